@@ -3,103 +3,40 @@
  * @brief Implementation of the Authentication class.
  * 
  * This class includes methods for authentication using JWT to the Magic Poi Lite server api. 
- * It also has methods to save and load the JWT token from LittleFS. 
+ * The JWT token itself is kept in the shared Session, which saves and loads it from LittleFS. 
  */
 
 
 #include "Authentication.h"
 #include <Arduino.h>
-#include <LittleFS.h>
 #include <secrets.h>
 #include <WiFiClient.h>
 #include <ESP8266HTTPClient.h>
 #include <ArduinoJson.h>
+#include <Telemetry.h>
+#include <Metrics.h>
+#include <Tracer.h>
 
 /**
- * @brief Default constructor for Authentication class.
- * 
- * This constructor initializes the Authentication object by clearing the jwtToken buffer.
+ * @brief Prints the last few characters of the JWT token, enough to tell tokens apart without giving one away.
+ *
+ * @param token The token.
  */
-Authentication::Authentication()
+static void printTokenEnd(const char *token)
 {
-    // Initialize variables
-    memset(jwtToken, 0, sizeof(jwtToken)); // Clear jwtToken buffer
+    size_t length = strlen(token);
+    Serial.print("token ...");
+    Serial.println(token + (length > 6 ? length - 6 : 0));
 }
 
 
 /**
- * @brief Reads JWT token from a file stored on LittleFS.
- * 
- * This method attempts to read a JWT token from a file stored on LittleFS (Little File System).
- * If the file exists, it reads the token from the file and returns it. If the file does not exist
- * or if there's any failure during the file system operation, an empty string is returned.
+ * @brief Constructor for Authentication class.
  * 
- * @return A string containing the JWT token read from the file, or an empty string if the token couldn't be read.
+ * @param session The shared session that stores the JWT token and WiFi client.
  */
-String Authentication::readJWTTokenFromFile()
+Authentication::Authentication(Session &session) : session(session)
 {
-    String jwtToken = "";
-
-    if (LittleFS.begin())
-    {
-        if (LittleFS.exists(jwtFilePath))
-        {
-            File file = LittleFS.open(jwtFilePath, "r");
-            if (file)
-            {
-                jwtToken = file.readString();
-                file.close();
-            }
-            else
-            {
-                Serial.println("no file?");
-            }
-        }
-        else
-        {
-            Serial.println("file not found on LittleFS");
-        }
-        LittleFS.end();
-    }
-    else
-    {
-        Serial.println("LittlFS Failed to begin");
-    }
-
-    return jwtToken;
-}
-
-
-/**
- * @brief Saves a JWT token to a file on LittleFS.
- * 
- * This method attempts to save a JWT token to a file stored on LittleFS (Little File System).
- * If LittleFS initialization succeeds and the file is successfully created and written, 
- * a success message is printed to the Serial monitor. If there's any failure during 
- * the file system operation, an error message is printed.
- * 
- * @param token The JWT token to be saved to the file.
- */
-void Authentication::saveJWTTokenToFile(const char *token)
-{
-    if (LittleFS.begin())
-    {
-        File file = LittleFS.open(jwtFilePath, "w");
-        if (file)
-        {
-            file.print(token);
-            file.close();
-            Serial.println("JWT token saved to file.");
-        }
-        else
-        {
-            Serial.println("couldn't create file?");
-        }
-        LittleFS.end();
-    }
-    else{
-        Serial.println("Couldn't open Littlefs to write jwt");
-    }
 }
 
 
@@ -109,8 +46,8 @@ void Authentication::saveJWTTokenToFile(const char *token)
  * This method attempts to authenticate the client with the server by sending a POST request
  * to the login endpoint with the provided email and password. If the authentication is successful,
  * the JWT token received from the server is parsed and saved, and the method returns true.
- * If any error occurs during the HTTP request or JSON parsing, or if the server returns an error
- * response code, the method returns false.
+ * If any error occurs during the HTTP request or JSON parsing, if the server returns an error
+ * response code, or if the response has no token (the saved one is then kept), the method returns false. The request is ended on every path, so nothing is left open.
  * 
  * @return true if the authentication is successful, false otherwise.
  */
@@ -119,45 +56,68 @@ bool Authentication::authenticate()
     Serial.println("Authenticating...");
 
     HTTPClient http;
-    http.begin(client, "http://" + String(serverIP) + ":" + String(serverPort) + "/api/login");
+    if (!session.beginRequest(http, "/api/login"))
+    {
+        Serial.println("Couldn't start the login request.");
+        metrics.request(false, 0);
+        session.endRequest(http);
+        return false;
+    }
     http.addHeader("Content-Type", "application/json");
 
     Serial.println("[HTTP] POST...");
+    unsigned long startTime = millis();
+    uint32_t traceStart = micros();
     int httpCode = http.POST("{\"email\":\"" + String(email) + "\",\"password\":\"" + String(passwordJwt) + "\"}");
 
+    tracer.add(Tracer::LOGIN_FIRST_BYTE, micros() - traceStart);
+
     // httpCode will be negative on error
     if (httpCode > 0)
     {
         if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_CREATED)
         {
+            Tracer::Span span(Tracer::LOGIN_BODY);
             // Parse the response JSON to get the token
-            DynamicJsonDocument doc(1024);
-            DeserializationError error = deserializeJson(doc, http.getString());
+            JsonDocument doc;
+            String response = http.getString();
+            telemetry.netResult(Telemetry::ENDPOINT_LOGIN, httpCode, response.length(), millis() - startTime);
+            metrics.request(true, response.length());
+            session.endRequest(http);
+            DeserializationError error = deserializeJson(doc, response);
             if (error)
             {
                 Serial.println("Failed to parse JSON.");
                 return false;
             }
 
-            strcpy(token, doc["token"]);
-            Serial.println("Authentication successful.");
-            Serial.println(token);
-            gotToken = true;
-            saveJWTTokenToFile(token); //save for next time, so we won't need to do this again. 
+            const char *token = doc["token"] | "";
+            if (token[0] == '\0')
+            {
+                Serial.println("No token in the response, keeping the saved one.");
+                return false;
+            }
+            session.setToken(token); // also saved for next time, so we won't need to do this again.
+            Serial.print("Authentication successful, ");
+            printTokenEnd(session.getToken());
             return true;
         }
         else
         {
             Serial.print("[HTTP] Error code: ");
             Serial.println(httpCode);
+            telemetry.netResult(Telemetry::ENDPOINT_LOGIN, httpCode, 0, millis() - startTime);
+            metrics.request(false, 0);
         }
     }
     else
     {
         Serial.println("Connection failed.");
+        telemetry.netResult(Telemetry::ENDPOINT_LOGIN, httpCode, 0, millis() - startTime);
+        metrics.request(false, 0);
     }
 
-    http.end();
+    session.endRequest(http);
     return false;
 
     // bool isAuthenticated = true; // Simulated result
@@ -169,7 +129,7 @@ bool Authentication::authenticate()
  * @brief Checks for a saved JWT token and loads it if available.
  * 
  * This method checks if a JWT token is saved in a file. If a token is found,
- * it loads the token into the internal token buffer. If no token is found,
+ * it loads the token into the shared session. If no token is found,
  * the method returns false.
  * 
  * @return true if a saved token is successfully loaded, false otherwise.
@@ -177,16 +137,10 @@ bool Authentication::authenticate()
 bool Authentication::checkSavedToken()
 {
     // check for saved token, load
-    String savedToken = readJWTTokenFromFile();
-    if (!savedToken.isEmpty())
+    if (session.reloadToken())
     {
-        strncpy(token, savedToken.c_str(), sizeof(token) - 1);
-        token[sizeof(token) - 1] = '\0'; // Null-terminate the token string
-        // strncpy(jwtToken, savedToken.c_str(), sizeof(jwtToken) - 1);
-        // jwtToken[sizeof(jwtToken) - 1] = '\0'; // Null-terminate the token string
-        gotToken = true;
-        Serial.println("Using saved JWT token:");
-        Serial.println(token);
+        Serial.print("Using saved JWT ");
+        printTokenEnd(session.getToken());
         return true;
     }
     else
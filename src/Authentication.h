@@ -2,7 +2,7 @@
 #define AUTHENTICATION_H
 
 #include <Arduino.h>
-#include <WiFiClient.h>
+#include <Session.h>
 
 /**
  * @file Authentication.h
@@ -11,45 +11,17 @@
 
 class Authentication {
 public:
-    Authentication(); // Constructor declaration
-    String readJWTTokenFromFile();
-    void saveJWTTokenToFile(const char *token);
+    Authentication(Session &session); // Constructor declaration
     bool authenticate();
     bool checkSavedToken();
 
 private:
     /**
-     * @brief Buffer for JWT token.
+     * @brief Shared session object.
      *
-     * This buffer stores the JWT token retrieved from authentication.
+     * This object holds the JWT token and the WiFi client used for network communication with the server.
      */
-    char token[500];
-
-    /**
-     * @brief Buffer for JWT token.
-     *
-     * This buffer stores the JWT token retrieved from LittleFS.
-     */
-    char jwtToken[500];
-
-    /**
-     * @brief Flag indicating whether a token has been retrieved.
-     */
-    boolean gotToken = false;
-
-    /**
-     * @brief Path to the file storing JWT token.
-     *
-     * This string represents the file path of the file storing the JWT token in LittleFS.
-     */
-    const char *jwtFilePath = "/jwt.txt";
-
-    /**
-     * @brief WiFi client object.
-     *
-     * This object is used for network communication with the server.
-     */
-    WiFiClient client;
+    Session &session;
 };
 
 #endif
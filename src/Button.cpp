@@ -0,0 +1,49 @@
+/**
+ * @file Button.cpp
+ * @brief Implementation of the Button class.
+ *
+ * Debounces a push button in its interrupt handler. The interrupt fires on every change of
+ * the pin, and a press only counts if the pin goes LOW after being quiet for debounceTime.
+ * The first edge of a press is taken straight away, with no delay, while the bounces that
+ * follow it and the bounces when the button is let go are all ignored, because each comes
+ * within a few milliseconds of the edge before it.
+ */
+
+
+#include "Button.h"
+#include <Arduino.h>
+
+/**
+ * @brief Constructor for Button class.
+ *
+ * @param pin Pin the button is on, between the pin and ground.
+ */
+Button::Button(int pin) : pin(pin)
+{
+}
+
+
+/**
+ * @brief Sets up the pin and its interrupt.
+ *
+ * @param handler Interrupt handler for the pin, which should call pressed().
+ */
+void Button::begin(void (*handler)())
+{
+    pinMode(pin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(pin), handler, CHANGE);
+}
+
+
+/**
+ * @brief Checks whether a pin change is a new press. Call from the pin's interrupt handler.
+ *
+ * @return true if the button was just pressed, false for bounces and releases.
+ */
+bool ICACHE_RAM_ATTR Button::pressed()
+{
+    unsigned long now = millis();
+    bool quiet = now - lastEdge >= debounceTime;
+    lastEdge = now;
+    return quiet && digitalRead(pin) == LOW;
+}
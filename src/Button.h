@@ -0,0 +1,35 @@
+#ifndef BUTTON_H
+#define BUTTON_H
+
+#include <Arduino.h>
+
+/**
+ * @file Button.h
+ * @brief Declaration of the Button class.
+ */
+
+class Button
+{
+public:
+    Button(int pin); // Constructor declaration
+    void begin(void (*handler)());
+    bool pressed();
+
+private:
+    /**
+     * @brief How long the pin must be quiet before a press counts, in milliseconds.
+     */
+    static const unsigned long debounceTime = 30;
+
+    /**
+     * @brief Pin the button is on, pulled up, pressed is LOW.
+     */
+    int pin;
+
+    /**
+     * @brief millis() at the last change of the pin, bounces included.
+     */
+    volatile unsigned long lastEdge = 0;
+};
+
+#endif
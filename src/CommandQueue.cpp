@@ -0,0 +1,122 @@
+/**
+ * @file CommandQueue.cpp
+ * @brief Implementation of the CommandQueue class.
+ *
+ * Carries commands from the button interrupts to loop() without locks. There is one producer
+ * (the pin interrupts, which don't interrupt each other) and one consumer (loop()): push() only
+ * writes head and pop() only writes tail, and each publishes its index after the slot is done
+ * with, so neither side ever sees a half written command and interrupts never have to be disabled.
+ * Commands typed on the Serial monitor are parsed with parse() and handled directly in loop().
+ */
+
+
+#include "CommandQueue.h"
+#include <Arduino.h>
+
+/**
+ * @brief Command names, as typed on the Serial monitor, indexed by Type.
+ */
+static const char *const commandNames[] = {"", "refresh", "next", "startstop", "start", "stop", "resync", "rate", "profile", "swap", "sync", "metrics", "trace", "clock"};
+
+// Constructor definition
+CommandQueue::CommandQueue()
+{
+}
+
+
+/**
+ * @brief Adds a command. Call from the interrupt handlers only.
+ *
+ * @param type The command.
+ * @param time micros() when it was given.
+ * @return true if it was queued, false if the queue is full (the command is dropped).
+ */
+bool ICACHE_RAM_ATTR CommandQueue::push(Type type, uint32_t time)
+{
+    uint8_t next = (head + 1) & (size - 1);
+    if (next == tail)
+    {
+        dropped++;
+        return false;
+    }
+
+    commands[head].type = type;
+    commands[head].time = time;
+    asm volatile("" ::: "memory"); // the slot is written before it is published
+    head = next;
+    return true;
+}
+
+
+/**
+ * @brief Takes the oldest command. Call from loop() only.
+ *
+ * @param command Set to the command.
+ * @return true if there was a command, false if the queue is empty.
+ */
+bool CommandQueue::pop(Command &command)
+{
+    if (tail == head)
+    {
+        return false;
+    }
+
+    command = commands[tail];
+    asm volatile("" ::: "memory"); // the slot is read before it is given back
+    tail = (tail + 1) & (size - 1);
+    return true;
+}
+
+
+/**
+ * @brief Returns the number of commands lost because the queue was full.
+ *
+ * @return Number of dropped commands since startup.
+ */
+uint32_t CommandQueue::getDropped()
+{
+    return dropped;
+}
+
+
+/**
+ * @brief Parses a command typed on the Serial monitor.
+ *
+ * @param text The command name, e.g. "refresh", optionally followed by a space and an argument.
+ *             The space is replaced with a null character.
+ * @param type Set to the command.
+ * @param argument Set to the argument, or an empty string if there is none.
+ * @return true if the command is known, false otherwise.
+ */
+bool CommandQueue::parse(char *text, Type &type, const char *&argument)
+{
+    char *space = strchr(text, ' ');
+    argument = "";
+    if (space)
+    {
+        *space = '\0';
+        argument = space + 1;
+    }
+
+    for (uint8_t i = REFRESH; i <= CLOCK; i++)
+    {
+        if (strcmp(text, commandNames[i]) == 0)
+        {
+            type = (Type)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Returns the name of a command.
+ *
+ * @param type The command.
+ * @return Name of the command, as typed on the Serial monitor.
+ */
+const char *CommandQueue::name(Type type)
+{
+    return type >= REFRESH && type <= CLOCK ? commandNames[type] : "unknown";
+}
@@ -0,0 +1,75 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <Arduino.h>
+
+/**
+ * @file CommandQueue.h
+ * @brief Declaration of the CommandQueue class.
+ */
+
+class CommandQueue
+{
+public:
+    /**
+     * @brief Commands from the buttons and the Serial monitor.
+     */
+    enum Type : uint8_t {
+        REFRESH = 1,        ///< fetch the timeline from the server again
+        NEXT_TIMELINE = 2,  ///< play the next timeline (downloaded, then the embedded ones)
+        START_STOP = 3,     ///< start playing from the beginning if stopped, stop if playing
+        START = 4,          ///< start playing from the beginning
+        STOP = 5,           ///< stop playing and switch the LEDs off
+        RESYNC = 6,         ///< jump back to the beginning of the timeline now
+        RATE = 7,           ///< set the playback rate (Serial monitor only, e.g. "rate 1.05")
+        PROFILE = 8,        ///< print the loop profile and start again (Serial monitor only)
+        SWAP = 9,           ///< set when a new timeline takes over, e.g. "swap loop" (Serial monitor only)
+        SYNC = 10,          ///< print the state of the troupe sync (Serial monitor only)
+        METRICS = 11,       ///< print the metrics, as served on /metrics (Serial monitor only)
+        TRACE = 12,         ///< print the phases of the last refreshes (Serial monitor only)
+        CLOCK = 13          ///< print the wall-clock time and any scheduled start (Serial monitor only)
+    };
+
+    /**
+     * @brief A command and when it was given.
+     */
+    struct Command {
+        Type type;
+        uint32_t time; ///< micros() when the button was pressed
+    };
+
+    CommandQueue(); // Constructor declaration
+    bool push(Type type, uint32_t time);
+    bool pop(Command &command);
+    uint32_t getDropped();
+    static bool parse(char *text, Type &type, const char *&argument);
+    static const char *name(Type type);
+
+private:
+    /**
+     * @brief Number of slots in the queue, a power of two. One is always left empty.
+     */
+    static const uint8_t size = 8;
+
+    /**
+     * @brief The queued commands.
+     */
+    Command commands[size];
+
+    /**
+     * @brief Index of the next slot to write. Only changed by push().
+     */
+    volatile uint8_t head = 0;
+
+    /**
+     * @brief Index of the next slot to read. Only changed by pop().
+     */
+    volatile uint8_t tail = 0;
+
+    /**
+     * @brief Number of commands lost because the queue was full.
+     */
+    volatile uint32_t dropped = 0;
+};
+
+#endif
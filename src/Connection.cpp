@@ -0,0 +1,290 @@
+/**
+ * @file Connection.cpp
+ * @brief Implementation of the Connection class.
+ * 
+ * Non-blocking WiFi connection manager. Each attempt has a time budget for associating with
+ * the access point and for DHCP. Failed attempts are retried with exponential backoff plus jitter,
+ * and the timing of every attempt is printed to the Serial monitor.
+ * The BSSID, channel and IP settings of the last connection are cached in RTC memory (and LittleFS),
+ * so a reconnect goes straight to the right access point with a static IP, skipping the scan and DHCP.
+ * A full scan with DHCP is only done when that fails.
+ * Call poll() from loop(); it never blocks, so playback keeps running while connecting.
+ */
+
+
+#include "Connection.h"
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include <coredecls.h>
+#include <RtcLayout.h>
+#include <Metrics.h>
+
+/**
+ * @brief Constructor for Connection class.
+ * 
+ * @param ssid WiFi network name.
+ * @param password WiFi password.
+ */
+Connection::Connection(const char *ssid, const char *password) : ssid(ssid), password(password)
+{
+}
+
+
+/**
+ * @brief Starts connecting to WiFi.
+ * 
+ * Call this once from setup(). Returns immediately.
+ */
+void Connection::begin()
+{
+    WiFi.persistent(false); // the SDK doesn't need to write the settings to flash on every begin()
+    WiFi.mode(WIFI_STA);
+    cacheValid = loadCache();
+    connectedHandler = WiFi.onStationModeConnected([this](const WiFiEventStationModeConnected &) {
+        associatedTime = millis();
+    });
+    attempt = 0;
+    nextBackoff = minBackoff;
+    startAttempt();
+}
+
+
+/**
+ * @brief Advances the connection, retrying or backing off as needed.
+ * 
+ * Call this from loop(). It only checks timestamps and WiFi status, so it never blocks.
+ * 
+ * @return true if WiFi is connected and has an IP address, false otherwise.
+ */
+bool Connection::poll()
+{
+    unsigned long now = millis();
+
+    switch (state)
+    {
+    case ASSOCIATING:
+        if (associatedTime != 0)
+        {
+            state = WAITING_FOR_IP;
+        }
+        else if (now - attemptStartTime >= (fastAttempt ? fastAssociateTimeout : associateTimeout))
+        {
+            failAttempt("associate");
+        }
+        break;
+    case WAITING_FOR_IP:
+        if (WiFi.status() == WL_CONNECTED)
+        {
+            state = CONNECTED;
+            Serial.print("WiFi attempt ");
+            Serial.print(attempt);
+            Serial.print(": associated in ");
+            Serial.print(associatedTime - attemptStartTime);
+            Serial.print(" ms, IP after ");
+            Serial.print(now - associatedTime);
+            Serial.print(" ms, IP address: ");
+            Serial.println(WiFi.localIP());
+            attempt = 0;
+            nextBackoff = minBackoff;
+            metrics.wifiConnected();
+            saveCache();
+        }
+        else if (now - associatedTime >= dhcpTimeout)
+        {
+            failAttempt("dhcp");
+        }
+        break;
+    case CONNECTED:
+        if (WiFi.status() != WL_CONNECTED)
+        {
+            Serial.println("WiFi connection lost");
+            metrics.wifiLost();
+            startAttempt();
+        }
+        break;
+    case BACKOFF:
+        if (now - backoffStartTime >= backoffDelay)
+        {
+            startAttempt();
+        }
+        break;
+    default:
+        break;
+    }
+
+    return state == CONNECTED;
+}
+
+
+/**
+ * @brief Checks whether WiFi is connected.
+ * 
+ * @return true if connected with an IP address, as of the last poll().
+ */
+bool Connection::isConnected()
+{
+    return state == CONNECTED;
+}
+
+
+/**
+ * @brief Starts a new connection attempt.
+ */
+void Connection::startAttempt()
+{
+    attempt++;
+    associatedTime = 0;
+    attemptStartTime = millis();
+    state = ASSOCIATING;
+    fastAttempt = cacheValid;
+    Serial.print("Connecting to WiFi, attempt ");
+    Serial.print(attempt);
+    if (fastAttempt)
+    {
+        Serial.print(" (cached, channel ");
+        Serial.print(cache.channel);
+        Serial.println(")");
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(ssid, password, cache.channel, cache.bssid);
+    }
+    else
+    {
+        Serial.println();
+        WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u)); // back to DHCP
+        WiFi.begin(ssid, password);
+    }
+}
+
+
+/**
+ * @brief Gives up on the current attempt and schedules the next one.
+ * 
+ * The backoff doubles after every failure up to maxBackoff, with up to 50% random jitter added
+ * so a group of poi rebooted together don't all retry at the same moment.
+ * 
+ * @param phase Name of the phase that ran out of time, for the log.
+ */
+void Connection::failAttempt(const char *phase)
+{
+    WiFi.disconnect(); // stop the SDK retrying on its own during the backoff
+    metrics.wifiAttemptFailed();
+
+    if (fastAttempt)
+    {
+        // the cached AP or IP settings didn't work: forget them and do a full scan straight away
+        Serial.print("WiFi cached connect failed at ");
+        Serial.print(phase);
+        Serial.print(" after ");
+        Serial.print(millis() - attemptStartTime);
+        Serial.println(" ms, scanning");
+        cacheValid = false;
+        startAttempt();
+        return;
+    }
+
+    backoffDelay = nextBackoff + ESP.random() % (nextBackoff / 2 + 1);
+    nextBackoff = min(nextBackoff * 2, maxBackoff);
+    backoffStartTime = millis();
+    state = BACKOFF;
+
+    Serial.print("WiFi attempt ");
+    Serial.print(attempt);
+    Serial.print(": ");
+    Serial.print(phase);
+    Serial.print(" timed out after ");
+    Serial.print(backoffStartTime - attemptStartTime);
+    Serial.print(" ms, retrying in ");
+    Serial.print(backoffDelay);
+    Serial.println(" ms");
+}
+
+
+/**
+ * @brief Loads the WiFi cache from RTC memory, or from LittleFS after a power cycle.
+ * 
+ * @return true if a valid cache entry for this SSID was found, false otherwise.
+ */
+bool Connection::loadCache()
+{
+    uint32_t ssidHash = crc32(ssid, strlen(ssid));
+
+    if (ESP.rtcUserMemoryRead(RTC_WIFI_CACHE_BLOCK, (uint32_t *)&cache, sizeof(cache)) &&
+        cache.crc == cacheCrc() && cache.ssidHash == ssidHash)
+    {
+        return true;
+    }
+
+    bool found = false;
+    if (LittleFS.begin())
+    {
+        metrics.opened(Metrics::FS_MOUNT);
+        File file = LittleFS.open(cacheFilePath, "r");
+        if (file)
+        {
+            metrics.opened(Metrics::OPEN_FILE);
+            found = file.read((uint8_t *)&cache, sizeof(cache)) == sizeof(cache) &&
+                    cache.crc == cacheCrc() && cache.ssidHash == ssidHash;
+            file.close();
+            metrics.closed(Metrics::OPEN_FILE);
+        }
+        LittleFS.end();
+        metrics.closed(Metrics::FS_MOUNT);
+    }
+    if (found)
+    {
+        ESP.rtcUserMemoryWrite(RTC_WIFI_CACHE_BLOCK, (uint32_t *)&cache, sizeof(cache));
+    }
+    return found;
+}
+
+
+/**
+ * @brief Saves the details of the current connection to the WiFi cache.
+ * 
+ * RTC memory is always updated; LittleFS is only written when something changed, to save flash wear.
+ */
+void Connection::saveCache()
+{
+    WiFiCache current;
+    memset(&current, 0, sizeof(current));
+    current.ssidHash = crc32(ssid, strlen(ssid));
+    memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+    current.channel = WiFi.channel();
+    current.ip = WiFi.localIP();
+    current.gateway = WiFi.gatewayIP();
+    current.subnet = WiFi.subnetMask();
+    current.dns = WiFi.dnsIP();
+
+    bool changed = !cacheValid || memcmp(&current.ssidHash, &cache.ssidHash, sizeof(cache) - sizeof(cache.crc)) != 0;
+    cache = current;
+    cache.crc = cacheCrc();
+    cacheValid = true;
+    ESP.rtcUserMemoryWrite(RTC_WIFI_CACHE_BLOCK, (uint32_t *)&cache, sizeof(cache));
+
+    if (changed && LittleFS.begin())
+    {
+        metrics.opened(Metrics::FS_MOUNT);
+        File file = LittleFS.open(cacheFilePath, "w");
+        if (file)
+        {
+            metrics.opened(Metrics::OPEN_FILE);
+            file.write((const uint8_t *)&cache, sizeof(cache));
+            file.close();
+            metrics.closed(Metrics::OPEN_FILE);
+        }
+        LittleFS.end();
+        metrics.closed(Metrics::FS_MOUNT);
+    }
+}
+
+
+/**
+ * @brief Calculates the checksum of the WiFi cache, covering everything after the crc field.
+ * 
+ * @return CRC32 of the cache contents.
+ */
+uint32_t Connection::cacheCrc()
+{
+    return crc32((const uint8_t *)&cache + sizeof(cache.crc), sizeof(cache) - sizeof(cache.crc));
+}
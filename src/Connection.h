@@ -0,0 +1,152 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+/**
+ * @file Connection.h
+ * @brief Declaration of the Connection class.
+ */
+
+class Connection {
+public:
+    Connection(const char *ssid, const char *password); // Constructor declaration
+    void begin();
+    bool poll();
+    bool isConnected();
+
+    /**
+     * @brief Time budget for each HTTP request, in milliseconds.
+     *
+     * HTTPClient uses one TCP timeout for both connecting and waiting for the response,
+     * so this bounds each of those phases of a request.
+     */
+    static const uint16_t httpTimeout = 5000;
+
+private:
+    enum State { IDLE, ASSOCIATING, WAITING_FOR_IP, CONNECTED, BACKOFF };
+
+    /**
+     * @brief Details of the last successful connection, for reconnecting without a scan or DHCP.
+     *
+     * Kept in RTC memory, with a copy in LittleFS for after a power cycle.
+     */
+    struct WiFiCache {
+        uint32_t crc;
+        uint32_t ssidHash;
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint8_t reserved;
+        uint32_t ip;
+        uint32_t gateway;
+        uint32_t subnet;
+        uint32_t dns;
+    };
+
+    void startAttempt();
+    void failAttempt(const char *phase);
+    bool loadCache();
+    void saveCache();
+    uint32_t cacheCrc();
+
+    /**
+     * @brief Time budget for associating with the access point, in milliseconds.
+     */
+    static const unsigned long associateTimeout = 10000;
+
+    /**
+     * @brief Time budget for associating using the cached BSSID and channel, in milliseconds.
+     *
+     * A direct connect takes a few hundred milliseconds; if it takes longer the AP has probably
+     * changed, so fall back to a full scan straight away.
+     */
+    static const unsigned long fastAssociateTimeout = 2000;
+
+    /**
+     * @brief Time budget for getting an IP address by DHCP after associating, in milliseconds.
+     */
+    static const unsigned long dhcpTimeout = 5000;
+
+    /**
+     * @brief Backoff after the first failed attempt, in milliseconds. Doubles on each failure.
+     */
+    static const unsigned long minBackoff = 1000;
+
+    /**
+     * @brief Longest backoff between attempts, in milliseconds.
+     */
+    static const unsigned long maxBackoff = 60000;
+
+    /**
+     * @brief WiFi network name.
+     */
+    const char *ssid;
+
+    /**
+     * @brief WiFi password.
+     */
+    const char *password;
+
+    /**
+     * @brief Current phase of the connection.
+     */
+    State state = IDLE;
+
+    /**
+     * @brief Number of the current attempt since the last successful connection.
+     */
+    int attempt = 0;
+
+    /**
+     * @brief Timestamp when the current attempt started.
+     */
+    unsigned long attemptStartTime = 0;
+
+    /**
+     * @brief Timestamp when the access point accepted the association, 0 if it hasn't yet.
+     */
+    volatile unsigned long associatedTime = 0;
+
+    /**
+     * @brief Timestamp when the current backoff started.
+     */
+    unsigned long backoffStartTime = 0;
+
+    /**
+     * @brief Length of the current backoff including jitter, in milliseconds.
+     */
+    unsigned long backoffDelay = 0;
+
+    /**
+     * @brief Backoff before jitter, doubled after every failed attempt.
+     */
+    unsigned long nextBackoff = minBackoff;
+
+    /**
+     * @brief Path of the copy of the WiFi cache in LittleFS.
+     */
+    const char *cacheFilePath = "/wifi.bin";
+
+    /**
+     * @brief Cached details of the last successful connection.
+     */
+    WiFiCache cache;
+
+    /**
+     * @brief Flag indicating whether cache holds a valid entry for this SSID.
+     */
+    bool cacheValid = false;
+
+    /**
+     * @brief Flag indicating whether the current attempt uses the cache.
+     */
+    bool fastAttempt = false;
+
+    /**
+     * @brief Handler for the station connected (associated) event.
+     */
+    WiFiEventHandler connectedHandler;
+};
+
+#endif
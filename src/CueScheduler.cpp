@@ -0,0 +1,138 @@
+/**
+ * @file CueScheduler.cpp
+ * @brief Implementation of the CueScheduler class.
+ *
+ * Merges the cues of several tracks into one stream in time order. Each track with cues left
+ * has one entry in a small min-heap, keyed by the time of its next cue, so finding the next
+ * cue is O(1) and moving a track on to its following cue is O(log k) for k tracks, however
+ * many cues there are in total. Cues due at the same time come out in track order.
+ */
+
+
+#include "CueScheduler.h"
+#include <Arduino.h>
+
+// Constructor definition
+CueScheduler::CueScheduler()
+{
+}
+
+
+/**
+ * @brief Removes all tracks.
+ */
+void CueScheduler::clear()
+{
+    size = 0;
+}
+
+
+/**
+ * @brief Adds the next cue of a track.
+ *
+ * @param track Index of the track.
+ * @param time Time of the track's next cue in milliseconds from the start of the timeline.
+ * @return true if it was added, false if the heap is full.
+ */
+bool CueScheduler::push(int track, long time)
+{
+    if (size >= maxEntries)
+    {
+        return false;
+    }
+
+    int i = size++;
+    heap[i].time = time;
+    heap[i].track = track;
+    while (i > 0 && before(heap[i], heap[(i - 1) / 2]))
+    {
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Removes the track with the earliest next cue.
+ *
+ * Push the track again with the time of its following cue, if it has one.
+ *
+ * @return Index of the track, or -1 if there are none.
+ */
+int CueScheduler::pop()
+{
+    if (size == 0)
+    {
+        return -1;
+    }
+
+    int track = heap[0].track;
+    heap[0] = heap[--size];
+    int i = 0;
+    while (true)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < size && before(heap[left], heap[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < size && before(heap[right], heap[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            break;
+        }
+        swap(i, smallest);
+        i = smallest;
+    }
+    return track;
+}
+
+
+/**
+ * @brief Checks whether any track has cues left.
+ *
+ * @return true if there are no cues left, false otherwise.
+ */
+bool CueScheduler::isEmpty()
+{
+    return size == 0;
+}
+
+
+/**
+ * @brief Returns the time of the earliest next cue.
+ *
+ * @return Time of the cue in milliseconds from the start of the timeline, or -1 if there are none.
+ */
+long CueScheduler::nextTime()
+{
+    return size > 0 ? heap[0].time : -1;
+}
+
+
+/**
+ * @brief Orders entries by time, then by track.
+ *
+ * @return true if a comes before b.
+ */
+bool CueScheduler::before(const Entry &a, const Entry &b)
+{
+    return a.time < b.time || (a.time == b.time && a.track < b.track);
+}
+
+
+/**
+ * @brief Swaps two heap entries.
+ */
+void CueScheduler::swap(int a, int b)
+{
+    Entry entry = heap[a];
+    heap[a] = heap[b];
+    heap[b] = entry;
+}
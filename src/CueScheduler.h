@@ -0,0 +1,49 @@
+#ifndef CUESCHEDULER_H
+#define CUESCHEDULER_H
+
+#include <Arduino.h>
+
+/**
+ * @file CueScheduler.h
+ * @brief Declaration of the CueScheduler class.
+ */
+
+class CueScheduler
+{
+public:
+    /**
+     * @brief Largest number of tracks that can be scheduled at once.
+     */
+    static const int maxEntries = 4;
+
+    CueScheduler(); // Constructor declaration
+    void clear();
+    bool push(int track, long time);
+    int pop();
+    bool isEmpty();
+    long nextTime();
+
+private:
+    /**
+     * @brief The next cue of one track.
+     */
+    struct Entry {
+        long time;
+        uint8_t track;
+    };
+
+    bool before(const Entry &a, const Entry &b);
+    void swap(int a, int b);
+
+    /**
+     * @brief Binary min-heap of the next cue of each track, earliest first.
+     */
+    Entry heap[maxEntries];
+
+    /**
+     * @brief Number of entries in the heap.
+     */
+    int size = 0;
+};
+
+#endif
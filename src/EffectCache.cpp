@@ -0,0 +1,271 @@
+/**
+ * @file EffectCache.cpp
+ * @brief Implementation of the EffectCache class.
+ *
+ * Frames of the effects of cues (fades, pulses and strobes), rendered ahead of the cues that show
+ * them. Rendering a frame of a fade takes square roots and interpolation; showing one takes a look up
+ * in a few slots and a division, the same for any effect, so effects never compete with the timing of
+ * cues. Playing::renderAhead() prepares the effects of the next few cues of each track and renders
+ * their frames a few at a time, in the idle time between cues.
+ *
+ * An effect is rendered to at most maxFrames frames, frameInterval ms apart or further apart for a
+ * long one, as PWM duties from the palette of the Output. The frames of an effect are kept for as
+ * long as it is used; cues with the same effect, the same colours and period, share them, and when
+ * the cache is full the least recently used effect makes room. A frame that isn't rendered in time
+ * is rendered on the spot. The cache is cleared when the palette changes.
+ */
+
+
+#include "EffectCache.h"
+#include <Arduino.h>
+#include <Metrics.h>
+
+// Constructor definition
+EffectCache::EffectCache(Output &output) : output(output)
+{
+    clear();
+}
+
+
+/**
+ * @brief Makes room for the frames of an effect in the cache, for render() to render.
+ *
+ * @param effect The effect.
+ * @return true if it is in the cache, false if it has no frames (SOLID).
+ */
+bool EffectCache::prepare(const Effect &effect)
+{
+    if (effect.type == SOLID || effect.type >= TYPE_COUNT)
+    {
+        return false;
+    }
+    Slot *slot = find(effect);
+    if (!slot)
+    {
+        slot = &slots[0];
+        for (int i = 1; i < slotCount && slot->used; i++)
+        {
+            if (!slots[i].used || slots[i].lastUsed < slot->lastUsed)
+            {
+                slot = &slots[i];
+            }
+        }
+        slot->effect = effect;
+        slot->used = true;
+        slot->rendered = 0;
+        layout(effect, slot->frameCount, slot->step);
+    }
+    slot->lastUsed = ++useCount;
+    return true;
+}
+
+
+/**
+ * @brief Renders frames of the prepared effects, most recently prepared first.
+ *
+ * @param budget Largest number of frames to render.
+ * @return true if there are frames left to render, false otherwise.
+ */
+bool EffectCache::render(int budget)
+{
+    while (true)
+    {
+        Slot *next = nullptr;
+        for (int i = 0; i < slotCount; i++)
+        {
+            if (slots[i].used && slots[i].rendered < slots[i].frameCount &&
+                (!next || slots[i].lastUsed > next->lastUsed))
+            {
+                next = &slots[i];
+            }
+        }
+        if (!next)
+        {
+            return false;
+        }
+        if (budget-- <= 0)
+        {
+            return true;
+        }
+        renderFrame(next->effect, next->frameCount, next->rendered, next->frames[next->rendered]);
+        next->rendered++;
+    }
+}
+
+
+/**
+ * @brief Returns the frame of an effect for a time since its cue.
+ *
+ * @param effect The effect, not SOLID.
+ * @param elapsed Time since the cue, in ms.
+ * @return PWM duties of the frame, for Output::setFrame(). Valid until the next call.
+ */
+const uint16_t *EffectCache::frame(const Effect &effect, long elapsed)
+{
+    Slot *slot = find(effect);
+    if (slot)
+    {
+        int index = frameIndex(effect, slot->frameCount, slot->step, elapsed);
+        if (index < slot->rendered)
+        {
+            slot->lastUsed = ++useCount;
+            metrics.effectFrame(true);
+            return slot->frames[index];
+        }
+    }
+
+    // not rendered in time: render this frame now, and the rest in the idle time
+    metrics.effectFrame(false);
+    prepare(effect);
+    uint8_t frameCount;
+    uint16_t step;
+    layout(effect, frameCount, step);
+    renderFrame(effect, frameCount, frameIndex(effect, frameCount, step, elapsed), missFrame);
+    return missFrame;
+}
+
+
+/**
+ * @brief Returns when the frame after the one for a time since its cue is due.
+ *
+ * @param effect The effect, not SOLID.
+ * @param elapsed Time since the cue, in ms.
+ * @return Time of the next frame since the cue in ms, or -1 if the effect has ended (a FADE holds its last frame).
+ */
+long EffectCache::nextFrame(const Effect &effect, long elapsed)
+{
+    uint8_t frameCount;
+    uint16_t step;
+    layout(effect, frameCount, step);
+    elapsed = max(elapsed, 0L);
+    if (effect.type == FADE && elapsed / step >= frameCount - 1)
+    {
+        return -1;
+    }
+    return (elapsed / step + 1) * step;
+}
+
+
+/**
+ * @brief Empties the cache, e.g. because the palette the frames were rendered from changed.
+ */
+void EffectCache::clear()
+{
+    for (int i = 0; i < slotCount; i++)
+    {
+        slots[i].used = false;
+    }
+}
+
+
+/**
+ * @brief Finds the frames of an effect in the cache.
+ *
+ * @return The slot, or nullptr if it isn't in the cache.
+ */
+EffectCache::Slot *EffectCache::find(const Effect &effect)
+{
+    for (int i = 0; i < slotCount; i++)
+    {
+        if (slots[i].used && same(slots[i].effect, effect))
+        {
+            return &slots[i];
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * @brief Checks whether two effects are the same, and so have the same frames.
+ */
+bool EffectCache::same(const Effect &a, const Effect &b)
+{
+    return a.type == b.type && a.colour == b.colour && a.colour2 == b.colour2 && a.period == b.period;
+}
+
+
+/**
+ * @brief Works out how many frames an effect has and how long each one is.
+ *
+ * @param effect The effect.
+ * @param frameCount Set to the number of frames, 2 to maxFrames.
+ * @param step Set to the time per frame in ms, frameInterval or more unless the period is shorter.
+ */
+void EffectCache::layout(const Effect &effect, uint8_t &frameCount, uint16_t &step)
+{
+    uint16_t period = max(effect.period, (uint16_t)minPeriod);
+    long count;
+    switch (effect.type)
+    {
+    case FADE:
+        count = constrain(period / frameInterval + 1, 2L, (long)maxFrames);
+        step = period / (count - 1);
+        break;
+    case PULSE:
+        count = constrain(period / frameInterval, 2L, (long)maxFrames);
+        step = period / count;
+        break;
+    default:
+        count = 2;
+        step = period / 2;
+        break;
+    }
+    frameCount = count;
+}
+
+
+/**
+ * @brief Returns the index of the frame for a time since the cue.
+ */
+int EffectCache::frameIndex(const Effect &effect, uint8_t frameCount, uint16_t step, long elapsed)
+{
+    long index = max(elapsed, 0L) / step;
+    if (effect.type == FADE)
+    {
+        return min(index, (long)frameCount - 1);
+    }
+    return index % frameCount;
+}
+
+
+/**
+ * @brief Renders one frame of an effect.
+ *
+ * Colours are mixed in the square root of the PWM duty, which undoes the gamma of Output, so a
+ * fade looks even from start to end.
+ *
+ * @param effect The effect.
+ * @param frameCount Number of frames it has, see layout().
+ * @param index Index of the frame.
+ * @param duties Set to the PWM duties of the frame.
+ */
+void EffectCache::renderFrame(const Effect &effect, uint8_t frameCount, int index, uint16_t duties[3])
+{
+    float mix; // 0 for colour, 1 for colour2
+    switch (effect.type)
+    {
+    case FADE:
+        mix = (float)index / (frameCount - 1);
+        break;
+    case PULSE:
+        mix = 2.0f * index / frameCount;
+        if (mix > 1.0f)
+        {
+            mix = 2.0f - mix;
+        }
+        break;
+    default:
+        mix = index;
+        break;
+    }
+
+    const uint16_t *from = output.getDuties(effect.colour);
+    static const uint16_t offDuties[3] = {0, 0, 0};
+    const uint16_t *to = effect.colour2 == off ? offDuties : output.getDuties(effect.colour2);
+    for (int c = 0; c < 3; c++)
+    {
+        float level = sqrtf(from[c]) + (sqrtf(to[c]) - sqrtf(from[c])) * mix;
+        duties[c] = level * level + 0.5f;
+    }
+}
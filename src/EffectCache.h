@@ -0,0 +1,109 @@
+#ifndef EFFECTCACHE_H
+#define EFFECTCACHE_H
+
+#include <Arduino.h>
+#include <Output.h>
+
+/**
+ * @file EffectCache.h
+ * @brief Declaration of the EffectCache class.
+ */
+
+class EffectCache
+{
+public:
+    /**
+     * @brief What a cue does with its colours.
+     */
+    enum Type : uint8_t {
+        SOLID = 0, ///< shows the colour, no frames
+        FADE,      ///< fades from the colour to colour2 over period ms, then holds colour2
+        PULSE,     ///< fades from the colour to colour2 and back every period ms
+        STROBE,    ///< shows the colour and colour2 in turn, each for half of period ms
+        TYPE_COUNT
+    };
+
+    /**
+     * @brief An effect, and the key of its frames in the cache.
+     */
+    struct Effect {
+        uint8_t type;
+        uint8_t colour;
+        int16_t colour2;  ///< palette index, or off
+        uint16_t period;  ///< in ms
+    };
+
+    EffectCache(Output &output); // Constructor declaration
+    bool prepare(const Effect &effect);
+    bool render(int budget);
+    const uint16_t *frame(const Effect &effect, long elapsed);
+    long nextFrame(const Effect &effect, long elapsed);
+    void clear();
+
+    /**
+     * @brief colour2 for off.
+     */
+    static const int16_t off = -1;
+
+    /**
+     * @brief Time between frames, in ms, unless an effect has more than maxFrames of them.
+     */
+    static const long frameInterval = 20;
+
+    /**
+     * @brief Shortest period, in ms, so a strobe never needs a frame more often than every frameInterval.
+     */
+    static const uint16_t minPeriod = 2 * frameInterval;
+
+private:
+    /**
+     * @brief Frames of one effect.
+     */
+    struct Slot {
+        Effect effect;
+        uint16_t frames[64][3];  ///< PWM duties of each frame, see Output::setFrame()
+        uint8_t frameCount;      ///< frames the effect has
+        uint8_t rendered;        ///< frames rendered so far, in order
+        uint16_t step;           ///< ms per frame
+        uint32_t lastUsed;       ///< useCount when it was last used, for evicting the least recently used
+        bool used;
+    };
+
+    Slot *find(const Effect &effect);
+    static bool same(const Effect &a, const Effect &b);
+    static void layout(const Effect &effect, uint8_t &frameCount, uint16_t &step);
+    static int frameIndex(const Effect &effect, uint8_t frameCount, uint16_t step, long elapsed);
+    void renderFrame(const Effect &effect, uint8_t frameCount, int index, uint16_t duties[3]);
+
+    /**
+     * @brief Most frames an effect has. A longer fade or pulse has longer frames.
+     */
+    static const int maxFrames = sizeof(Slot::frames) / sizeof(Slot::frames[0]);
+
+    /**
+     * @brief Number of effects the cache holds.
+     */
+    static const int slotCount = 6;
+
+    /**
+     * @brief The cache.
+     */
+    Slot slots[slotCount];
+
+    /**
+     * @brief Counts uses of the cache, to time stamp them.
+     */
+    uint32_t useCount = 0;
+
+    /**
+     * @brief A frame rendered on the spot, for an effect that isn't in the cache.
+     */
+    uint16_t missFrame[3];
+
+    /**
+     * @brief Output whose palette the colours are rendered from.
+     */
+    Output &output;
+};
+
+#endif
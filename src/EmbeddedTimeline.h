@@ -0,0 +1,75 @@
+#ifndef EMBEDDEDTIMELINE_H
+#define EMBEDDEDTIMELINE_H
+
+#include <Arduino.h>
+
+/**
+ * @file EmbeddedTimeline.h
+ * @brief Types for timelines built into the firmware.
+ *
+ * The tables themselves are generated from the .json files in timelines/ by tools/embed_timelines.py
+ * into EmbeddedTimelineData.h, and live in flash (PROGMEM).
+ */
+
+/**
+ * @brief One cue of an embedded timeline.
+ */
+struct EmbeddedCue {
+    /**
+     * @brief Time of the cue in milliseconds from the start of the timeline.
+     */
+    uint32_t time;
+
+    /**
+     * @brief Colour shown by the cue, an index into the palette.
+     */
+    uint8_t colour;
+};
+
+/**
+ * @brief An embedded timeline, already validated and normalised at build time.
+ */
+struct EmbeddedTimeline {
+    /**
+     * @brief Cues of each track in turn, in time order within the track, in flash.
+     */
+    const EmbeddedCue *cues;
+
+    /**
+     * @brief Number of cues, in all tracks.
+     */
+    uint32_t count;
+
+    /**
+     * @brief Number of cues in each track, in flash.
+     */
+    const uint32_t *trackCues;
+
+    /**
+     * @brief Number of tracks.
+     */
+    uint32_t trackCount;
+
+    /**
+     * @brief Palette of the timeline as red, green, blue levels, in flash, or nullptr to keep the current one.
+     */
+    const uint8_t (*palette)[3];
+
+    /**
+     * @brief Number of colours in the palette.
+     */
+    uint32_t paletteSize;
+
+    /**
+     * @brief Length of one pass of the timeline in milliseconds.
+     */
+    uint32_t loopLength;
+
+    /**
+     * @brief Checksum of the timeline, the same as Playing calculates for the same timeline downloaded
+     * (with no effects and no startAt), see timeline_id() in tools/embed_timelines.py.
+     */
+    uint32_t id;
+};
+
+#endif
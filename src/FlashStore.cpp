@@ -0,0 +1,683 @@
+/**
+ * @file FlashStore.cpp
+ * @brief Implementation of the FlashStore class.
+ *
+ * Timelines saved straight to a reserved region of flash, with no file system in between: loading
+ * one is a lookup in a small index in RAM and word aligned spi_flash_read() calls for its bytes,
+ * so it takes as long as the bytes take to read. Only built with TIMELINE_FLASH, which the
+ * d1_mini_lite_timeline_flash environment in platformio.ini sets together with the linker script
+ * (ld/eagle.flash.1m64.timeline.ld) that reserves the region, between the sketch and LittleFS.
+ *
+ * The region is split in two banks, each an append-only log of records: a header and the data padded
+ * to whole words. Flash bits can only be cleared without an erase, so each header word is written
+ * once, in order, and the record counts only once its commit word is written last; a record cut off
+ * by a reset is skipped. Saving the same data again is skipped, like Storage. The index (the latest
+ * record of each path) is rebuilt by reading the headers of both banks the first time the store is
+ * used after a boot. When the next record might not fit in its bank, the log moves to the other bank,
+ * which is erased first; the latest record stays in the old bank until the new one is committed, so
+ * a reset or failed download never leaves the poi without a timeline. Records of other paths in the
+ * erased bank are lost - the store is meant for the timeline.
+ *
+ * A path with no record yet is loaded from LittleFS, so a timeline saved before switching to the
+ * flash store still plays until the next refresh.
+ *
+ * All flash access goes through read(), program() and erase(). Built for the host (the native
+ * environment, with no ARDUINO), those work on a file instead, which the power can be cut to after
+ * any word, so the tests in test/test_flashstore can check what a reset at any point leaves behind.
+ */
+
+
+#include "FlashStore.h"
+
+#ifdef TIMELINE_FLASH
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <coredecls.h>
+#include <LoopProfiler.h>
+#include <Metrics.h>
+
+#ifdef ARDUINO
+#include <spi_flash.h>
+
+/**
+ * @brief Start and end of the region in the flash memory map, from the linker script.
+ */
+extern "C" uint32_t _TIMELINE_start;
+extern "C" uint32_t _TIMELINE_end;
+
+/**
+ * @brief Address of flash in the memory map, subtracted to get physical flash addresses.
+ */
+static const uint32_t flashMapStart = 0x40200000;
+#else
+#include <stdio.h>
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+/**
+ * @brief The file that stands in for the region on the host, and its size, see hostBegin().
+ */
+static FILE *hostFile = nullptr;
+static uint32_t hostSize = 0;
+
+/**
+ * @brief Words that can still be written (an erased sector counts as one) before the power is cut, -1 for no limit.
+ */
+static long hostPowerLeft = -1;
+#endif
+
+uint32_t FlashStore::regionStart = 0;
+uint32_t FlashStore::regionSize = 0;
+uint32_t FlashStore::bankSize = 0;
+bool FlashStore::mounted = false;
+uint32_t FlashStore::bank = 0;
+uint32_t FlashStore::appendOffset = 0;
+uint32_t FlashStore::nextSeq = 1;
+FlashStore::IndexEntry FlashStore::index[maxEntries];
+int FlashStore::entryCount = 0;
+uint32_t FlashStore::recordOffset = 0;
+uint32_t FlashStore::recordKey = 0;
+uint32_t FlashStore::recordSeq = 0;
+uint32_t FlashStore::dataOffset = 0;
+uint32_t FlashStore::length = 0;
+uint32_t FlashStore::crc = 0;
+bool FlashStore::saving = false;
+uint32_t FlashStore::buffer[bufferSize / 4];
+uint32_t FlashStore::buffered = 0;
+
+/**
+ * @brief Default constructor for FlashStore class.
+ *
+ * Nothing is read from flash here, the region is scanned the first time it is used.
+ */
+FlashStore::FlashStore()
+{
+}
+
+
+/**
+ * @brief Saves data as the latest record of a path, unless it already is.
+ *
+ * @param path Path of the record, as for Storage.
+ * @param data The data to save, up to maxRecordSize bytes.
+ * @return true if the latest record of the path holds the data afterwards, false if saving failed.
+ */
+bool FlashStore::save(const String &path, const String &data)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    mount();
+    IndexEntry *entry = find(keyOf(path));
+    if (entry && entry->length == data.length() && entry->crc == crc32(data.c_str(), data.length()))
+    {
+        Serial.print("Unchanged, not saving ");
+        Serial.println(path);
+        return true;
+    }
+
+    if (!beginSave(path))
+    {
+        return false;
+    }
+    if (write((const uint8_t *)data.c_str(), data.length()) != data.length())
+    {
+        abortSave();
+        return false;
+    }
+    return endSave();
+}
+
+
+/**
+ * @brief Loads the latest record of a path, or the file saved with Storage if it has none.
+ *
+ * @param path Path of the record.
+ * @return The data, or an empty string if there is none or it is corrupt.
+ */
+String FlashStore::load(const String &path)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    mount();
+    IndexEntry *entry = find(keyOf(path));
+    if (!entry)
+    {
+        return legacy.load(path);
+    }
+
+    String data = "";
+    if (!data.reserve(entry->length))
+    {
+        return data;
+    }
+    uint32_t chunk[bufferSize / 4];
+    uint32_t offset = entry->offset + sizeof(Header);
+    uint32_t remaining = entry->length;
+    while (remaining > 0)
+    {
+        uint32_t len = min(remaining, (uint32_t)bufferSize);
+        if (!read(offset, chunk, (len + 3) & ~3U)) // records are padded to whole words
+        {
+            break;
+        }
+        data.concat((const char *)chunk, len);
+        offset += len;
+        remaining -= len;
+    }
+    if (remaining > 0 || crc32(data.c_str(), data.length()) != entry->crc)
+    {
+        Serial.print("Corrupt record in flash: ");
+        Serial.println(path);
+        data = "";
+    }
+    return data;
+}
+
+
+/**
+ * @brief Starts saving a record in chunks, for data that arrives in pieces.
+ *
+ * Follow with write() for each chunk and endSave(), or abortSave() to keep the old record. If a
+ * record of maxRecordSize might not fit after the last one, the log moves to the other bank, see switchBank().
+ *
+ * @param path Path of the record.
+ * @return true if the record could be started, false otherwise.
+ */
+bool FlashStore::beginSave(const String &path)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    abortSave(); // in case the last save was never finished
+    mount();
+    if (bankSize < sizeof(Header) + maxRecordSize)
+    {
+        Serial.println("No timeline region in flash, check the linker script");
+        return false;
+    }
+    if (appendOffset + sizeof(Header) + maxRecordSize > bankEnd() && !switchBank())
+    {
+        return false;
+    }
+
+    recordOffset = appendOffset;
+    recordKey = keyOf(path);
+    recordSeq = nextSeq;
+    dataOffset = recordOffset + sizeof(Header);
+    length = 0;
+    crc = 0xffffffff;
+    buffered = 0;
+    uint32_t start[3] = {headerMagic, recordKey, recordSeq};
+    if (!program(recordOffset, start, sizeof(start)))
+    {
+        return fail();
+    }
+    nextSeq++;
+    saving = true;
+    return true;
+}
+
+
+/**
+ * @brief Adds a chunk of data to the record being saved.
+ *
+ * @param data The chunk of data.
+ * @param len Length of the chunk.
+ * @return Number of bytes taken, less than len if the record would be larger than maxRecordSize or writing failed.
+ */
+size_t FlashStore::write(const uint8_t *data, size_t len)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    if (!saving)
+    {
+        return 0;
+    }
+    size_t taken = min(len, (size_t)(maxRecordSize - length));
+    for (size_t i = 0; i < taken; i++)
+    {
+        ((uint8_t *)buffer)[buffered++] = data[i];
+        if (buffered == bufferSize && !flush(false))
+        {
+            fail();
+            return i;
+        }
+    }
+    crc = crc32(data, taken, crc);
+    length += taken;
+    return taken;
+}
+
+
+/**
+ * @brief Finishes saving: writes the rest of the data, the length and checksum, and commits the record.
+ *
+ * @return true if the record was saved completely, false otherwise (the old record is kept).
+ */
+bool FlashStore::endSave()
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    if (!saving)
+    {
+        return false;
+    }
+    saving = false;
+    uint32_t end[2] = {length, crc};
+    uint32_t commit = 0;
+    bool ok = flush(true) && program(recordOffset + offsetof(Header, length), end, sizeof(end)) &&
+              program(recordOffset + offsetof(Header, commit), &commit, sizeof(commit));
+    metrics.fileSaved(ok);
+    if (!ok)
+    {
+        Serial.println("Failed to save to flash");
+        return fail();
+    }
+    appendOffset = dataOffset;
+    remember(recordKey, recordOffset, length, crc, recordSeq);
+    Serial.print("Saved to flash: ");
+    Serial.print(length);
+    Serial.println(" bytes");
+    return true;
+}
+
+
+/**
+ * @brief Abandons saving and keeps the old record. Does nothing if no save is in progress.
+ *
+ * The record is closed with its length but never committed, so it is skipped from then on.
+ */
+void FlashStore::abortSave()
+{
+    if (!saving)
+    {
+        return;
+    }
+    saving = false;
+    uint32_t end[2] = {length, crc};
+    if (!flush(true) || !program(recordOffset + offsetof(Header, length), end, sizeof(end)))
+    {
+        fail();
+        return;
+    }
+    appendOffset = dataOffset;
+}
+
+
+/**
+ * @brief Finds the region and builds the index, the first time the store is used.
+ */
+void FlashStore::mount()
+{
+    if (mounted)
+    {
+        return;
+    }
+    mounted = true;
+#ifdef ARDUINO
+    regionStart = (uint32_t)((uintptr_t)&_TIMELINE_start - flashMapStart);
+    regionSize = (uint32_t)((uintptr_t)&_TIMELINE_end - (uintptr_t)&_TIMELINE_start);
+#else
+    regionStart = 0;
+    regionSize = hostSize;
+#endif
+    bankSize = regionSize / bankCount / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    scan();
+}
+
+
+/**
+ * @brief Reads the record headers of both banks, to build the index and find the end of the log.
+ *
+ * The log goes on in the bank with the latest record. A record that wasn't committed is skipped if
+ * its length was written. Anything else that isn't a header ends the bank, and the log moves to the
+ * other bank at the next save.
+ */
+void FlashStore::scan()
+{
+    entryCount = 0;
+    nextSeq = 1;
+    bank = 0;
+    uint32_t ends[bankCount];
+    uint32_t latestSeq = 0;
+    for (uint32_t b = 0; b < bankCount; b++)
+    {
+        uint32_t end = (b + 1) * bankSize;
+        uint32_t offset = b * bankSize;
+        Header header;
+        while (offset + sizeof(Header) <= end && read(offset, &header, sizeof(header)))
+        {
+            if (header.magic == erased)
+            {
+                break; // the end of the log
+            }
+            uint32_t next = offset + sizeof(Header) + ((header.length + 3) & ~3U);
+            if (header.magic != headerMagic || header.length > maxRecordSize || next > end)
+            {
+                offset = end; // can't tell where the next record starts
+                break;
+            }
+            if (header.seq > latestSeq)
+            {
+                latestSeq = header.seq;
+                bank = b;
+            }
+            nextSeq = max(nextSeq, header.seq + 1);
+            if (header.commit == 0)
+            {
+                remember(header.key, offset, header.length, header.crc, header.seq);
+            }
+            offset = next;
+        }
+        ends[b] = min(offset, end);
+    }
+    appendOffset = ends[bank];
+
+    Serial.print("Timeline flash: ");
+    Serial.print(entryCount);
+    Serial.print(" records, ");
+    Serial.print(bankEnd() - appendOffset);
+    Serial.println(" bytes free");
+}
+
+
+/**
+ * @brief Finds the latest record of a path in the index.
+ *
+ * @param key Checksum of the path, see keyOf().
+ * @return The index entry, or nullptr if the path has no record.
+ */
+FlashStore::IndexEntry *FlashStore::find(uint32_t key)
+{
+    for (int i = 0; i < entryCount; i++)
+    {
+        if (index[i].key == key)
+        {
+            return &index[i];
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * @brief Makes a record the latest one of its path in the index, unless the index has a later one.
+ *
+ * Records beyond maxEntries paths are left out.
+ */
+void FlashStore::remember(uint32_t key, uint32_t offset, uint32_t length, uint32_t crc, uint32_t seq)
+{
+    IndexEntry *entry = find(key);
+    if (!entry)
+    {
+        if (entryCount >= maxEntries)
+        {
+            return;
+        }
+        entry = &index[entryCount++];
+    }
+    else if (entry->seq > seq)
+    {
+        return;
+    }
+    *entry = {key, offset, length, crc, seq};
+}
+
+
+/**
+ * @brief Moves the log to a freshly erased bank.
+ *
+ * That is the other bank, unless only the current one has nothing in the index (after a failed
+ * save), so the latest records are never erased to make room for a record that may not finish.
+ *
+ * @return true if the bank was erased, false otherwise.
+ */
+bool FlashStore::switchBank()
+{
+    uint32_t target = 1 - bank;
+    if (holdsEntries(target) && !holdsEntries(bank))
+    {
+        target = bank;
+    }
+    bank = target;
+    appendOffset = bankEnd(); // until it is erased
+
+    for (int i = 0; i < entryCount;)
+    {
+        if (index[i].offset / bankSize == bank)
+        {
+            index[i] = index[--entryCount];
+        }
+        else
+        {
+            i++;
+        }
+    }
+    Serial.print("Erasing timeline flash bank ");
+    Serial.println(bank);
+    if (!erase(bank))
+    {
+        Serial.println("Couldn't erase timeline flash");
+        return false;
+    }
+    appendOffset = bank * bankSize;
+    return true;
+}
+
+
+/**
+ * @brief Erases a bank, sector by sector.
+ *
+ * @param b The bank.
+ * @return true if it was erased, false otherwise.
+ */
+bool FlashStore::erase(uint32_t b)
+{
+    uint32_t firstSector = (regionStart + b * bankSize) / SPI_FLASH_SEC_SIZE;
+    for (uint32_t sector = 0; sector < bankSize / SPI_FLASH_SEC_SIZE; sector++)
+    {
+#ifdef ARDUINO
+        if (spi_flash_erase_sector(firstSector + sector) != SPI_FLASH_RESULT_OK)
+        {
+            return false;
+        }
+#else
+        uint8_t ones[SPI_FLASH_SEC_SIZE];
+        memset(ones, 0xff, sizeof(ones));
+        if (hostPowerLeft == 0 || fseek(hostFile, (firstSector + sector) * SPI_FLASH_SEC_SIZE, SEEK_SET) != 0 ||
+            fwrite(ones, 1, sizeof(ones), hostFile) != sizeof(ones))
+        {
+            return false;
+        }
+        if (hostPowerLeft > 0)
+        {
+            hostPowerLeft--;
+        }
+#endif
+    }
+    return true;
+}
+
+
+/**
+ * @brief Returns whether the index has a record in a bank.
+ */
+bool FlashStore::holdsEntries(uint32_t b)
+{
+    for (int i = 0; i < entryCount; i++)
+    {
+        if (index[i].offset / bankSize == b)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Returns the end of the current bank, from the start of the region.
+ */
+uint32_t FlashStore::bankEnd()
+{
+    return (bank + 1) * bankSize;
+}
+
+
+/**
+ * @brief Reads from the region.
+ *
+ * @param offset Offset from the start of the region, a multiple of 4.
+ * @param data Where to put the data, word aligned.
+ * @param len Number of bytes, a multiple of 4.
+ * @return true if it was read, false otherwise.
+ */
+bool FlashStore::read(uint32_t offset, void *data, uint32_t len)
+{
+#ifdef ARDUINO
+    return spi_flash_read(regionStart + offset, (uint32_t *)data, len) == SPI_FLASH_RESULT_OK;
+#else
+    return offset + len <= hostSize && fseek(hostFile, regionStart + offset, SEEK_SET) == 0 &&
+           fread(data, 1, len, hostFile) == len;
+#endif
+}
+
+
+/**
+ * @brief Writes to erased flash in the current bank.
+ *
+ * @param offset Offset from the start of the region, a multiple of 4.
+ * @param data The data, word aligned.
+ * @param len Number of bytes, a multiple of 4.
+ * @return true if it was written, false otherwise.
+ */
+bool FlashStore::program(uint32_t offset, const void *data, uint32_t len)
+{
+    if (offset + len > bankEnd())
+    {
+        return false;
+    }
+    metrics.flashWrite(len);
+#ifdef ARDUINO
+    return spi_flash_write(regionStart + offset, (uint32_t *)data, len) == SPI_FLASH_RESULT_OK;
+#else
+    for (uint32_t done = 0; done < len;)
+    {
+        uint32_t words[bufferSize / 4];
+        uint32_t count = min((len - done) / 4, (uint32_t)(bufferSize / 4));
+        if (hostPowerLeft >= 0 && (uint32_t)hostPowerLeft < count)
+        {
+            count = hostPowerLeft; // the power goes after these
+        }
+        if (count == 0 || !read(offset + done, words, count * 4))
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            words[i] &= ((const uint32_t *)data)[done / 4 + i]; // like flash, writing only clears bits
+        }
+        if (fseek(hostFile, regionStart + offset + done, SEEK_SET) != 0 || fwrite(words, 4, count, hostFile) != count)
+        {
+            return false;
+        }
+        if (hostPowerLeft > 0)
+        {
+            hostPowerLeft -= count;
+        }
+        done += count * 4;
+    }
+    return true;
+#endif
+}
+
+
+/**
+ * @brief Returns the key of a path in the index and record headers.
+ */
+uint32_t FlashStore::keyOf(const String &path)
+{
+    return crc32(path.c_str(), path.length());
+}
+
+
+/**
+ * @brief Writes the buffered data to flash.
+ *
+ * @param pad Whether to pad it to a whole word, for the end of a record. Otherwise the buffer is full.
+ * @return true if it was written, false otherwise.
+ */
+bool FlashStore::flush(bool pad)
+{
+    uint32_t len = buffered;
+    if (pad)
+    {
+        while (len % 4 != 0)
+        {
+            ((uint8_t *)buffer)[len++] = 0xff;
+        }
+    }
+    buffered = 0;
+    if (len == 0)
+    {
+        return true;
+    }
+    if (!program(dataOffset, buffer, len))
+    {
+        return false;
+    }
+    dataOffset += len;
+    return true;
+}
+
+
+#ifndef ARDUINO
+/**
+ * @brief Host builds only: uses a file as the region, erased if it is new, and forgets everything in
+ * RAM, as a reset does. The power is on again.
+ *
+ * @param file Path of the file.
+ * @param size Size of the region, in bytes, a multiple of the sector size.
+ */
+void FlashStore::hostBegin(const char *file, uint32_t size)
+{
+    if (hostFile)
+    {
+        fclose(hostFile);
+    }
+    hostFile = fopen(file, "r+b");
+    if (!hostFile)
+    {
+        hostFile = fopen(file, "w+b");
+        for (uint32_t i = 0; hostFile && i < size; i++)
+        {
+            fputc(0xff, hostFile);
+        }
+    }
+    hostSize = size;
+    hostPowerLeft = -1;
+    mounted = false;
+    saving = false;
+}
+
+
+/**
+ * @brief Host builds only: cuts the power after some more words are written, from then on nothing is.
+ *
+ * @param words Number of words (or erased sectors) still written, -1 for no limit.
+ */
+void FlashStore::hostCutPower(long words)
+{
+    hostPowerLeft = words;
+}
+#endif
+
+
+/**
+ * @brief Gives up on the record being saved. Where the log ends is unknown now, so it moves to an erased bank at the next save.
+ *
+ * @return false, for returning straight away.
+ */
+bool FlashStore::fail()
+{
+    saving = false;
+    appendOffset = bankEnd();
+    return false;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef FLASHSTORE_H
+#define FLASHSTORE_H
+
+#include <Arduino.h>
+#include <Storage.h>
+
+/**
+ * @file FlashStore.h
+ * @brief Declaration of the FlashStore class, and TimelineStore, where timelines are kept.
+ */
+
+class FlashStore {
+public:
+    FlashStore(); // Constructor declaration
+    bool save(const String &path, const String &data);
+    String load(const String &path);
+    bool beginSave(const String &path);
+    size_t write(const uint8_t *data, size_t len);
+    bool endSave();
+    void abortSave();
+
+    /**
+     * @brief Largest record, in bytes. A save always has this much room, see beginSave().
+     */
+    static const uint32_t maxRecordSize = 8192;
+
+#ifndef ARDUINO
+    static void hostBegin(const char *file, uint32_t size);
+    static void hostCutPower(long words);
+#endif
+
+private:
+    /**
+     * @brief Header in front of every record. Each word is written once, in order, so a record cut off by a
+     * reset is recognised (commit is still erased) and skipped.
+     */
+    struct Header {
+        uint32_t magic;   ///< headerMagic, written first
+        uint32_t key;     ///< checksum of the path
+        uint32_t seq;     ///< higher for later records
+        uint32_t length;  ///< bytes of data, written with crc after the data
+        uint32_t crc;
+        uint32_t commit;  ///< 0 once the record is complete, written last
+    };
+
+    /**
+     * @brief Where the latest complete record of a path is.
+     */
+    struct IndexEntry {
+        uint32_t key;
+        uint32_t offset;  ///< of the header, from the start of the region
+        uint32_t length;
+        uint32_t crc;
+        uint32_t seq;
+    };
+
+    static void mount();
+    static void scan();
+    static IndexEntry *find(uint32_t key);
+    static void remember(uint32_t key, uint32_t offset, uint32_t length, uint32_t crc, uint32_t seq);
+    static bool switchBank();
+    static bool erase(uint32_t b);
+    static bool holdsEntries(uint32_t b);
+    static uint32_t bankEnd();
+    static bool read(uint32_t offset, void *data, uint32_t len);
+    static bool program(uint32_t offset, const void *data, uint32_t len);
+    static uint32_t keyOf(const String &path);
+    static bool flush(bool pad);
+    static bool fail();
+
+    /**
+     * @brief Marks the start of a record header.
+     */
+    static const uint32_t headerMagic = 0x4c544d50; // "PMTL"
+
+    /**
+     * @brief Erased flash, and a header word not written yet.
+     */
+    static const uint32_t erased = 0xffffffff;
+
+    /**
+     * @brief Number of paths the index holds.
+     */
+    static const int maxEntries = 4;
+
+    /**
+     * @brief Number of banks the region is split in. Each holds a record of maxRecordSize.
+     */
+    static const uint32_t bankCount = 2;
+
+    /**
+     * @brief Size of the write buffer, in bytes. Data goes to flash in aligned pieces of this size.
+     */
+    static const uint32_t bufferSize = 256;
+
+    /**
+     * @brief Physical flash address and size of the region, from the linker script.
+     */
+    static uint32_t regionStart;
+    static uint32_t regionSize;
+
+    /**
+     * @brief Size of a bank, in whole sectors, and the bank the log goes on in.
+     */
+    static uint32_t bankSize;
+    static uint32_t bank;
+
+    /**
+     * @brief Whether the region has been scanned since boot.
+     */
+    static bool mounted;
+
+    /**
+     * @brief Where the next record goes, from the start of the region, and its sequence number.
+     */
+    static uint32_t appendOffset;
+    static uint32_t nextSeq;
+
+    /**
+     * @brief The index: the latest complete record of each path.
+     */
+    static IndexEntry index[maxEntries];
+    static int entryCount;
+
+    /**
+     * @brief The record being saved: its header offset, key, sequence number, where the next data goes, its length and checksum.
+     *
+     * There is one region, so there is one save at a time, whichever FlashStore started it.
+     */
+    static uint32_t recordOffset;
+    static uint32_t recordKey;
+    static uint32_t recordSeq;
+    static uint32_t dataOffset;
+    static uint32_t length;
+    static uint32_t crc;
+    static bool saving;
+
+    /**
+     * @brief Data waiting to be written. It goes to flash bufferSize bytes at a time, padded to a whole word at the end.
+     */
+    static uint32_t buffer[bufferSize / 4];
+    static uint32_t buffered;
+
+    /**
+     * @brief LittleFS, for timelines saved before the flash store was used.
+     */
+    Storage legacy;
+};
+
+#ifdef TIMELINE_FLASH
+/**
+ * @brief Where timelines are saved: the raw flash region (build with the timeline flash linker script).
+ */
+typedef FlashStore TimelineStore;
+#else
+/**
+ * @brief Where timelines are saved: a file in LittleFS.
+ */
+typedef Storage TimelineStore;
+#endif
+
+#endif
@@ -1,194 +1,335 @@
 /**
  * @file Loading.cpp
  * @brief Implementation of the Loading class.
- * 
- * This class has methods to fetch the user data from MagicPoi api. 
+ *
+ * This class has methods to fetch the user data from MagicPoi api.
  * Run on startup - saves timeline to LittleFS for later usage
+ *
+ * Fetching is split into steps (see step()), so loop() keeps playing in between: asking for the
+ * timeline number, reading it, asking for the timeline, reading it a chunk at a time as it arrives,
+ * and, once the caller has checked that it loads (see FETCHED), saving it. Each request itself (connecting, sending and waiting for the response headers)
+ * is still one step, as HTTPClient has no way to do that without waiting; it is bounded by
+ * Connection::httpTimeout, and the Scheduler starts it straight after a cue.
  */
 
 
 #include "Loading.h"
 #include <Arduino.h>
 #include <secrets.h>
-#include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <ESP8266HTTPClient.h>
-#include <Authentication.h>
+#include <Connection.h>
+#include <Telemetry.h>
+#include <Metrics.h>
+#include <Tracer.h>
+#include <Playing.h>
 
 /**
- * @brief Default constructor for Loading class.
- * 
- * This constructor initializes the Loading object. It attempts to load a JWT token 
- * from a file using the Authentication object. If a token is successfully loaded,
- * it is stored internally. Otherwise, it prepares to use password login if token loading fails.
+ * @brief Constructor for Loading class.
+ *
+ * The JWT token is not read here: the shared session loads it from LittleFS the first time
+ * a request needs it, so nothing touches the file system during static initialisation.
+ *
+ * @param session The shared session that stores the JWT token and WiFi client.
  */
-Loading::Loading()
+Loading::Loading(Session &session) : session(session)
 {
-    // token = authentication.readJWTTokenFromFile(); //todo: add logic to use Password login if this fails
-    String savedToken = authentication.readJWTTokenFromFile();
-    if (!savedToken.isEmpty())
+}
+
+
+/**
+ * @brief Starts fetching the current timeline. Follow with step() until it returns DONE or FAILED.
+ */
+void Loading::begin()
+{
+    //todo: load saved timeline if not able to access internet or auth doesn't work?
+    Serial.println("Loading data...");
+    if (state == NUMBER_BODY || state == TIMELINE_BODY)
     {
-        strncpy(token, savedToken.c_str(), sizeof(token) - 1);
-        token[sizeof(token) - 1] = '\0'; // Null-terminate the token string
-        // strncpy(jwtToken, savedToken.c_str(), sizeof(jwtToken) - 1);
-        // jwtToken[sizeof(jwtToken) - 1] = '\0'; // Null-terminate the token string
-        // gotToken = true;
-        Serial.println("Using saved JWT token:");
-        Serial.println(token);
+        session.endRequest(http); // a fetch was left unfinished
     }
+    state = NUMBER_REQUEST;
 }
 
 
 /**
- * @brief Retrieves the current timeline number from the server.
- * 
- * This method sends a GET request to the server to retrieve the current timeline number.
- * It includes the JWT token in the request headers for authentication. If the request
- * is successful and the response code is OK, the method returns the timeline number
- * received from the server. If any error occurs during the HTTP request or the response
- * code indicates a failure, an empty string is returned.
- * 
- * @return A string containing the current timeline number, or an empty string if the
- * request fails or if the server response code is not OK.
+ * @brief Does the next step of fetching the timeline.
+ *
+ * First the current timeline number is retrieved from the server, then the timeline data for that
+ * number. That is handed back as FETCHED, so it can be checked before it replaces the saved timeline;
+ * the next step() saves it to LittleFS. The JWT token is sent with both requests.
+ *
+ * @return BUSY or WAITING while there is more to do, FETCHED once the timeline is in getBody(), DONE once it
+ *         is saved, FAILED if a request or the save failed.
  */
-String Loading::getTimelineNumber()
+Loading::Status Loading::step()
 {
-    HTTPClient http;
-    http.begin(client, "http://" + String(serverIP) + ":" + String(serverPort) + "/lite/api/get-current-timeline-number");
-    http.addHeader("Authorization", "Bearer " + String(token));
-
-    Serial.println("[HTTP] GET...");
-    int httpCode = http.GET();
-    String response = "";
-    // httpCode will be negative on error
-    if (httpCode > 0)
+    switch (state)
     {
-        if (httpCode == HTTP_CODE_OK)
+    case NUMBER_REQUEST:
+        requestStartTime = millis();
+        if (!sendRequest("/lite/api/get-current-timeline-number", Tracer::NUMBER_FIRST_BYTE))
         {
-            // Print the API response
-            response = http.getString();
-            Serial.print("Got timeline number: ");
-            Serial.println(response);
+            Serial.println("Failed to get Timeline Number");
+            telemetry.loadPhase(Telemetry::PHASE_NUMBER, false, millis() - requestStartTime);
+            return finish(false);
         }
-        else
+        state = NUMBER_BODY;
+        return BUSY;
+
+    case NUMBER_BODY:
+        if (!readBody())
         {
-            Serial.print("Failed to get Timeline Number - Error code: ");
-            Serial.println(httpCode);
+            return WAITING;
+        }
+        tracer.add(Tracer::NUMBER_BODY, micros() - bodyStart);
+        telemetry.netResult(Telemetry::ENDPOINT_NUMBER, bodyFailed ? HTTPC_ERROR_READ_TIMEOUT : HTTP_CODE_OK, body.length(),
+                            millis() - requestStartTime);
+        metrics.request(!bodyFailed, body.length());
+        session.endRequest(http);
+        timelineNumber = bodyFailed ? "" : body;
+        telemetry.loadPhase(Telemetry::PHASE_NUMBER, !timelineNumber.isEmpty(), millis() - requestStartTime);
+        if (timelineNumber.isEmpty())
+        {
+            Serial.println("Failed to get Timeline Number - response broke off");
+            return finish(false);
+        }
+        // Print the API response
+        Serial.print("Got timeline number: ");
+        Serial.println(timelineNumber);
+        state = TIMELINE_REQUEST;
+        return BUSY;
+
+    case TIMELINE_REQUEST:
+        requestStartTime = millis();
+        if (!sendRequest("/lite/api/load-timeline?number=" + timelineNumber, Tracer::TIMELINE_FIRST_BYTE))
+        {
+            Serial.println("Failed to get Timeline");
+            telemetry.loadPhase(Telemetry::PHASE_DOWNLOAD, false, millis() - requestStartTime);
+            return finish(false);
+        }
+        state = TIMELINE_BODY;
+        return BUSY;
+
+    case TIMELINE_BODY:
+        if (!readBody())
+        {
+            return WAITING;
         }
+        tracer.add(Tracer::TIMELINE_BODY, micros() - bodyStart);
+        telemetry.netResult(Telemetry::ENDPOINT_TIMELINE, bodyFailed ? HTTPC_ERROR_READ_TIMEOUT : HTTP_CODE_OK, body.length(),
+                            millis() - requestStartTime);
+        metrics.request(!bodyFailed, body.length());
+        session.endRequest(http);
+        telemetry.loadPhase(Telemetry::PHASE_DOWNLOAD, !bodyFailed, millis() - requestStartTime);
+        if (bodyFailed)
+        {
+            Serial.println("Failed to get Timeline - response broke off");
+            return finish(false);
+        }
+        Serial.print("got Timeline: ");
+        Serial.print(body.length());
+        Serial.println(" bytes");
+        state = SAVE;
+        return FETCHED;
+
+    case SAVE:
+        return finish(saveTimeline(body));
+
+    default:
+        return FAILED;
     }
-    else
+}
+
+
+/**
+ * @brief Returns what the next step() does, e.g. to tell a request from reading a response.
+ *
+ * @return The state.
+ */
+Loading::State Loading::getState()
+{
+    return state;
+}
+
+
+/**
+ * @brief Returns the fetched timeline, after step() returned FETCHED.
+ *
+ * @return The response body.
+ */
+const String &Loading::getBody()
+{
+    return body;
+}
+
+
+/**
+ * @brief Drops a fetched timeline instead of saving it, e.g. because it doesn't load.
+ */
+void Loading::cancel()
+{
+    finish(false);
+}
+
+
+/**
+ * @brief Fetches and saves the current timeline in one go, without returning in between.
+ *
+ * The timeline isn't checked before it is saved; step() by step, the caller can do that at FETCHED.
+ *
+ * @return true if data loading is successful, false otherwise.
+ */
+bool Loading::load()
+{
+    begin();
+    Status status;
+    while ((status = step()) == BUSY || status == WAITING || status == FETCHED)
     {
-        Serial.println("Connection failed.");
+        yield();
     }
-
-    http.end();
-    return response;
+    return status == DONE;
 }
 
 
 /**
- * @brief Retrieves the timeline data from the server based on the specified timeline number.
- * 
- * This method sends a GET request to the server to retrieve the timeline data corresponding
- * to the provided timeline number. It includes the JWT token in the request headers for authentication.
- * If the request is successful and the response code is OK, the timeline data is saved and the method
- * returns true. If any error occurs during the HTTP request or the response code indicates a failure,
- * the method returns false.
- * 
- * @param tln The timeline number to retrieve data for.
- * @return true if the timeline data is successfully retrieved, false otherwise.
+ * @brief Sends a GET request to the server and waits for the response headers.
+ *
+ * It includes the JWT token in the request headers for authentication.
+ *
+ * @param path Path of the api endpoint.
+ * @param phase Trace phase for connecting and waiting for the first byte.
+ * @return true if the server answered OK and the body can be read with readBody(), false otherwise (also if its
+ *         Content-Length is over Playing::maxTimelineSize, so it is never buffered).
  */
-bool Loading::getTimeline(String tln)
+bool Loading::sendRequest(const String &path, Tracer::Phase phase)
 {
-    HTTPClient http;
-    http.begin(client, "http://" + String(serverIP) + ":" + String(serverPort) + "/lite/api/load-timeline?number=" + tln);
-    http.addHeader("Authorization", "Bearer " + String(token));
+    if (!session.beginRequest(http, path))
+    {
+        Serial.println("Couldn't start the request.");
+        metrics.request(false, 0);
+        session.endRequest(http);
+        return false;
+    }
+    http.addHeader("Authorization", "Bearer " + String(session.getToken()));
 
     Serial.println("[HTTP] GET...");
+    uint32_t traceStart = micros();
     int httpCode = http.GET();
+    tracer.add(phase, micros() - traceStart);
     // httpCode will be negative on error
-    if (httpCode > 0)
+    if (httpCode != HTTP_CODE_OK)
     {
-        if (httpCode == HTTP_CODE_OK)
+        if (httpCode > 0)
         {
-            // Print the API response
-            // DynamicJsonDocument led_doc(1500);
-            String payload = http.getString();
-            saveTimeline(payload);
-            Serial.println("got Timeline: ");
-            Serial.println(payload);
-            // delay(10);
-            // loadTimeline();
-
-            // already_got_data = true;
-            // digitalWrite(led, LOW);
-            http.end();
-            return true;
+            Serial.print("Error code: ");
+            Serial.println(httpCode);
         }
         else
         {
-            Serial.print("Failed to get Timeline - Error Code: ");
-            Serial.println(httpCode);
-            // gotToken=false;
+            Serial.println("Connection failed.");
         }
+        telemetry.netResult(phase == Tracer::NUMBER_FIRST_BYTE ? Telemetry::ENDPOINT_NUMBER : Telemetry::ENDPOINT_TIMELINE,
+                            httpCode, 0, millis() - requestStartTime);
+        metrics.request(false, 0);
+        session.endRequest(http);
+        return false;
     }
-    else
+
+    body = "";
+    bodySize = http.getSize();
+    if (bodySize > (int)Playing::maxTimelineSize)
     {
-        Serial.println("Connection failed.");
-        // gotToken=false;
+        Serial.print("Response too big: ");
+        Serial.print(bodySize);
+        Serial.println(" bytes");
+        metrics.request(false, 0);
+        session.endRequest(http);
+        return false;
     }
-
-    http.end();
-    return false;
+    if (bodySize > 0)
+    {
+        body.reserve(bodySize);
+    }
+    bodyFailed = false;
+    bodyStart = micros();
+    lastData = millis();
+    return true;
 }
 
+
 /**
- * @brief Saves the timeline data to a file.
- * 
- * This method saves the provided timeline data to a file using the LittleFS (Little File System).
- * If LittleFS initialization succeeds and the file is successfully created and written, 
- * a success message is printed to the Serial monitor. If there's any failure during 
- * the file system operation, the method returns without saving the data.
- * 
- * @param timelineData The timeline data to be saved to the file.
+ * @brief Reads what has arrived of the response body, at most bodyChunkSize bytes, without waiting.
+ *
+ * A response without a Content-Length (chunked) is read in one go with HTTPClient::getString(), and
+ * counts as broken off if it is larger than Playing::maxTimelineSize.
+ *
+ * @return true once the whole body is in or it broke off (bodyFailed is set), false while more is to come.
  */
-void Loading::saveTimeline(const String &timelineData)
+bool Loading::readBody()
 {
-    if (LittleFS.begin())
+    if (bodySize < 0)
     {
-        File file = LittleFS.open(timelineFilePath, "w");
-        if (file)
+        body = http.getString();
+        if (body.length() > Playing::maxTimelineSize)
         {
-            file.print(timelineData);
-            file.close();
-            Serial.println("Timeline data saved to file.");
+            body = "";
+            bodyFailed = true;
         }
-        LittleFS.end();
+        return true;
     }
+
+    WiFiClient *stream = http.getStreamPtr();
+    size_t available = stream ? stream->available() : 0;
+    if (available > 0)
+    {
+        uint8_t buffer[bodyChunkSize];
+        size_t len = stream->read(buffer, min(min(available, bodyChunkSize), (size_t)bodySize - body.length()));
+        body.concat((const char *)buffer, len);
+        lastData = millis();
+    }
+    if (body.length() >= (unsigned int)bodySize)
+    {
+        return true;
+    }
+    if (!stream || (!stream->connected() && stream->available() == 0) || millis() - lastData >= Connection::httpTimeout)
+    {
+        bodyFailed = true;
+        return true;
+    }
+    return false;
 }
 
 
 /**
- * @brief Loads data required for the application.
- * 
- * This method attempts to load data required for the application. It first tries to retrieve the current
- * timeline number from the server. If successful, it proceeds to load the timeline data. If both operations
- * succeed, the method returns true indicating successful loading. If any of the operations fail, the method
- * returns false.
- * 
- * @return true if data loading is successful, false otherwise.
+ * @brief Ends a fetch.
+ *
+ * @param ok Whether the timeline was fetched and saved.
+ * @return DONE or FAILED.
  */
-bool Loading::load()
+Loading::Status Loading::finish(bool ok)
 {
-    //todo: load saved timeline if not able to access internet or auth doesn't work? 
-    Serial.println("Loading data...");
+    state = IDLE;
+    body = ""; // the timeline is in LittleFS now (or was dropped), free the RAM
+    return ok ? DONE : FAILED;
+}
 
-    //load from api: 
-    timelineNumber = getTimelineNumber();
-    if(getTimeline(timelineNumber)){
-        return true;
-    } 
 
-    return false;
-    
+/**
+ * @brief Saves the timeline data to a file.
+ *
+ * This method saves the provided timeline data to a file in LittleFS (Little File System).
+ * Nothing is written if the saved timeline is already the same. Otherwise it is written
+ * to a temporary file first and swapped in when complete, see Storage.
+ *
+ * @param timelineData The timeline data to be saved to the file.
+ * @return true if it was saved, false otherwise.
+ */
+bool Loading::saveTimeline(const String &timelineData)
+{
+    Tracer::Span span(Tracer::SAVE);
+    unsigned long startTime = millis();
+    bool ok = storage.save(timelineFilePath, timelineData);
+    telemetry.loadPhase(Telemetry::PHASE_SAVE, ok, millis() - startTime);
+    return ok;
 }
@@ -2,8 +2,10 @@
 #define LOADING_H
 
 #include <Arduino.h>
-#include <WiFiClient.h>
-#include <Authentication.h>
+#include <ESP8266HTTPClient.h>
+#include <Session.h>
+#include <FlashStore.h>
+#include <Tracer.h>
 
 /**
  * @file Loading.h
@@ -12,33 +14,93 @@
 
 class Loading {
 public:
-    Loading(); // Constructor declaration
-    String getTimelineNumber();
-    bool getTimeline(String tln);
-    void saveTimeline(const String &timelineData);
+    /**
+     * @brief What the next step() does.
+     */
+    enum State : uint8_t {
+        IDLE = 0,           ///< nothing, call begin()
+        NUMBER_REQUEST,     ///< ask for the current timeline number
+        NUMBER_BODY,        ///< read the timeline number
+        TIMELINE_REQUEST,   ///< ask for the timeline
+        TIMELINE_BODY,      ///< read the timeline, a chunk at a time
+        SAVE,               ///< save the timeline to LittleFS
+        STATE_COUNT
+    };
+
+    /**
+     * @brief Result of a step().
+     */
+    enum Status : uint8_t {
+        BUSY,     ///< more to do, call step() again as soon as possible
+        WAITING,  ///< waiting for the server, call step() again in pollInterval
+        FETCHED,  ///< the timeline is in getBody(): check it, then call step() to save it or cancel() to drop it
+        DONE,     ///< the timeline was fetched and saved
+        FAILED    ///< the timeline couldn't be fetched or saved
+    };
+
+    Loading(Session &session); // Constructor declaration
+    void begin();
+    Status step();
+    State getState();
+    const String &getBody();
+    void cancel();
     bool load();
 
+    /**
+     * @brief How long to wait for more of a response before calling step() again, in milliseconds.
+     */
+    static const unsigned long pollInterval = 5;
+
 private:
+    bool sendRequest(const String &path, Tracer::Phase phase);
+    bool readBody();
+    Status finish(bool ok);
+    bool saveTimeline(const String &timelineData);
+
     /**
-     * @brief WiFi client object.
-     *
-     * This object is used for network communication with the server.
+     * @brief Largest amount of a response read in one step, in bytes.
      */
-    WiFiClient client;
+    static const size_t bodyChunkSize = 512;
 
     /**
-     * @brief Authentication object.
+     * @brief Shared session object.
      *
-     * This object is used for handling authentication operations.
+     * This object holds the JWT token and the WiFi client used for network communication with the server.
      */
-    Authentication authentication;
+    Session &session;
 
     /**
-     * @brief JWT token buffer.
-     *
-     * This buffer stores the JWT token retrieved from authentication.
+     * @brief Storage used to save the timeline.
+     */
+    TimelineStore storage;
+
+    /**
+     * @brief The request in progress.
+     */
+    HTTPClient http;
+
+    /**
+     * @brief What the next step() does.
+     */
+    State state = IDLE;
+
+    /**
+     * @brief The response being read, its length from the headers (-1 if not given), and when data last arrived.
+     */
+    String body;
+    int bodySize = 0;
+    unsigned long lastData = 0;
+
+    /**
+     * @brief Whether the response broke off or timed out.
+     */
+    bool bodyFailed = false;
+
+    /**
+     * @brief Timestamp when the current request started (millis and micros), for telemetry and the trace.
      */
-    char token[512];
+    unsigned long requestStartTime = 0;
+    uint32_t bodyStart = 0;
 
     /**
      * @brief Default timeline number.
@@ -0,0 +1,170 @@
+/**
+ * @file LocalServer.cpp
+ * @brief Implementation of the LocalServer class.
+ * 
+ * Optional web server on the poi, so a timeline can be pushed from a laptop on the same LAN
+ * without going through magicpoi.circusscientist.com. Enabled with LOCAL_SERVER_PORT in secrets.h.
+ * 
+ * Upload a timeline with: curl -F "timeline=@timeline.json" http://<poi ip>/timeline
+ * 
+ * GET /metrics returns the counters in Metrics in the Prometheus text format, for scraping,
+ * and GET /trace the phases of the last refreshes as CSV (see Tracer).
+ */
+
+
+#include "LocalServer.h"
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <Metrics.h>
+#include <Tracer.h>
+
+/**
+ * @brief Constructor for LocalServer class.
+ * 
+ * @param playing The Playing object to hot-load pushed timelines into.
+ * @param port TCP port to listen on.
+ */
+LocalServer::LocalServer(Playing &playing, int port) : server(port), playing(playing)
+{
+}
+
+
+/**
+ * @brief Registers the routes and starts listening.
+ * 
+ * Call this once from setup(); the server listens on all interfaces, so it doesn't have to wait for WiFi.
+ */
+void LocalServer::begin()
+{
+    server.on("/timeline", HTTP_POST,
+              [this]() { handleTimelineDone(); },
+              [this]() { handleTimelineUpload(); });
+    server.on("/metrics", HTTP_GET, [this]() { handleMetrics(); });
+    server.on("/trace", HTTP_GET, [this]() { handleTrace(); });
+    server.begin();
+    Serial.println("Local server started");
+}
+
+
+/**
+ * @brief Handles pending HTTP requests.
+ * 
+ * Call this from loop().
+ */
+void LocalServer::handleClient()
+{
+    server.handleClient();
+}
+
+
+/**
+ * @brief Collects an uploaded timeline chunk by chunk.
+ * 
+ * Called by the web server for every chunk of the upload. The timeline is kept in RAM, up to
+ * Playing::maxTimelineSize (it has to be in RAM to be parsed anyway), and only saved once
+ * handleTimelineDone() has loaded it as a valid timeline, so a bad or interrupted upload leaves
+ * the saved timeline alone.
+ */
+void LocalServer::handleTimelineUpload()
+{
+    HTTPUpload &upload = server.upload();
+
+    switch (upload.status)
+    {
+    case UPLOAD_FILE_START:
+        Serial.print("Timeline upload: ");
+        Serial.println(upload.filename);
+        uploadData = "";
+        uploadBytes = 0;
+        uploadTooBig = false;
+        uploadStartTime = millis();
+        uploadOk = true;
+        break;
+    case UPLOAD_FILE_WRITE:
+        uploadBytes += upload.currentSize;
+        if (uploadBytes > Playing::maxTimelineSize)
+        {
+            uploadTooBig = true;
+            uploadOk = false;
+            uploadData = String(); // hand the heap back straight away
+        }
+        if (uploadOk)
+        {
+            uploadOk = uploadData.concat((const char *)upload.buf, upload.currentSize);
+        }
+        break;
+    case UPLOAD_FILE_END:
+        uploadOk = uploadOk && uploadBytes > 0;
+        break;
+    default: // aborted
+        uploadOk = false;
+        Serial.println("Timeline upload aborted");
+        break;
+    }
+}
+
+
+/**
+ * @brief Replies to a finished upload, and hot-loads and saves the new timeline if it is valid.
+ * 
+ * Ends the request's upload state whatever happens, so the next request starts afresh (a POST that
+ * isn't a file upload never reaches handleTimelineUpload()).
+ */
+void LocalServer::handleTimelineDone()
+{
+    if (uploadTooBig)
+    {
+        server.send(413, "text/plain", "timeline too big, kept the current one\n");
+        Serial.println("Timeline upload too big");
+    }
+    else if (!uploadOk)
+    {
+        server.send(500, "text/plain", "timeline upload failed\n");
+        Serial.println("Timeline upload failed");
+    }
+    else
+    {
+        Serial.print("Timeline uploaded: ");
+        Serial.print(uploadBytes);
+        Serial.print(" bytes in ");
+        Serial.print(millis() - uploadStartTime);
+        Serial.println(" ms");
+
+        if (!playing.processTimelineData(uploadData))
+        {
+            server.send(400, "text/plain", "not a valid timeline, kept the current one\n");
+        }
+        else if (!storage.save(playing.getTimelineFilePath(), uploadData))
+        {
+            server.send(500, "text/plain", "timeline loaded, but couldn't be saved\n");
+        }
+        else
+        {
+            server.send(200, "text/plain", "timeline loaded: " + String(playing.getMaxTimingsNum()) + " cues" +
+                                               (playing.isSwapPending() ? ", waiting to swap\n" : "\n"));
+        }
+    }
+
+    uploadData = String();
+    uploadOk = false;
+    uploadTooBig = false;
+    uploadBytes = 0;
+}
+
+
+/**
+ * @brief Replies with the metrics, for Prometheus or curl.
+ */
+void LocalServer::handleMetrics()
+{
+    server.send(200, "text/plain; version=0.0.4", metrics.render());
+}
+
+
+/**
+ * @brief Replies with the trace of the last refreshes, as CSV.
+ */
+void LocalServer::handleTrace()
+{
+    server.send(200, "text/csv", tracer.render());
+}
@@ -0,0 +1,67 @@
+#ifndef LOCALSERVER_H
+#define LOCALSERVER_H
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <FlashStore.h>
+#include <Playing.h>
+
+/**
+ * @file LocalServer.h
+ * @brief Declaration of the LocalServer class.
+ */
+
+class LocalServer {
+public:
+    LocalServer(Playing &playing, int port); // Constructor declaration
+    void begin();
+    void handleClient();
+
+private:
+    void handleTimelineUpload();
+    void handleTimelineDone();
+    void handleMetrics();
+    void handleTrace();
+
+    /**
+     * @brief HTTP server listening on the LAN.
+     */
+    ESP8266WebServer server;
+
+    /**
+     * @brief Playing object that is reloaded after a timeline has been pushed.
+     */
+    Playing &playing;
+
+    /**
+     * @brief Storage the upload is saved to, once it has loaded as a valid timeline.
+     */
+    TimelineStore storage;
+
+    /**
+     * @brief The upload so far, at most Playing::maxTimelineSize bytes.
+     */
+    String uploadData;
+
+    /**
+     * @brief Flag indicating whether the current upload was received completely.
+     */
+    bool uploadOk = false;
+
+    /**
+     * @brief Flag indicating whether the current upload was larger than Playing::maxTimelineSize.
+     */
+    bool uploadTooBig = false;
+
+    /**
+     * @brief Number of bytes received by the current upload.
+     */
+    size_t uploadBytes = 0;
+
+    /**
+     * @brief Timestamp when the current upload started.
+     */
+    unsigned long uploadStartTime = 0;
+};
+
+#endif
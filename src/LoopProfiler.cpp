@@ -0,0 +1,274 @@
+/**
+ * @file LoopProfiler.cpp
+ * @brief Implementation of the LoopProfiler class.
+ *
+ * Times every loop() iteration, and the sections of it, with the CPU cycle counter
+ * (ESP.getCycleCount(), one tick per CPU clock, so reading it costs next to nothing; it wraps
+ * after 53 s at 80 MHz, far longer than any iteration with the request timeouts).
+ * Sections can nest (e.g. storage inside a network refresh); time is only charged to the
+ * innermost one, so the sections of an iteration add up to the whole iteration.
+ * The idle time at the end of loop() is not part of an iteration.
+ *
+ * An iteration misses a cue deadline if a cue that was due when it started wasn't reached
+ * within a millisecond, or if it took longer than the time to the next cue, so the next
+ * iteration can only show that cue late. The longest iterations are kept with the section
+ * responsible, and report() (the "profile" command) prints it all.
+ */
+
+
+#include "LoopProfiler.h"
+#include <Arduino.h>
+#include <Telemetry.h>
+#include <Metrics.h>
+
+LoopProfiler profiler;
+
+/**
+ * @brief Section names for report(), indexed by Section.
+ */
+static const char *const sectionNames[] = {"other", "commands", "network", "storage", "playback", "logging"};
+
+/**
+ * @brief Starts charging time to a section.
+ *
+ * @param section The section.
+ */
+LoopProfiler::Scope::Scope(Section section)
+{
+    profiler.enter(section);
+}
+
+
+/**
+ * @brief Stops charging time to the section.
+ */
+LoopProfiler::Scope::~Scope()
+{
+    profiler.leave();
+}
+
+
+/**
+ * @brief Default constructor for LoopProfiler class.
+ */
+LoopProfiler::LoopProfiler()
+{
+    memset(sectionStats, 0, sizeof(sectionStats));
+    memset(&loopStats, 0, sizeof(loopStats));
+    memset(stalls, 0, sizeof(stalls));
+}
+
+
+/**
+ * @brief Starts timing a loop() iteration. Call first thing in loop().
+ *
+ * @param untilCue Milliseconds until the next cue is due, or -1 if there is none (see Playing::msUntilNextCue()).
+ */
+void LoopProfiler::beginLoop(long untilCue)
+{
+    this->untilCue = untilCue;
+    memset(sectionCycles, 0, sizeof(sectionCycles));
+    depth = 0;
+    missedDeadline = false;
+    inLoop = true;
+    loopStart = lastCharge = ESP.getCycleCount();
+}
+
+
+/**
+ * @brief Finishes timing a loop() iteration. Call at the end of loop(), before idling.
+ */
+void LoopProfiler::endLoop()
+{
+    if (!inLoop)
+    {
+        return;
+    }
+    uint32_t now = ESP.getCycleCount();
+    charge(now);
+    inLoop = false;
+
+    uint32_t cycles = now - loopStart;
+    addSample(loopStats, cycles);
+    uint8_t worst = OTHER;
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        if (sectionCycles[i] > 0)
+        {
+            addSample(sectionStats[i], sectionCycles[i]);
+        }
+        if (sectionCycles[i] > sectionCycles[worst])
+        {
+            worst = i;
+        }
+    }
+
+    if (untilCue > 0 && toMicros(cycles) > (uint32_t)untilCue * 1000)
+    {
+        missedDeadline = true; // the next cue will be late
+    }
+    metrics.loopEnded(toMicros(cycles), missedDeadline);
+    if (missedDeadline)
+    {
+        deadlineMisses++;
+        if (!telemetry.isEnabled())
+        {
+            Serial.print("Missed cue deadline: loop took ");
+            Serial.print(toMicros(cycles));
+            Serial.print(" us, mostly ");
+            Serial.println(sectionNames[worst]);
+        }
+    }
+
+    // keep the longest iterations, longest first
+    if (cycles <= stalls[topStalls - 1].cycles)
+    {
+        return;
+    }
+    int i = topStalls - 1;
+    while (i > 0 && stalls[i - 1].cycles < cycles)
+    {
+        stalls[i] = stalls[i - 1];
+        i--;
+    }
+    stalls[i].cycles = cycles;
+    stalls[i].time = millis();
+    stalls[i].section = worst;
+    stalls[i].missedDeadline = missedDeadline;
+}
+
+
+/**
+ * @brief Starts charging time to a section, until leave() is called.
+ *
+ * @param section The section.
+ */
+void LoopProfiler::enter(Section section)
+{
+    if (!inLoop)
+    {
+        return;
+    }
+    uint32_t now = ESP.getCycleCount();
+    charge(now);
+    if (section == PLAYBACK && untilCue == 0 && toMicros(now - loopStart) > 1000)
+    {
+        missedDeadline = true; // a cue was due when the iteration started, and playback is only starting now
+    }
+    if (depth < maxDepth)
+    {
+        stack[depth] = section;
+    }
+    depth++;
+}
+
+
+/**
+ * @brief Stops charging time to the section entered last.
+ */
+void LoopProfiler::leave()
+{
+    if (!inLoop || depth == 0)
+    {
+        return;
+    }
+    charge(ESP.getCycleCount());
+    depth--;
+}
+
+
+/**
+ * @brief Prints the statistics since the last report, and starts again.
+ */
+void LoopProfiler::report()
+{
+    Serial.print("Loop profile, ");
+    Serial.print(deadlineMisses);
+    Serial.println(" missed cue deadlines (times in us):");
+    Serial.println("section     count      min      avg      max");
+    printStats("loop", loopStats);
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        printStats(sectionNames[i], sectionStats[i]);
+    }
+
+    Serial.println("longest iterations:");
+    for (int i = 0; i < topStalls && stalls[i].cycles > 0; i++)
+    {
+        Serial.print("  ");
+        Serial.print(toMicros(stalls[i].cycles));
+        Serial.print(" us at ");
+        Serial.print(stalls[i].time);
+        Serial.print(" ms, mostly ");
+        Serial.print(sectionNames[stalls[i].section]);
+        Serial.println(stalls[i].missedDeadline ? " - missed cue deadline" : "");
+    }
+
+    memset(sectionStats, 0, sizeof(sectionStats));
+    memset(&loopStats, 0, sizeof(loopStats));
+    memset(stalls, 0, sizeof(stalls));
+    deadlineMisses = 0;
+}
+
+
+/**
+ * @brief Charges the time since the last charge to the innermost section.
+ *
+ * @param now The current cycle count.
+ */
+void LoopProfiler::charge(uint32_t now)
+{
+    Section section = depth == 0 ? OTHER : stack[min(depth, maxDepth) - 1];
+    sectionCycles[section] += now - lastCharge;
+    lastCharge = now;
+}
+
+
+/**
+ * @brief Adds one sample to time statistics.
+ *
+ * @param stats The statistics.
+ * @param cycles The sample, in CPU cycles.
+ */
+void LoopProfiler::addSample(Stats &stats, uint32_t cycles)
+{
+    if (stats.count == 0 || cycles < stats.min)
+    {
+        stats.min = cycles;
+    }
+    if (cycles > stats.max)
+    {
+        stats.max = cycles;
+    }
+    stats.total += cycles;
+    stats.count++;
+}
+
+
+/**
+ * @brief Prints one line of time statistics.
+ *
+ * @param name Name of the section.
+ * @param stats The statistics.
+ */
+void LoopProfiler::printStats(const char *name, const Stats &stats)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "%-9s %7lu %8lu %8lu %8lu", name, (unsigned long)stats.count,
+             (unsigned long)toMicros(stats.min),
+             (unsigned long)(stats.count ? toMicros(stats.total / stats.count) : 0),
+             (unsigned long)toMicros(stats.max));
+    Serial.println(line);
+}
+
+
+/**
+ * @brief Converts CPU cycles to microseconds.
+ *
+ * @param cycles Number of cycles.
+ * @return Microseconds at the current CPU clock.
+ */
+uint32_t LoopProfiler::toMicros(uint64_t cycles)
+{
+    return cycles / ESP.getCpuFreqMHz();
+}
@@ -0,0 +1,129 @@
+#ifndef LOOPPROFILER_H
+#define LOOPPROFILER_H
+
+#include <Arduino.h>
+
+/**
+ * @file LoopProfiler.h
+ * @brief Declaration of the LoopProfiler class.
+ */
+
+class LoopProfiler {
+public:
+    /**
+     * @brief Parts of loop() that time is charged to.
+     */
+    enum Section : uint8_t {
+        OTHER = 0,     ///< anything outside a named section
+        COMMANDS,      ///< buttons and Serial commands
+        NETWORK,       ///< WiFi, server requests and the local web server
+        STORAGE,       ///< LittleFS
+        PLAYBACK,      ///< cues, LEDs and decoding timelines
+        LOGGING,       ///< telemetry
+        SECTION_COUNT
+    };
+
+    /**
+     * @brief Charges the time until it goes out of scope to a section.
+     */
+    class Scope {
+    public:
+        Scope(Section section);
+        ~Scope();
+    };
+
+    LoopProfiler(); // Constructor declaration
+    void beginLoop(long untilCue);
+    void endLoop();
+    void enter(Section section);
+    void leave();
+    void report();
+
+private:
+    /**
+     * @brief Time statistics, in CPU cycles.
+     */
+    struct Stats {
+        uint32_t count;
+        uint64_t total;
+        uint32_t min;
+        uint32_t max;
+    };
+
+    /**
+     * @brief One of the longest loop() iterations.
+     */
+    struct Stall {
+        uint32_t cycles;
+        uint32_t time;   ///< millis() at the end of the iteration
+        uint8_t section; ///< section that took most of the iteration
+        bool missedDeadline;
+    };
+
+    void charge(uint32_t now);
+    static void addSample(Stats &stats, uint32_t cycles);
+    static void printStats(const char *name, const Stats &stats);
+    static uint32_t toMicros(uint64_t cycles);
+
+    /**
+     * @brief Number of longest iterations kept.
+     */
+    static const int topStalls = 5;
+
+    /**
+     * @brief Deepest nesting of sections.
+     */
+    static const int maxDepth = 4;
+
+    /**
+     * @brief Time of each section per iteration, and of whole iterations, since the last report.
+     */
+    Stats sectionStats[SECTION_COUNT];
+    Stats loopStats;
+
+    /**
+     * @brief Cycles charged to each section in the current iteration.
+     */
+    uint32_t sectionCycles[SECTION_COUNT];
+
+    /**
+     * @brief The longest iterations since the last report, longest first.
+     */
+    Stall stalls[topStalls];
+
+    /**
+     * @brief Sections entered and not left yet, innermost last. Time goes to the innermost one only.
+     */
+    Section stack[maxDepth];
+    int depth = 0;
+
+    /**
+     * @brief Whether an iteration is being timed. Sections outside loop() (e.g. in setup()) are ignored.
+     */
+    bool inLoop = false;
+
+    /**
+     * @brief Cycle count at the start of the iteration, and when time was last charged to a section.
+     */
+    uint32_t loopStart = 0;
+    uint32_t lastCharge = 0;
+
+    /**
+     * @brief Milliseconds until the next cue at the start of the iteration, or -1 if there is none.
+     */
+    long untilCue = -1;
+
+    /**
+     * @brief Whether the current iteration has made a cue late.
+     */
+    bool missedDeadline = false;
+
+    /**
+     * @brief Number of iterations that made a cue late since the last report.
+     */
+    uint32_t deadlineMisses = 0;
+};
+
+extern LoopProfiler profiler;
+
+#endif
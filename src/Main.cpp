@@ -9,34 +9,96 @@
 
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266WiFiMulti.h>
 #include <EEPROM.h>
 
 #include "secrets.h"
+#include "Connection.h"
+#include "Session.h"
 #include "Authentication.h"
 #include "Loading.h"
+#include "Output.h"
 #include "Playing.h"
+#include "PowerManager.h"
+#include "Telemetry.h"
+#include "CommandQueue.h"
+#include "Button.h"
+#include "LoopProfiler.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "Scheduler.h"
+#include "WallClock.h"
+#ifdef LOCAL_SERVER_PORT
+#include "LocalServer.h"
+#endif
+#if defined(SYNC_LEADER) || defined(SYNC_FOLLOWER)
+#include "TimelineSync.h"
+#endif
+
+/**
+ * @brief Instance of the Session class.
+ *
+ * This object holds the JWT token and WiFi client shared by authentication and loading.
+ */
+Session session;
 
 /**
  * @brief Instance of the Authentication class.
  *
  * This object is used for handling authentication operations.
  */
-Authentication authentication;
+Authentication authentication(session);
 
 /**
  * @brief Instance of the Loading class.
  *
  * This object is used for loading timeline data.
  */
-Loading loading;
+Loading loading(session);
+
+/**
+ * @brief Instance of the Output class.
+ *
+ * This object drives the RGB LEDs, one output per timeline track.
+ */
+Output output;
 
 /**
  * @brief Instance of the Playing class.
  *
  * This object is used for playing timeline data.
  */
-Playing playing;
+Playing playing(output);
+
+#ifdef LOCAL_SERVER_PORT
+/**
+ * @brief Instance of the LocalServer class.
+ *
+ * This object accepts timelines pushed over the LAN. Only built when LOCAL_SERVER_PORT is set in secrets.h.
+ */
+LocalServer localServer(playing, LOCAL_SERVER_PORT);
+#endif
+
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+
+#if defined(SYNC_LEADER) || defined(SYNC_FOLLOWER)
+#ifndef SYNC_PORT
+#define SYNC_PORT TimelineSync::defaultPort
+#endif
+/**
+ * @brief Instance of the TimelineSync class.
+ *
+ * This object shares the timeline and start/stop between the poi of a troupe over UDP: the leader
+ * fetches it from the server and passes it on, followers get it from the leader only.
+ * Only built when SYNC_LEADER or SYNC_FOLLOWER is set in secrets.h.
+ */
+#ifdef SYNC_LEADER
+TimelineSync timelineSync(playing, true, SYNC_PORT);
+#else
+TimelineSync timelineSync(playing, false, SYNC_PORT);
+#endif
+#endif
 
 /**
  * @brief Pin number for the built-in LED.
@@ -82,127 +144,562 @@ const int btnUpdatePin = D1;
 const int btnStartPin = D2;
 
 /**
- * @brief WiFi multi-client manager for ESP8266.
+ * @brief Instance of the Connection class.
+ *
+ * This object manages the WiFi connection without blocking playback.
+ */
+Connection connection(WIFI_SSID, WIFI_PASSWORD);
+
+/**
+ * @brief Flag indicating that the timeline still has to be fetched once WiFi is connected.
+ *
+ * This flag is set at startup, so the first connection triggers refreshTimeline().
+ */
+bool loadPending = true;
+
+/**
+ * @brief Instance of the PowerManager class.
+ *
+ * This object sleeps the CPU and WiFi modem between cues.
+ */
+PowerManager powerManager(playing, connection, output);
+
+/**
+ * @brief Longest time loop() idles for, in milliseconds.
  *
- * This object is used for managing multiple WiFi connections on ESP8266.
+ * Keeps the local web server and WiFi connection responsive when the next cue is far away.
  */
-ESP8266WiFiMulti WiFiMulti;
+const unsigned long maxLoopIdle = 100;
 
 /**
- * @brief Flag indicating whether an update is requested.
+ * @brief Time between telemetry flushes, in milliseconds, while telemetry is on.
+ */
+const unsigned long telemetryInterval = 10;
+
+/**
+ * @brief Returns the milliseconds until the next cue, the deadline of the scheduler.
  *
- * This flag is set to true when an update is requested via the update button interrupt.
+ * @return Milliseconds until the next cue, or -1 if there is none.
+ */
+long untilNextCue() {
+  return playing.msUntilNextCue();
+}
+
+/**
+ * @brief Instance of the Scheduler class.
+ *
+ * This object runs the tasks of loop() (see setup()), playback first, and holds the others back
+ * when they would make a cue late.
+ */
+Scheduler scheduler(untilNextCue);
+
+/**
+ * @brief Id of the refresh task, to wake it when a refresh is requested.
+ */
+int refreshTask = -1;
+
+/**
+ * @brief Time between heap snapshots in the telemetry stream, in milliseconds.
+ */
+const unsigned long heapTelemetryInterval = 5000;
+
+/**
+ * @brief Timestamp of the last heap snapshot in the telemetry stream.
  */
-volatile bool updateRequested = false;
+unsigned long lastHeapTelemetry = 0;
+
+/**
+ * @brief Sets up the timeline just fetched, and records how long decoding it took.
+ *
+ * @param timelineData The timeline data.
+ * @return true if the timeline was loaded, false otherwise.
+ */
+bool setupPlaying(const String &timelineData) {
+  LoopProfiler::Scope scope(LoopProfiler::PLAYBACK);
+  Tracer::Span span(Tracer::DECODE);
+  unsigned long startTime = millis();
+  bool ok = playing.setup(timelineData);
+  telemetry.loadPhase(Telemetry::PHASE_DECODE, ok, millis() - startTime);
+  return ok;
+}
+
+/**
+ * @brief Logs in with the password, and records how long it took.
+ *
+ * @return true if the authentication is successful, false otherwise.
+ */
+bool authenticate() {
+  unsigned long startTime = millis();
+  bool ok = authentication.authenticate();
+  telemetry.loadPhase(Telemetry::PHASE_AUTH, ok, millis() - startTime);
+  return ok;
+}
+
+/**
+ * @brief Queue of commands from the button interrupts to loop().
+ */
+CommandQueue commands;
+
+/**
+ * @brief The update button, debounced.
+ */
+Button updateButton(btnUpdatePin);
+
+/**
+ * @brief The start button, debounced.
+ */
+Button startButton(btnStartPin);
+
+/**
+ * @brief Line typed on the Serial monitor so far.
+ */
+char serialLine[32];
+
+/**
+ * @brief Length of serialLine.
+ */
+size_t serialLineLength = 0;
 
 /**
  * @brief Interrupt service routine for handling update button press.
  *
- * This function sets the updateRequested flag to true when the update button is pressed.
+ * This function queues a refresh when the update button is pressed. With an embedded timeline
+ * (no network) it switches to the next timeline instead.
  */
 void ICACHE_RAM_ATTR handleUpdateInterrupt() {
-  updateRequested = true;
+  if (updateButton.pressed()) {
+#ifdef EMBEDDED_TIMELINE
+    commands.push(CommandQueue::NEXT_TIMELINE, micros());
+#else
+    commands.push(CommandQueue::REFRESH, micros());
+#endif
+  }
 }
 
 /**
- * @brief Handles authentication and loading of timeline data.
- * 
- * This function performs the process of checking for saved authentication tokens,
- * handling authentication, and loading timeline data. It prints messages to indicate
- * the status of these operations.
+ * @brief Interrupt service routine for handling start button press.
+ *
+ * This function queues a start/stop when the start button is pressed.
  */
-void handleAuthenticationAndLoading() {
-  Serial.println("Setup: Connection & Authentication");
-  
-  bool isAuthenticated = authentication.checkSavedToken();
-  isAuthenticated = false; // test re-auth - todo: tie this to a button press - todo: not working without this?
+void ICACHE_RAM_ATTR handleStartInterrupt() {
+  if (startButton.pressed()) {
+    commands.push(CommandQueue::START_STOP, micros());
+  }
+}
 
-  if (isAuthenticated) {
-    Serial.println("Authentication found. Using saved.");
-    if (loading.load()) {
-      Serial.println("LOADED AND SAVED TIMELINE SUCCESSFULLY");
-      if (playing.setup()) {
-        Serial.println("SETUP COMPLETE");
-      }
+/**
+ * @brief Starts playing from the beginning. A sync leader starts the whole troupe at once.
+ */
+void startShow() {
+#ifdef SYNC_LEADER
+  timelineSync.sendStart(); // this poi starts with the others
+#else
+  playing.start();
+#endif
+}
+
+/**
+ * @brief Stops playing. A sync leader stops the whole troupe.
+ */
+void stopShow() {
+#ifdef SYNC_LEADER
+  timelineSync.sendStop();
+#else
+  playing.stop();
+#endif
+}
+
+/**
+ * @brief Carries out a command from a button or the Serial monitor.
+ *
+ * A refresh only marks the timeline to be fetched, so however many come in before it happens,
+ * the server is only asked once.
+ *
+ * @param type The command.
+ * @param argument The command's argument, or an empty string if it has none.
+ */
+void handleCommand(CommandQueue::Type type, const char *argument) {
+  switch (type) {
+  case CommandQueue::REFRESH:
+    loadPending = true; // fetched once WiFi is connected
+    break;
+  case CommandQueue::NEXT_TIMELINE:
+    playing.nextTimeline();
+    break;
+  case CommandQueue::START_STOP:
+    if (playing.isPlaying()) {
+      stopShow();
     } else {
-      Serial.println("LOADING AND SAVING TIMELINE UNSUCCESSFUL");
+      startShow();
     }
-  } else {
-    bool isAuthenticating = authentication.authenticate();
-    if (isAuthenticating) {
-      isAuthenticated = authentication.checkSavedToken();
-      if (isAuthenticated) {
-        Serial.println("Authenticated using login success. Should be saved now, using..");
-        if (loading.load()) {
-          Serial.println("LOADED AND SAVED TIMELINE SUCCESSFULLY");
-          if (playing.setup()) {
-            Serial.println("SETUP COMPLETE");
-          }
-        } else {
-          Serial.println("LOADING AND SAVING TIMELINE UNSUCCESSFUL");
-        }
+    break;
+  case CommandQueue::START:
+    startShow();
+    break;
+  case CommandQueue::STOP:
+    stopShow();
+    break;
+  case CommandQueue::RESYNC:
+#ifdef SYNC_LEADER
+    timelineSync.sendStart(); // back to the beginning together
+#else
+    playing.restart();
+#endif
+    break;
+  case CommandQueue::RATE:
+    if (*argument != '\0') {
+      double multiplier = strtod(argument, nullptr);
+      if (multiplier > 0 && isfinite(multiplier)) {
+        // limit it before converting, a multiplier far out of range doesn't fit in the Q16 rate
+        multiplier = constrain(multiplier, (double)Playing::minRate / Playing::rateOne,
+                               (double)Playing::maxRate / Playing::rateOne);
+        playing.setRate((uint32_t)(multiplier * Playing::rateOne + 0.5));
       } else {
-        Serial.println("Auth check saved JWT after password login failed");
+        Serial.println("Bad rate, e.g. rate 1.05 for 5% faster");
       }
     } else {
+      Serial.print("Rate: ");
+      Serial.print(playing.getRate() * 100.0 / Playing::rateOne, 1);
+      Serial.println("%");
+    }
+    break;
+  case CommandQueue::PROFILE:
+    profiler.report();
+    scheduler.report();
+    break;
+  case CommandQueue::SWAP:
+    if (strcmp(argument, "now") == 0) {
+      playing.setSwapMode(Playing::SWAP_NOW);
+    } else if (strcmp(argument, "loop") == 0) {
+      playing.setSwapMode(Playing::SWAP_AT_LOOP_END);
+    } else if (isdigit(*argument)) {
+      playing.setSwapMode(Playing::SWAP_AT_CUE, atol(argument));
+    } else if (*argument == '\0') {
+      playing.printSwapMode();
+    } else {
+      Serial.println("Bad swap, e.g. swap now, swap loop or swap 12000 (at the cue at 12 s)");
+    }
+    break;
+  case CommandQueue::SYNC:
+#if defined(SYNC_LEADER) || defined(SYNC_FOLLOWER)
+    timelineSync.printStatus();
+#else
+    Serial.println("Sync is off, set SYNC_LEADER or SYNC_FOLLOWER in secrets.h");
+#endif
+    break;
+  case CommandQueue::METRICS:
+    Serial.print(metrics.render());
+    break;
+  case CommandQueue::TRACE:
+    Serial.print(tracer.render());
+    break;
+  case CommandQueue::CLOCK:
+    wallClock.printStatus();
+    if (playing.getScheduledStart() != 0) {
+      Serial.print("Timeline starts at ");
+      WallClock::print(playing.getScheduledStart());
+      Serial.println(" UTC");
+    }
+    break;
+  }
+}
+
+/**
+ * @brief Handles the commands queued by the buttons and any typed on the Serial monitor.
+ *
+ * Serial input is read without waiting, a line at a time.
+ */
+void handleCommands() {
+  CommandQueue::Command command;
+  while (commands.pop(command)) {
+    Serial.print("Button: ");
+    Serial.print(CommandQueue::name(command.type));
+    Serial.print(" (");
+    Serial.print(micros() - command.time);
+    Serial.println(" us)");
+    handleCommand(command.type, "");
+  }
+
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (serialLineLength < sizeof(serialLine) - 1) {
+        serialLine[serialLineLength++] = c;
+      }
+      continue;
+    }
+    if (serialLineLength == 0) {
+      continue;
+    }
+    serialLine[serialLineLength] = '\0';
+    serialLineLength = 0;
+
+    CommandQueue::Type type;
+    const char *argument;
+    if (CommandQueue::parse(serialLine, type, argument)) {
+      handleCommand(type, argument);
+    } else {
+      Serial.print("Unknown command: ");
+      Serial.println(serialLine);
+      Serial.println("Commands: refresh, next, start, stop, startstop, resync, rate [multiplier], profile, swap [now|loop|ms], sync, metrics, trace, clock");
+    }
+  }
+}
+
+/**
+ * @brief Steps of a refresh, see refreshStep(). Loading's own steps follow on from REFRESH_LOAD as scheduler phases.
+ */
+enum RefreshState : uint8_t { REFRESH_IDLE = 0, REFRESH_AUTH = 1, REFRESH_DECODE = 2, REFRESH_LOAD = 3 };
+
+/**
+ * @brief What the next step of the refresh does.
+ */
+RefreshState refreshState = REFRESH_IDLE;
+
+/**
+ * @brief Timestamp when the current refresh started.
+ */
+unsigned long refreshStartTime = 0;
+
+/**
+ * @brief Ends a refresh, records it, and lets a sync leader offer what it has to the followers,
+ * even if the server couldn't be reached.
+ *
+ * @param ok Whether a timeline was loaded.
+ * @return Scheduler::asleep, for refreshStep() to return.
+ */
+unsigned long finishRefresh(bool ok) {
+  refreshState = REFRESH_IDLE;
+  scheduler.setPhase(REFRESH_AUTH); // the next refresh starts with authentication
+  tracer.endRefresh(ok);
+  metrics.refreshed(ok, millis() - refreshStartTime);
+#ifdef SYNC_LEADER
+  timelineSync.offer();
+#endif
+  return Scheduler::asleep;
+}
+
+/**
+ * @brief Does the next step of a refresh: authentication, then loading the timeline data (a step at a
+ * time, see Loading::step()), then decoding it, and only if it loads, saving it in place of the saved one.
+ *
+ * This function performs the process of checking for saved authentication tokens,
+ * handling authentication, and loading timeline data. It prints messages to indicate
+ * the status of these operations. It is the step function of the refresh task, which sleeps
+ * until refreshTimeline() wakes it.
+ *
+ * @return Milliseconds until the next step, or Scheduler::asleep when there is no refresh.
+ */
+unsigned long refreshStep() {
+  switch (refreshState) {
+  case REFRESH_AUTH: {
+    Serial.println("Setup: Connection & Authentication");
+    bool isAuthenticated = authentication.checkSavedToken();
+    isAuthenticated = false; // test re-auth - todo: tie this to a button press - todo: not working without this?
+
+    if (isAuthenticated) {
+      Serial.println("Authentication found. Using saved.");
+    } else if (!authenticate()) {
       Serial.println("Failed to authenticate with password");
+      return finishRefresh(false);
+    } else if (!authentication.checkSavedToken()) {
+      Serial.println("Auth check saved JWT after password login failed");
+      return finishRefresh(false);
+    } else {
+      Serial.println("Authenticated using login success. Should be saved now, using..");
     }
+    loading.begin();
+    refreshState = REFRESH_LOAD;
+    scheduler.setPhase(REFRESH_LOAD + loading.getState() - 1);
+    return 0;
   }
+  case REFRESH_LOAD:
+    switch (loading.step()) {
+    case Loading::BUSY:
+      scheduler.setPhase(REFRESH_LOAD + loading.getState() - 1);
+      return 0;
+    case Loading::WAITING:
+      return Loading::pollInterval;
+    case Loading::FETCHED:
+      refreshState = REFRESH_DECODE;
+      scheduler.setPhase(REFRESH_DECODE);
+      return 0;
+    case Loading::DONE:
+      Serial.println("LOADED AND SAVED TIMELINE SUCCESSFULLY");
+      return finishRefresh(true);
+    default:
+      Serial.println("LOADING AND SAVING TIMELINE UNSUCCESSFUL");
+      return finishRefresh(false);
+    }
+  case REFRESH_DECODE:
+    if (!setupPlaying(loading.getBody())) {
+      Serial.println("Fetched timeline doesn't load, keeping the saved one");
+      loading.cancel();
+      return finishRefresh(false);
+    }
+    Serial.println("SETUP COMPLETE");
+    refreshState = REFRESH_LOAD; // on to saving it
+    scheduler.setPhase(REFRESH_LOAD + loading.getState() - 1);
+    return 0;
+  default:
+    return Scheduler::asleep;
+  }
+}
+
+/**
+ * @brief Fetches the timeline: from the server, or from the leader for a sync follower.
+ *
+ * Only starts the refresh; the refresh task does it a step at a time between cues.
+ */
+void refreshTimeline() {
+#ifdef SYNC_FOLLOWER
+  timelineSync.requestTimeline(); // counted in the metrics when the timeline arrives
+#else
+  refreshStartTime = millis();
+  tracer.beginRefresh();
+  refreshState = REFRESH_AUTH;
+  scheduler.wake(refreshTask);
+#endif
+}
+
+/**
+ * @brief Step of the playback task: shows the cues that are due. Runs before every other step.
+ *
+ * @return 0, the deadline of the next cue is what counts (see untilNextCue()).
+ */
+unsigned long playbackStep() {
+  playing.play();
+  return 0;
+}
+
+/**
+ * @brief Step of the input task: carries out commands from the buttons and the Serial monitor.
+ *
+ * @return Milliseconds until the next step.
+ */
+unsigned long inputStep() {
+  handleCommands();
+  return maxLoopIdle;
+}
+
+/**
+ * @brief Step of the network task: keeps the WiFi connection going, and once connected starts a
+ * refresh for the first load and whenever an update is requested, and keeps the troupe sync
+ * going (if enabled). It also serves the local web server (if enabled).
+ *
+ * @return Milliseconds until the next step.
+ */
+unsigned long networkStep() {
+  if (connection.poll()) {
+    if (loadPending && refreshState == REFRESH_IDLE) {
+      loadPending = false;
+      refreshTimeline();
+    }
+#if defined(SYNC_LEADER) || defined(SYNC_FOLLOWER)
+    timelineSync.poll();
+#endif
+  }
+
+#ifdef LOCAL_SERVER_PORT
+  localServer.handleClient();
+#endif
+  return maxLoopIdle;
+}
+
+/**
+ * @brief Step of the logging task: sends any queued telemetry, with a heap snapshot every few seconds.
+ *
+ * @return Milliseconds until the next step, or Scheduler::asleep with telemetry off.
+ */
+unsigned long loggingStep() {
+  if (!telemetry.isEnabled()) {
+    return Scheduler::asleep;
+  }
+  if (millis() - lastHeapTelemetry >= heapTelemetryInterval) {
+    lastHeapTelemetry = millis();
+    telemetry.heap();
+  }
+  telemetry.flush();
+  return telemetryInterval;
+}
+
+/**
+ * @brief Step of the effects task: renders the frames of the effects of the next cues, in the idle time between them.
+ *
+ * @return Milliseconds until the next step.
+ */
+unsigned long effectsStep() {
+  return playing.renderAhead();
 }
 
 /**
  * @brief Sets up the system including WiFi connection, authentication, and loading and playing timeline data.
  * 
- * This function initializes the system by establishing a WiFi connection, setting up interrupt for update button,
- * and calling handleAuthenticationAndLoading() to handle authentication and loading processes.
+ * This function initializes the pins, starts playing the timeline saved in LittleFS straight away,
+ * starts connecting to WiFi without waiting for it, and sets up the interrupts for the update and start buttons.
+ * The timeline is fetched from the server in loop() once WiFi is connected, so the time to first light
+ * doesn't depend on the network. If EMBEDDED_TIMELINE is set in secrets.h, that timeline built into
+ * the firmware is played instead and WiFi stays off.
  */
 void setup() {
   Serial.begin(115200);
+#ifdef TELEMETRY
+  telemetry.begin();
+#endif
   pinMode(led, OUTPUT);
   digitalWrite(led, HIGH); // HIGH is off for D1 mini
 
-  // Set the digital pins as outputs
-  pinMode(greenLEDPin, OUTPUT);
-  pinMode(redLEDPin, OUTPUT);
-  pinMode(blueLEDPin, OUTPUT);
-  pinMode(btnUpdatePin, INPUT_PULLUP);
-
-  // WiFi connection
-  WiFi.mode(WIFI_STA);
-  WiFiMulti.addAP(WIFI_SSID, WIFI_PASSWORD);
-  Serial.println("Connecting to WiFi");
-  while (WiFiMulti.run() != WL_CONNECTED) {
-    Serial.print(".");
-    delay(500);
-  }
+  // Set the digital pins as outputs - track 0 drives this LED, further tracks an extra LED if set in secrets.h
+  output.addChannel(redLEDPin, greenLEDPin, blueLEDPin);
+#ifdef OUTPUT2_PINS
+  output.addChannel(OUTPUT2_PINS);
+#endif
+#ifdef EMBEDDED_TIMELINE
+  // Fixed show built into the firmware: no network needed
+  WiFi.mode(WIFI_OFF);
+  playing.setupEmbedded(EMBEDDED_TIMELINE);
+#else
+  // Play the saved timeline while connecting
+  playing.setup();
+
+  // WiFi connection, and the wall clock once connected (for timelines with a start time)
+  connection.begin();
+  wallClock.begin(NTP_SERVER);
+  powerManager.begin();
+#if defined(SYNC_LEADER) || defined(SYNC_FOLLOWER)
+  timelineSync.begin();
+#endif
+#endif
 
-  Serial.println("");
-  Serial.println("WiFi connected");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
+  // Set up interrupts for the buttons
+  updateButton.begin(handleUpdateInterrupt);
+  startButton.begin(handleStartInterrupt);
 
-  // Set up interrupt for update button
-  attachInterrupt(digitalPinToInterrupt(btnUpdatePin), handleUpdateInterrupt, FALLING);
+#ifdef LOCAL_SERVER_PORT
+  localServer.begin();
+#endif
 
-  // Handle authentication and loading
-  handleAuthenticationAndLoading();
+  scheduler.add("playback", playbackStep, Scheduler::PRIORITY_PLAYBACK, LoopProfiler::PLAYBACK);
+  scheduler.add("input", inputStep, Scheduler::PRIORITY_INPUT, LoopProfiler::COMMANDS);
+  scheduler.add("network", networkStep, Scheduler::PRIORITY_NETWORK, LoopProfiler::NETWORK);
+  refreshTask = scheduler.add("refresh", refreshStep, Scheduler::PRIORITY_REFRESH, LoopProfiler::NETWORK);
+  scheduler.add("logging", loggingStep, Scheduler::PRIORITY_LOGGING, LoopProfiler::LOGGING);
+  scheduler.add("effects", effectsStep, Scheduler::PRIORITY_IDLE, LoopProfiler::PLAYBACK);
 }
 
 /**
  * @brief Main loop of the program.
  * 
- * This function is the main loop of the program. It checks for update requests and calls
- * handleAuthenticationAndLoading() if an update is requested. It also calls the play function
- * to execute the playing process, which involves changing LED colors over time according to
- * the timeline data. Additionally, it adds a delay of 5 seconds between each play iteration
- * to control the timing of the LED color changes.
+ * This function is the main loop of the program. The scheduler runs the steps of the tasks that are due:
+ * playback (the play function, which changes LED colors over time according to the timeline data) first and
+ * between every other step, then commands from the buttons and the Serial monitor, the network (WiFi, sync and
+ * the local web server), a refresh in progress, telemetry and rendering effects ahead, holding back any step that would make a cue late.
+ * Finally it idles (sleeping the CPU and modem) until just before the next cue or task, for at most maxLoopIdle.
+ * Each iteration up to the idle is timed by the profiler, section by section (see LoopProfiler).
  */
 void loop() {
-  if (updateRequested) {
-    updateRequested = false;
-    handleAuthenticationAndLoading();
-  }
-
-  playing.play();
-  delay(5000); // Example: Delay for 5 seconds between each play
+  profiler.beginLoop(playing.msUntilNextCue());
+  scheduler.run();
+  profiler.endLoop();
+  powerManager.idle(min(maxLoopIdle, scheduler.msUntilNextRun()));
 }
@@ -0,0 +1,360 @@
+/**
+ * @file Metrics.cpp
+ * @brief Implementation of the Metrics class.
+ *
+ * Running counters for watching a fleet of poi without a Serial cable: cue lateness, loop() stalls,
+ * refreshes, downloads, flash writes, WiFi reconnects and effect frames, and the HTTP requests, LittleFS mounts and
+ * files in use, which should be back to 0 between refreshes (anything else is a leak). Every update
+ * is a few additions on fixed fields, O(1) and without allocating, so it can sit on hot paths. The counters only ever
+ * go up (until a reset), and are turned into the Prometheus text format only when someone asks
+ * for them, see render() and GET /metrics on the LocalServer.
+ */
+
+
+#include "Metrics.h"
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+Metrics metrics;
+
+const uint16_t Metrics::latenessBounds[latenessBuckets] = {0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000};
+
+/**
+ * @brief Label values of the resources, indexed by Resource.
+ */
+static const char *const resourceNames[] = {"http_request", "fs_mount", "file"};
+
+/**
+ * @brief Default constructor for Metrics class.
+ */
+Metrics::Metrics()
+{
+}
+
+
+/**
+ * @brief Counts a cue being shown.
+ *
+ * @param lateness How late the cue was shown, in milliseconds.
+ */
+void Metrics::cueFired(long lateness)
+{
+    if (lateness < 0)
+    {
+        lateness = 0;
+    }
+    int bucket = 0;
+    while (bucket < latenessBuckets && lateness > latenessBounds[bucket])
+    {
+        bucket++;
+    }
+    latenessCounts[bucket]++;
+    latenessSum += lateness;
+    cues++;
+    if (lateness > maxLateness)
+    {
+        maxLateness = lateness;
+    }
+}
+
+
+/**
+ * @brief Counts a loop() iteration, see LoopProfiler::endLoop().
+ *
+ * @param micros How long the iteration took, in microseconds.
+ * @param missedDeadline Whether it made a cue late.
+ */
+void Metrics::loopEnded(uint32_t micros, bool missedDeadline)
+{
+    loops++;
+    if (micros >= stallMicros)
+    {
+        stalls++;
+    }
+    if (missedDeadline)
+    {
+        deadlineMisses++;
+    }
+    if (micros > maxLoopMicros)
+    {
+        maxLoopMicros = micros;
+    }
+}
+
+
+/**
+ * @brief Counts a timeline refresh.
+ *
+ * @param ok Whether a new timeline was loaded.
+ * @param duration How long it took, in milliseconds.
+ */
+void Metrics::refreshed(bool ok, uint32_t duration)
+{
+    refreshes++;
+    if (!ok)
+    {
+        failedRefreshes++;
+    }
+    refreshMillis += duration;
+    lastRefreshMillis = duration;
+    if (duration > maxRefreshMillis)
+    {
+        maxRefreshMillis = duration;
+    }
+}
+
+
+/**
+ * @brief Counts an HTTP request to the server.
+ *
+ * @param ok Whether it succeeded.
+ * @param bytes Size of the response.
+ */
+void Metrics::request(bool ok, uint32_t bytes)
+{
+    requests++;
+    if (!ok)
+    {
+        failedRequests++;
+    }
+    bytesDownloaded += bytes;
+}
+
+
+/**
+ * @brief Counts bytes written to LittleFS.
+ *
+ * @param bytes Number of bytes.
+ */
+void Metrics::flashWrite(uint32_t bytes)
+{
+    bytesWritten += bytes;
+}
+
+
+/**
+ * @brief Counts a file saved to LittleFS.
+ *
+ * @param ok Whether it was saved completely.
+ */
+void Metrics::fileSaved(bool ok)
+{
+    if (ok)
+    {
+        filesSaved++;
+    }
+    else
+    {
+        failedSaves++;
+    }
+}
+
+
+/**
+ * @brief Counts a WiFi connection being made.
+ */
+void Metrics::wifiConnected()
+{
+    wifiConnects++;
+}
+
+
+/**
+ * @brief Counts a WiFi connection being lost.
+ */
+void Metrics::wifiLost()
+{
+    wifiDisconnects++;
+}
+
+
+/**
+ * @brief Counts a WiFi connection attempt that timed out.
+ */
+void Metrics::wifiAttemptFailed()
+{
+    wifiFailures++;
+}
+
+
+/**
+ * @brief Counts a frame of an effect being shown.
+ *
+ * @param cached Whether it came from the EffectCache, rather than being rendered on the spot.
+ */
+void Metrics::effectFrame(bool cached)
+{
+    effectFrames++;
+    if (!cached)
+    {
+        effectMisses++;
+    }
+}
+
+
+/**
+ * @brief Counts a resource being taken.
+ *
+ * @param resource The resource.
+ */
+void Metrics::opened(Resource resource)
+{
+    inUse[resource]++;
+    if (inUse[resource] > maxInUse[resource])
+    {
+        maxInUse[resource] = inUse[resource];
+    }
+}
+
+
+/**
+ * @brief Counts a resource being handed back.
+ *
+ * @param resource The resource.
+ */
+void Metrics::closed(Resource resource)
+{
+    inUse[resource]--;
+}
+
+
+/**
+ * @brief Puts the counters, and the uptime, heap and WiFi signal as they are now, in the Prometheus text format.
+ *
+ * @return The metrics, about 3 KB.
+ */
+String Metrics::render()
+{
+    String out;
+    out.reserve(3072);
+
+    addGauge(out, "magicpoi_uptime_seconds", "Time since the last reset.", millis() / 1000);
+    addGauge(out, "magicpoi_heap_free_bytes", "Free heap.", ESP.getFreeHeap());
+    addGauge(out, "magicpoi_heap_max_block_bytes", "Largest free block of heap.", ESP.getMaxFreeBlockSize());
+    addGauge(out, "magicpoi_heap_fragmentation_percent", "Heap fragmentation.", ESP.getHeapFragmentation());
+
+    addHeader(out, "magicpoi_cue_lateness_ms", "How late cues were shown.", "histogram");
+    uint32_t cumulative = 0;
+    for (int i = 0; i < latenessBuckets; i++)
+    {
+        cumulative += latenessCounts[i];
+        out += "magicpoi_cue_lateness_ms_bucket{le=\"" + String(latenessBounds[i]) + "\"} " + String(cumulative) + "\n";
+    }
+    out += "magicpoi_cue_lateness_ms_bucket{le=\"+Inf\"} " + String(cues) + "\n";
+    out += "magicpoi_cue_lateness_ms_sum " + String(latenessSum) + "\n";
+    out += "magicpoi_cue_lateness_ms_count " + String(cues) + "\n";
+    addHeader(out, "magicpoi_cue_lateness_quantile_ms", "Cue lateness percentiles, to the bucket bound.", "gauge");
+    out += "magicpoi_cue_lateness_quantile_ms{quantile=\"0.5\"} " + String(latenessQuantile(500)) + "\n";
+    out += "magicpoi_cue_lateness_quantile_ms{quantile=\"0.9\"} " + String(latenessQuantile(900)) + "\n";
+    out += "magicpoi_cue_lateness_quantile_ms{quantile=\"0.99\"} " + String(latenessQuantile(990)) + "\n";
+    addGauge(out, "magicpoi_cue_lateness_max_ms", "Latest cue.", maxLateness);
+
+    addCounter(out, "magicpoi_loops_total", "loop() iterations.", loops);
+    addCounter(out, "magicpoi_loop_stalls_total", "loop() iterations of 20 ms or more.", stalls);
+    addCounter(out, "magicpoi_loop_deadline_misses_total", "loop() iterations that made a cue late.", deadlineMisses);
+    addGauge(out, "magicpoi_loop_max_us", "Longest loop() iteration.", maxLoopMicros);
+
+    addCounter(out, "magicpoi_refreshes_total", "Timeline refreshes.", refreshes);
+    addCounter(out, "magicpoi_refresh_failures_total", "Timeline refreshes that loaded no timeline.", failedRefreshes);
+    addCounter(out, "magicpoi_refresh_ms_total", "Time spent refreshing.", refreshMillis);
+    addGauge(out, "magicpoi_refresh_last_ms", "Duration of the last refresh.", lastRefreshMillis);
+    addGauge(out, "magicpoi_refresh_max_ms", "Longest refresh.", maxRefreshMillis);
+
+    addCounter(out, "magicpoi_http_requests_total", "Requests to the server.", requests);
+    addCounter(out, "magicpoi_http_failures_total", "Requests to the server that failed.", failedRequests);
+    addCounter(out, "magicpoi_downloaded_bytes_total", "Bytes received from the server.", bytesDownloaded);
+
+    addCounter(out, "magicpoi_flash_written_bytes_total", "Bytes written to LittleFS.", bytesWritten);
+    addCounter(out, "magicpoi_flash_files_saved_total", "Files saved to LittleFS.", filesSaved);
+    addCounter(out, "magicpoi_flash_save_failures_total", "Files that failed to save.", failedSaves);
+
+    addGauge(out, "magicpoi_wifi_connected", "1 if WiFi is connected.", WiFi.status() == WL_CONNECTED);
+    addGauge(out, "magicpoi_wifi_rssi_dbm", "WiFi signal strength.", WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0);
+    addCounter(out, "magicpoi_wifi_connects_total", "WiFi connections made.", wifiConnects);
+    addCounter(out, "magicpoi_wifi_disconnects_total", "WiFi connections lost.", wifiDisconnects);
+    addCounter(out, "magicpoi_wifi_failed_attempts_total", "WiFi connection attempts that timed out.", wifiFailures);
+
+    addCounter(out, "magicpoi_effect_frames_total", "Frames of effects shown.", effectFrames);
+    addCounter(out, "magicpoi_effect_frame_misses_total", "Frames of effects rendered on the spot, not ahead.", effectMisses);
+
+    addHeader(out, "magicpoi_resources_in_use", "Resources in use now, 0 between refreshes unless one leaks.", "gauge");
+    for (int i = 0; i < RESOURCE_COUNT; i++)
+    {
+        out += "magicpoi_resources_in_use{resource=\"" + String(resourceNames[i]) + "\"} " + String(inUse[i]) + "\n";
+    }
+    addHeader(out, "magicpoi_resources_in_use_max", "Most resources in use at once.", "gauge");
+    for (int i = 0; i < RESOURCE_COUNT; i++)
+    {
+        out += "magicpoi_resources_in_use_max{resource=\"" + String(resourceNames[i]) + "\"} " + String(maxInUse[i]) + "\n";
+    }
+    return out;
+}
+
+
+/**
+ * @brief Works out a percentile of the cue lateness from the buckets.
+ *
+ * @param permille The percentile, in tenths of a percent.
+ * @return Upper bound of the bucket the percentile falls in, in milliseconds (the latest cue for the last bucket), 0 with no cues.
+ */
+long Metrics::latenessQuantile(uint32_t permille)
+{
+    if (cues == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = ((uint64_t)cues * permille + 999) / 1000; // the rank-th cue, counting from 1
+    uint32_t cumulative = 0;
+    for (int i = 0; i < latenessBuckets; i++)
+    {
+        cumulative += latenessCounts[i];
+        if (cumulative >= rank)
+        {
+            return min((long)latenessBounds[i], maxLateness);
+        }
+    }
+    return maxLateness;
+}
+
+
+/**
+ * @brief Adds a counter to the output.
+ */
+void Metrics::addCounter(String &out, const char *name, const char *help, uint32_t value)
+{
+    addHeader(out, name, help, "counter");
+    out += name;
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+
+/**
+ * @brief Adds a gauge to the output.
+ */
+void Metrics::addGauge(String &out, const char *name, const char *help, long value)
+{
+    addHeader(out, name, help, "gauge");
+    out += name;
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+
+/**
+ * @brief Adds the HELP and TYPE lines of a metric to the output.
+ */
+void Metrics::addHeader(String &out, const char *name, const char *help, const char *type)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
@@ -0,0 +1,119 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+/**
+ * @file Metrics.h
+ * @brief Declaration of the Metrics class.
+ */
+
+class Metrics {
+public:
+    /**
+     * @brief Resources that must be handed back after use. Keep in step with resourceNames.
+     */
+    enum Resource : uint8_t {
+        HTTP_REQUEST = 0,  ///< an HTTPClient set up by Session::beginRequest(), until Session::endRequest()
+        FS_MOUNT,          ///< LittleFS mounted by Storage or Connection
+        OPEN_FILE,         ///< a LittleFS file open
+        RESOURCE_COUNT
+    };
+
+    Metrics(); // Constructor declaration
+    void cueFired(long lateness);
+    void loopEnded(uint32_t micros, bool missedDeadline);
+    void refreshed(bool ok, uint32_t duration);
+    void request(bool ok, uint32_t bytes);
+    void flashWrite(uint32_t bytes);
+    void fileSaved(bool ok);
+    void wifiConnected();
+    void wifiLost();
+    void wifiAttemptFailed();
+    void effectFrame(bool cached);
+    void opened(Resource resource);
+    void closed(Resource resource);
+    String render();
+
+private:
+    static void addCounter(String &out, const char *name, const char *help, uint32_t value);
+    static void addGauge(String &out, const char *name, const char *help, long value);
+    static void addHeader(String &out, const char *name, const char *help, const char *type);
+    long latenessQuantile(uint32_t permille);
+
+    /**
+     * @brief Upper bounds of the cue lateness buckets, in milliseconds. The last bucket holds the rest.
+     */
+    static const uint16_t latenessBounds[];
+    static const int latenessBuckets = 12;
+
+    /**
+     * @brief Shortest loop() iteration counted as a stall, in microseconds, even if no cue was due.
+     */
+    static const uint32_t stallMicros = 20000;
+
+    /**
+     * @brief Cues shown, by lateness bucket (not cumulative), and the total lateness in milliseconds.
+     */
+    uint32_t latenessCounts[latenessBuckets + 1] = {};
+    uint32_t latenessSum = 0;
+    uint32_t cues = 0;
+    long maxLateness = 0;
+
+    /**
+     * @brief loop() iterations, those longer than stallMicros, those that made a cue late, and the longest one in microseconds.
+     */
+    uint32_t loops = 0;
+    uint32_t stalls = 0;
+    uint32_t deadlineMisses = 0;
+    uint32_t maxLoopMicros = 0;
+
+    /**
+     * @brief Timeline refreshes, those that failed, and their durations in milliseconds.
+     */
+    uint32_t refreshes = 0;
+    uint32_t failedRefreshes = 0;
+    uint32_t refreshMillis = 0;
+    uint32_t lastRefreshMillis = 0;
+    uint32_t maxRefreshMillis = 0;
+
+    /**
+     * @brief HTTP requests to the server, those that failed, and the bytes of the responses.
+     */
+    uint32_t requests = 0;
+    uint32_t failedRequests = 0;
+    uint32_t bytesDownloaded = 0;
+
+    /**
+     * @brief Bytes written to LittleFS, and files saved or that failed to save.
+     */
+    uint32_t bytesWritten = 0;
+    uint32_t filesSaved = 0;
+    uint32_t failedSaves = 0;
+
+    /**
+     * @brief WiFi connections made, connections lost, and attempts that timed out.
+     */
+    uint32_t wifiConnects = 0;
+    uint32_t wifiDisconnects = 0;
+    uint32_t wifiFailures = 0;
+
+    /**
+     * @brief Frames of effects shown, and those that weren't in the cache yet and were rendered on the spot.
+     */
+    uint32_t effectFrames = 0;
+    uint32_t effectMisses = 0;
+
+    /**
+     * @brief Resources in use now (more closed than opened shows as negative), and the most in use at once.
+     */
+    int16_t inUse[RESOURCE_COUNT] = {};
+    int16_t maxInUse[RESOURCE_COUNT] = {};
+};
+
+/**
+ * @brief The counters, shared by all classes like telemetry.
+ */
+extern Metrics metrics;
+
+#endif
@@ -0,0 +1,275 @@
+/**
+ * @file Output.cpp
+ * @brief Implementation of the Output class.
+ *
+ * The output layer between the timeline tracks and the LEDs. Track N drives RGB output N;
+ * tracks beyond the last output are layered onto the last one, so the most recent cue on any
+ * of them is shown (an effect track over a base track, or two poi heads on a single LED).
+ * Cues only set the colour of a channel; show() then writes every changed channel in one go,
+ * so cues that are due together reach the LEDs in the same frame. A frame of an effect (see
+ * EffectCache) is set as PWM duties instead of a colour, and only the duties that changed are written.
+ *
+ * A colour is an index into a palette of up to 256 colours. Palette colours are converted to
+ * PWM duties once, when they are set, so showing a colour is a table lookup. A new palette is
+ * built in a second, staged table and swapped in whole, so it can be prepared while the old one
+ * is still showing and takes over in the same frame as the timeline that brought it.
+ */
+
+
+#include "Output.h"
+#include <Arduino.h>
+
+/**
+ * @brief The palette used when the timeline doesn't bring one: the colours the site has always used.
+ *
+ * Colours after these are off.
+ */
+static const uint8_t defaultPalette[][3] PROGMEM = {
+    {255, 0, 0},     // 0: red
+    {0, 255, 0},     // 1: green
+    {0, 0, 255},     // 2: blue
+    {0, 255, 255},   // 3: cyan
+    {255, 0, 255},   // 4: magenta
+    {255, 255, 0},   // 5: yellow
+    {255, 255, 255}, // 6: white
+};
+
+// Constructor definition
+Output::Output()
+{
+    memset(palettes, 0, sizeof(palettes)); // including both off rows
+    resetPalette();
+    swapPalette();
+    resetPalette();
+}
+
+
+/**
+ * @brief Adds an RGB LED output.
+ *
+ * Outputs are numbered in the order they are added, starting at 0 for track 0.
+ *
+ * @param redPin Pin of the red LED.
+ * @param greenPin Pin of the green LED.
+ * @param bluePin Pin of the blue LED.
+ * @return true if the output was added, false if there are already maxChannels.
+ */
+bool Output::addChannel(int redPin, int greenPin, int bluePin)
+{
+    if (channelCount >= maxChannels)
+    {
+        return false;
+    }
+
+    analogWriteRange(maxDuty);
+    Channel &channel = channels[channelCount++];
+    channel.pins[0] = redPin;
+    channel.pins[1] = greenPin;
+    channel.pins[2] = bluePin;
+    channel.colour = off;
+    channel.shown = off;
+    for (int i = 0; i < 3; i++)
+    {
+        pinMode(channel.pins[i], OUTPUT);
+        channel.written[i] = 0;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Returns the number of RGB outputs.
+ *
+ * @return Number of outputs added with addChannel().
+ */
+int Output::getChannelCount()
+{
+    return channelCount;
+}
+
+
+/**
+ * @brief Sets the colour for a track, to be shown by the next show().
+ *
+ * @param track Index of the track. Tracks beyond the last output use the last output.
+ * @param colour Index of the colour in the palette.
+ */
+void Output::setColour(int track, uint8_t colour)
+{
+    if (channelCount == 0)
+    {
+        return;
+    }
+    channels[track < channelCount ? track : channelCount - 1].colour = colour;
+}
+
+
+/**
+ * @brief Sets a frame of an effect for a track, to be shown by the next show().
+ *
+ * @param track Index of the track. Tracks beyond the last output use the last output.
+ * @param duties Red, green and blue PWM duties, 0 to the PWM range.
+ */
+void Output::setFrame(int track, const uint16_t duties[3])
+{
+    if (channelCount == 0)
+    {
+        return;
+    }
+    Channel &channel = channels[track < channelCount ? track : channelCount - 1];
+    channel.colour = frame;
+    memcpy(channel.frame, duties, sizeof(channel.frame));
+}
+
+
+/**
+ * @brief Returns the PWM duties of a colour of the palette shown.
+ *
+ * @param colour Index of the colour in the palette.
+ * @return Red, green and blue PWM duties.
+ */
+const uint16_t *Output::getDuties(uint8_t colour)
+{
+    return palette[colour];
+}
+
+
+/**
+ * @brief Writes the colours set since the last show() to the LEDs.
+ *
+ * Only channels whose colour changed are written, and of a frame only the duties that changed.
+ */
+void Output::show()
+{
+    for (int i = 0; i < channelCount; i++)
+    {
+        Channel &channel = channels[i];
+        if (channel.colour == channel.shown && channel.colour != frame)
+        {
+            continue;
+        }
+
+        const uint16_t *duties = channel.colour == frame ? channel.frame : palette[channel.colour];
+        for (int c = 0; c < 3; c++)
+        {
+            if (duties[c] != channel.written[c] || channel.shown == unknown)
+            {
+                analogWrite(channel.pins[c], duties[c]);
+                channel.written[c] = duties[c];
+            }
+        }
+        channel.shown = channel.colour;
+    }
+}
+
+
+/**
+ * @brief Switches all outputs off, to be shown by the next show().
+ */
+void Output::clear()
+{
+    for (int i = 0; i < channelCount; i++)
+    {
+        channels[i].colour = off;
+    }
+}
+
+
+/**
+ * @brief Sets one colour of the staged palette.
+ *
+ * The colour is converted to PWM duties here, so it costs nothing when shown. It is shown
+ * once swapPalette() makes the staged palette the current one.
+ *
+ * @param index Index of the colour in the palette.
+ * @param red Red level, 0 to 255.
+ * @param green Green level, 0 to 255.
+ * @param blue Blue level, 0 to 255.
+ */
+void Output::setPaletteColour(uint8_t index, uint8_t red, uint8_t green, uint8_t blue)
+{
+    stagedPalette[index][0] = toDuty(red);
+    stagedPalette[index][1] = toDuty(green);
+    stagedPalette[index][2] = toDuty(blue);
+}
+
+
+/**
+ * @brief Sets the staged palette to the default one (see defaultPalette), with every other colour off.
+ */
+void Output::resetPalette()
+{
+    const int defaultSize = sizeof(defaultPalette) / sizeof(defaultPalette[0]);
+    for (int i = 0; i < paletteSize; i++)
+    {
+        if (i < defaultSize)
+        {
+            setPaletteColour(i, pgm_read_byte(&defaultPalette[i][0]), pgm_read_byte(&defaultPalette[i][1]),
+                             pgm_read_byte(&defaultPalette[i][2]));
+        }
+        else
+        {
+            setPaletteColour(i, 0, 0, 0);
+        }
+    }
+}
+
+
+/**
+ * @brief Makes the staged palette the one shown, and keeps the old one as the staged palette.
+ *
+ * Only two pointers change. Every channel is written again by the next show().
+ */
+void Output::swapPalette()
+{
+    uint16_t(*shown)[3] = palette;
+    palette = stagedPalette;
+    stagedPalette = shown;
+    for (int i = 0; i < channelCount; i++)
+    {
+        channels[i].shown = unknown;
+    }
+}
+
+
+/**
+ * @brief Checks whether any LED is dimmed, i.e. needs a PWM waveform rather than fully on or off.
+ *
+ * PWM stops while the CPU is in light sleep, so a dimmed LED would freeze on or off.
+ *
+ * @return true if an output shows a colour with a duty between off and fully on.
+ */
+bool Output::isDimmed()
+{
+    for (int i = 0; i < channelCount; i++)
+    {
+        if (channels[i].shown == unknown)
+        {
+            continue;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            uint16_t duty = channels[i].written[c];
+            if (duty != 0 && duty != maxDuty)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Converts a colour level to a PWM duty.
+ *
+ * The eye is much more sensitive to changes in dim light than in bright light, so the level
+ * is squared (gamma 2) to make steps between levels look even. 0 stays off and 255 stays fully on.
+ *
+ * @param level Colour level, 0 to 255.
+ * @return PWM duty, 0 to maxDuty.
+ */
+uint16_t Output::toDuty(uint8_t level)
+{
+    return ((uint32_t)level * level * maxDuty + 255 * 255 / 2) / (255 * 255);
+}
@@ -0,0 +1,98 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <Arduino.h>
+
+/**
+ * @file Output.h
+ * @brief Declaration of the Output class.
+ */
+
+class Output
+{
+public:
+    Output(); // Constructor declaration
+    bool addChannel(int redPin, int greenPin, int bluePin);
+    int getChannelCount();
+    void setColour(int track, uint8_t colour);
+    void setFrame(int track, const uint16_t duties[3]);
+    const uint16_t *getDuties(uint8_t colour);
+    void show();
+    void clear();
+    void setPaletteColour(uint8_t index, uint8_t red, uint8_t green, uint8_t blue);
+    void resetPalette();
+    void swapPalette();
+    bool isDimmed();
+
+    /**
+     * @brief Number of colours in the palette, the range of a colour number.
+     */
+    static const int paletteSize = 256;
+
+private:
+    /**
+     * @brief One RGB LED, driven by PWM.
+     */
+    struct Channel {
+        uint8_t pins[3];
+        int16_t colour;       ///< palette index, off, or frame
+        int16_t shown;        ///< palette index written to the pins, off, frame, or unknown
+        uint16_t frame[3];    ///< PWM duties to show for the colour frame, see setFrame()
+        uint16_t written[3];  ///< PWM duties written to the pins
+    };
+
+    static uint16_t toDuty(uint8_t level);
+
+    /**
+     * @brief Channel colour for off: the extra row after the palette, always all zero.
+     */
+    static const int16_t off = paletteSize;
+
+    /**
+     * @brief Channel colour when what the pins show is unknown, so the next show() writes them.
+     */
+    static const int16_t unknown = -2;
+
+    /**
+     * @brief Channel colour for a frame of an effect, given as PWM duties instead of a palette index.
+     */
+    static const int16_t frame = -3;
+
+    /**
+     * @brief PWM range, for 10 bit duties.
+     */
+    static const uint16_t maxDuty = 1023;
+
+    /**
+     * @brief Two palettes, already converted to red, green and blue PWM duties (0 to maxDuty),
+     * each followed by the off row: the one shown, and the staged one that palette changes go to.
+     */
+    uint16_t palettes[2][paletteSize + 1][3];
+
+    /**
+     * @brief The palette shown, one of palettes.
+     */
+    uint16_t (*palette)[3] = palettes[0];
+
+    /**
+     * @brief The staged palette, shown after swapPalette().
+     */
+    uint16_t (*stagedPalette)[3] = palettes[1];
+
+    /**
+     * @brief Largest number of RGB outputs.
+     */
+    static const int maxChannels = 4;
+
+    /**
+     * @brief The RGB outputs, in track order.
+     */
+    Channel channels[maxChannels];
+
+    /**
+     * @brief Number of RGB outputs added with addChannel().
+     */
+    int channelCount = 0;
+};
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * @file PlaybackCheckpoint.cpp
+ * @brief Implementation of the PlaybackCheckpoint class.
+ *
+ * The playback position, saved in RTC memory each time cues are shown so playback can carry on after
+ * a reset (see Playing::resumeFromCheckpoint()). RTC memory survives a watchdog, exception or reset
+ * button restart but not a power cycle, after which it holds anything, so a checkpoint is only used
+ * if its checksum matches, it is for the timeline that was loaded, and its position and rate are
+ * ones that timeline can play at.
+ *
+ * Only read() and write() touch RTC memory. Built for the host (the native environment, with no
+ * ARDUINO), they use an array instead, which a test can keep over a simulated reset or scribble on.
+ */
+
+
+#include "PlaybackCheckpoint.h"
+#include <Arduino.h>
+#include <coredecls.h>
+#include <RtcLayout.h>
+
+#ifndef ARDUINO
+/**
+ * @brief Stands in for RTC user memory on the host.
+ */
+static uint32_t hostRtc[128];
+#endif
+
+
+/**
+ * @brief Saves a playback position to RTC memory.
+ *
+ * Writing 16 bytes to RTC memory takes a few microseconds and doesn't wear the flash.
+ *
+ * @param timelineId Id of the timeline playing.
+ * @param position Position in ms from the start of the pass.
+ * @param rate Playback rate, Q16.
+ */
+void PlaybackCheckpoint::save(uint32_t timelineId, long position, uint32_t rate)
+{
+    write(encode(timelineId, position, rate));
+}
+
+
+/**
+ * @brief Loads the playback position saved in RTC memory, if it is valid for a timeline.
+ *
+ * @param timelineId Id of the timeline loaded.
+ * @param loopLength Its loop length in ms; the position has to be within it.
+ * @param minRate Slowest rate accepted, Q16.
+ * @param maxRate Fastest rate accepted, Q16.
+ * @param position Set to the position in ms from the start of the pass.
+ * @param rate Set to the playback rate, Q16.
+ * @return true if there is a valid checkpoint for the timeline, false otherwise (position and rate are left alone).
+ */
+bool PlaybackCheckpoint::load(uint32_t timelineId, long loopLength, uint32_t minRate, uint32_t maxRate, long &position,
+                              uint32_t &rate)
+{
+    Record record;
+    return read(record) && decode(record, timelineId, loopLength, minRate, maxRate, position, rate);
+}
+
+
+/**
+ * @brief Puts a playback position in a record, with its checksum.
+ */
+PlaybackCheckpoint::Record PlaybackCheckpoint::encode(uint32_t timelineId, long position, uint32_t rate)
+{
+    Record record;
+    record.timelineId = timelineId;
+    record.position = position;
+    record.rate = rate;
+    record.crc = checksum(record);
+    return record;
+}
+
+
+/**
+ * @brief Checks a record and takes the playback position from it, see load().
+ */
+bool PlaybackCheckpoint::decode(const Record &record, uint32_t timelineId, long loopLength, uint32_t minRate,
+                                uint32_t maxRate, long &position, uint32_t &rate)
+{
+    if (record.crc != checksum(record) || record.timelineId != timelineId ||
+        record.position < 0 || record.position >= loopLength ||
+        record.rate < minRate || record.rate > maxRate)
+    {
+        return false;
+    }
+    position = record.position;
+    rate = record.rate;
+    return true;
+}
+
+
+/**
+ * @brief Returns the checksum of a record, of everything after its crc.
+ */
+uint32_t PlaybackCheckpoint::checksum(const Record &record)
+{
+    return crc32(&record.timelineId, sizeof(record) - sizeof(record.crc));
+}
+
+
+/**
+ * @brief Reads the record from RTC memory.
+ *
+ * @return true if it could be read, false otherwise.
+ */
+bool PlaybackCheckpoint::read(Record &record)
+{
+#ifdef ARDUINO
+    return ESP.rtcUserMemoryRead(RTC_PLAYBACK_BLOCK, (uint32_t *)&record, sizeof(record));
+#else
+    memcpy(&record, &hostRtc[RTC_PLAYBACK_BLOCK], sizeof(record));
+    return true;
+#endif
+}
+
+
+/**
+ * @brief Writes the record to RTC memory.
+ */
+void PlaybackCheckpoint::write(const Record &record)
+{
+#ifdef ARDUINO
+    ESP.rtcUserMemoryWrite(RTC_PLAYBACK_BLOCK, (uint32_t *)&record, sizeof(record));
+#else
+    memcpy(&hostRtc[RTC_PLAYBACK_BLOCK], &record, sizeof(record));
+#endif
+}
+
+
+#ifndef ARDUINO
+/**
+ * @brief Host builds only: returns the array standing in for RTC user memory, 128 blocks.
+ */
+uint32_t *PlaybackCheckpoint::hostMemory()
+{
+    return hostRtc;
+}
+#endif
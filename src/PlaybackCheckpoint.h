@@ -0,0 +1,40 @@
+#ifndef PLAYBACKCHECKPOINT_H
+#define PLAYBACKCHECKPOINT_H
+
+#include <Arduino.h>
+
+/**
+ * @file PlaybackCheckpoint.h
+ * @brief Declaration of the PlaybackCheckpoint class.
+ */
+
+class PlaybackCheckpoint {
+public:
+    static void save(uint32_t timelineId, long position, uint32_t rate);
+    static bool load(uint32_t timelineId, long loopLength, uint32_t minRate, uint32_t maxRate, long &position,
+                     uint32_t &rate);
+
+#ifndef ARDUINO
+    static uint32_t *hostMemory();
+#endif
+
+private:
+    /**
+     * @brief The checkpoint as kept in RTC memory, 4 blocks.
+     */
+    struct Record {
+        uint32_t crc;         ///< of the rest
+        uint32_t timelineId;  ///< see Playing's Timeline::id
+        int32_t position;     ///< in ms from the start of the pass
+        uint32_t rate;        ///< Q16, see Playing::setRate()
+    };
+
+    static Record encode(uint32_t timelineId, long position, uint32_t rate);
+    static bool decode(const Record &record, uint32_t timelineId, long loopLength, uint32_t minRate,
+                       uint32_t maxRate, long &position, uint32_t &rate);
+    static uint32_t checksum(const Record &record);
+    static bool read(Record &record);
+    static void write(const Record &record);
+};
+
+#endif
@@ -5,6 +5,10 @@
  * This class has methods to parse the Json format timelines display the colours on LED's. 
  * Runs in Loop()
  * 
+ * There are two timeline slots. A new timeline is parsed, validated and normalised into the
+ * staged slot while the active one keeps playing, and takes over at the boundary set with
+ * setSwapMode(): the switch only swaps two pointers, so there is never a half loaded timeline
+ * on the LEDs and no blackout in between.
  */
 
 
@@ -12,113 +16,919 @@
 #include <Arduino.h>
 #include <Loading.h>
 #include <secrets.h>
-#include <LittleFS.h>
+#include <coredecls.h>
+#include <PlaybackCheckpoint.h>
+#include <EmbeddedTimelineData.h>
+#include <Telemetry.h>
+#include <Metrics.h>
+#include <WallClock.h>
 
 #define led D4
-const int blueLEDPin = D5;
-const int greenLEDPin = D6;
-const int redLEDPin = D7;
 
-DynamicJsonDocument led_doc(1500);
+/**
+ * @brief JSON document for parsing timelines and palettes.
+ *
+ * ArduinoJson 7 grows it on the heap as needed (a capacity given to it is ignored), so the size of
+ * the input is checked instead (see Playing::maxTimelineSize), and it is cleared after each use to hand
+ * the heap back until the next refresh.
+ */
+JsonDocument led_doc;
+
+// Constructor definition
+Playing::Playing(Output &output) : output(output), effectCache(output)
+{
+    memset(slots, 0, sizeof(slots));
+    slots[0].embeddedIndex = slots[1].embeddedIndex = -1;
+    // String currentTimelineData = loadTimeline();
+    // Serial.print("Got timeline Data from disk: ");
+    // Serial.println(currentTimelineData);
+}
+
+
+/**
+ * @brief Processes the timeline data received from the server.
+ * 
+ * This method processes the timeline data received from the server. It deserializes the JSON data,
+ * extracts key-value pairs, and stores the LED colors and timings for each event in the timeline.
+ * A timeline is either one track, an object of "time": [colour, ...] entries, or several tracks
+ * as {"tracks": [{...}, {...}]}, each driving its own output (see Output). Colours are indexes
+ * into the palette; a timeline can bring its own as "palette": [...] (see applyPalette()), which is
+ * also cached in LittleFS for timelines without one. A timeline can also be scheduled to start at a
+ * wall-clock time, "startAt": Unix time in ms or a UTC time like "2026-10-19T20:30:00.000Z" (see startScheduled()).
+ * A cue can run an effect instead of just showing its colour, as "time": [colour, effect, period, colour2]
+ * (see parseEffect()).
+ * Events are validated and normalised on the way in (see normaliseTrack()), so the arrays
+ * used for playback are always in time order within each track. The timeline is loaded into the
+ * staged slot and takes over as set by setSwapMode() (see offerTimeline()); if it is the same as
+ * the one already playing, playback carries on from where it is.
+ * 
+ * @param timelineData The timeline data received from the server.
+ * @return true if the timeline was loaded, false if it isn't valid JSON, is too big or has no cues (the current timeline is kept).
+ */
+bool Playing::processTimelineData(const String &timelineData)
+{
+    if (timelineData.length() > maxTimelineSize)
+    {
+        Serial.print("Timeline too big, keeping current timeline: ");
+        Serial.print(timelineData.length());
+        Serial.println(" bytes");
+        return false;
+    }
+    DeserializationError error = deserializeJson(led_doc, timelineData);
+    JsonObject root = led_doc.as<JsonObject>();
+    if (error || root.isNull())
+    {
+        Serial.print("Bad timeline JSON, keeping current timeline: ");
+        Serial.println(error == DeserializationError::NoMemory ? "out of memory" : error ? error.c_str() : "not an object");
+        led_doc.clear();
+        return false;
+    }
+
+    swapPending = false; // the staged slot is about to be overwritten
+    Timeline &timeline = *staged;
+    int counts[maxTracks];
+    int newTrackCount = 0;
+    int count = 0;
+    JsonVariant startAt = root["startAt"];
+    timeline.startAt = startAt.is<const char *>() ? WallClock::parse(startAt.as<const char *>()) : startAt.as<uint64_t>();
+    if (!startAt.isNull() && timeline.startAt == 0)
+    {
+        Serial.print("bad startAt, playing straight away: ");
+        Serial.println(startAt.as<String>());
+    }
+
+    timeline.effectCount = 0;
+    JsonArray trackList = root["tracks"].as<JsonArray>();
+    if (trackList.isNull())
+    {
+        counts[newTrackCount++] = count = parseTrack(root, 0);
+    }
+    else
+    {
+        for (JsonVariant track : trackList)
+        {
+            if (newTrackCount >= maxTracks)
+            {
+                Serial.println("too many tracks, ignoring the rest");
+                break;
+            }
+            counts[newTrackCount] = parseTrack(track.as<JsonObject>(), count);
+            count += counts[newTrackCount++];
+        }
+    }
+
+    // normalise each track, packing them together at the start of the arrays
+    int from = 0;
+    int cues = 0;
+    timeline.loopLength = 0;
+    for (int t = 0; t < newTrackCount; t++)
+    {
+        timeline.tracks[t].first = cues;
+        timeline.tracks[t].count = normaliseTrack(from, counts[t], cues);
+        from += counts[t];
+        cues += timeline.tracks[t].count;
+    }
+    timeline.trackCount = newTrackCount;
+    timeline.cueCount = cues;
+    Serial.print("events: ");
+    Serial.print(count);
+    Serial.print(" -> cues: ");
+    Serial.print(timeline.cueCount);
+    Serial.print(", tracks: ");
+    Serial.println(timeline.trackCount);
+    if (timeline.cueCount == 0)
+    {
+        Serial.println("No cues in timeline, keeping current timeline");
+        led_doc.clear();
+        return false;
+    }
+
+    // only a timeline that will play changes the palette
+    JsonArray palette = root["palette"].as<JsonArray>();
+    timeline.hasPalette = !palette.isNull();
+    if (timeline.hasPalette)
+    {
+        Serial.print("palette colours: ");
+        Serial.println(applyPalette(palette));
+        String paletteData;
+        serializeJson(palette, paletteData);
+        storage.save(paletteFilePath, paletteData); // nothing is written if it is the same as the cached one
+    }
+    led_doc.clear(); // everything needed is in the staged slot now
+
+    timeline.cues = nullptr;
+    timeline.embeddedIndex = -1;
+    timeline.id = crc32(timeline.timings, timeline.cueCount * sizeof(timeline.timings[0]));
+    timeline.id = crc32(timeline.colours, timeline.cueCount * sizeof(timeline.colours[0]), timeline.id);
+    timeline.id = crc32(timeline.effects, timeline.cueCount * sizeof(timeline.effects[0]), timeline.id);
+    timeline.id = crc32(timeline.effectTable, timeline.effectCount * sizeof(timeline.effectTable[0]), timeline.id);
+    for (int t = 0; t < timeline.trackCount; t++)
+    {
+        timeline.id = crc32(&timeline.tracks[t].count, sizeof(timeline.tracks[t].count), timeline.id);
+    }
+    timeline.id = crc32(&timeline.startAt, sizeof(timeline.startAt), timeline.id); // a new start time is a new show
+
+    offerTimeline();
+    digitalWrite(led, LOW);
+    return true;
+}
+
+
+/**
+ * @brief Hands the timeline just loaded into the staged slot over to playback.
+ * 
+ * The first timeline, or one loaded while stopped, takes over straight away; otherwise it waits
+ * for the boundary set with setSwapMode(). If it is the same timeline as the one playing, only
+ * its palette (if it brought one) is taken, and playback carries on undisturbed.
+ */
+void Playing::offerTimeline()
+{
+    if (already_got_data && staged->id == active->id)
+    {
+        Serial.println("same timeline, carrying on");
+        if (staged->hasPalette)
+        {
+            output.swapPalette();
+            effectCache.clear(); // rendered from the old palette
+            output.show();
+        }
+        return;
+    }
+
+    if (!already_got_data)
+    {
+        setPosition(0);
+    }
+    if (!already_got_data || !playing || swapMode == SWAP_NOW)
+    {
+        swapTimeline();
+        return;
+    }
+
+    swapPending = true;
+    Serial.print("New timeline ready, ");
+    printSwapMode();
+}
+
+
+/**
+ * @brief Makes the staged timeline the one playing, at the current position.
+ * 
+ * The old timeline is kept in the staged slot until the next one is loaded. Each track shows its
+ * cue for the position straight away, so nothing goes dark in between; if the new timeline is
+ * shorter than the position, it starts from the beginning. A timeline with a start time is armed
+ * instead: the LEDs stay off until then (see startScheduled()).
+ * 
+ * The first timeline after a reset doesn't save a checkpoint, so the one in RTC memory is still
+ * there for resumeFromCheckpoint().
+ */
+void Playing::swapTimeline()
+{
+    bool firstTimeline = !already_got_data;
+    currentMillis2 = getPosition();
+    Timeline *previous = active;
+    active = staged;
+    staged = previous;
+    swapPending = false;
+    already_got_data = true;
+    if (active->hasPalette)
+    {
+        output.swapPalette();
+        effectCache.clear(); // rendered from the old palette
+    }
+
+    armedStart = active->startAt;
+    if (armedStart != 0)
+    {
+        output.clear();
+        output.show();
+        Serial.print("Armed to start at ");
+        WallClock::print(armedStart);
+        Serial.println(wallClock.isSynced() ? " UTC" : " UTC, once the clock is synced");
+        return;
+    }
+
+    if (currentMillis2 < 0 || currentMillis2 >= active->loopLength)
+    {
+        setPosition(0);
+    }
+    seek(currentMillis2);
+    if (!firstTimeline)
+    {
+        saveCheckpoint();
+    }
+    Serial.print("Swapped timeline at ");
+    Serial.print(currentMillis2);
+    Serial.println(" ms");
+}
+
+
+/**
+ * @brief Reads the events of one track into the staged timeline's timings[] and colours[].
+ * 
+ * Bad events are skipped. Events beyond maxEvents (counting all tracks) are ignored.
+ * 
+ * @param track The track, an object of "time": [colour, ...] entries.
+ * @param first Index in timings[] and colours[] to store the first event at.
+ * @return Number of events stored.
+ */
+int Playing::parseTrack(JsonObject track, int first)
+{
+    int count = first;
+    for (JsonPair kv : track)
+    {
+        const char *key = kv.key().c_str();
+        if (strcmp(key, "") == 0)
+        {
+            Serial.println("end");
+            continue;
+        }
+        if (strcmp(key, "palette") == 0 || strcmp(key, "startAt") == 0)
+        {
+            continue;
+        }
+
+        char *keyEnd;
+        long time = strtol(key, &keyEnd, 10);
+        int colour = kv.value()[0].as<int>();
+        if (*keyEnd != '\0' || time < 0 || time > maxEventTime)
+        {
+            Serial.print("skipping bad time: ");
+            Serial.println(key);
+            continue;
+        }
+        if (colour < 0 || colour > 255)
+        {
+            Serial.print("skipping bad colour at ");
+            Serial.print(key);
+            Serial.print(": ");
+            Serial.println(colour);
+            continue;
+        }
+        if (count >= maxEvents)
+        {
+            Serial.print("timeline too long, ignoring events from ");
+            Serial.println(key);
+            break;
+        }
+
+        staged->timings[count] = time;
+        staged->colours[count] = colour;
+        staged->effects[count] = parseEffect(kv.value(), colour);
+        count++;
+    }
+    return count - first;
+}
+
+
+/**
+ * @brief Reads the effect of an event into the staged timeline's effect table.
+ * 
+ * An event is [colour, effect, period, colour2]: effect is an EffectCache::Type (0 or left out for
+ * just the colour), period its length in ms, and colour2 the colour it fades or strobes to (off if
+ * left out). Cues with the same effect share one entry of the table.
+ * 
+ * @param event The event.
+ * @param colour Its colour.
+ * @return 1 + the index of the effect in effectTable, or 0 for just the colour (also for a bad effect, or a full table).
+ */
+uint8_t Playing::parseEffect(JsonVariant event, int colour)
+{
+    int type = event[1] | 0;
+    if (type == EffectCache::SOLID)
+    {
+        return 0;
+    }
+    long period = event[2] | 0L;
+    int colour2 = event[3] | (int)EffectCache::off;
+    if (type < 0 || type >= EffectCache::TYPE_COUNT || period < EffectCache::minPeriod || period > 65535 ||
+        colour2 < EffectCache::off || colour2 > 255)
+    {
+        Serial.print("bad effect, showing just the colour: ");
+        Serial.println(event.as<String>());
+        return 0;
+    }
+
+    EffectCache::Effect effect = {(uint8_t)type, (uint8_t)colour, (int16_t)colour2, (uint16_t)period};
+    for (int i = 0; i < staged->effectCount; i++)
+    {
+        EffectCache::Effect &known = staged->effectTable[i];
+        if (known.type == effect.type && known.colour == effect.colour && known.colour2 == effect.colour2 &&
+            known.period == effect.period)
+        {
+            return i + 1;
+        }
+    }
+    if (staged->effectCount >= maxEffects)
+    {
+        Serial.println("too many effects, showing just the colour");
+        return 0;
+    }
+    staged->effectTable[staged->effectCount++] = effect;
+    return staged->effectCount;
+}
+
+
+/**
+ * @brief Sets the staged palette from a timeline, to be shown with it (see Output::swapPalette()).
+ * 
+ * Each entry is a colour as "#rrggbb" or [red, green, blue], for colour numbers 0, 1, 2 and on.
+ * Colours the palette doesn't cover are the default ones (see Output::resetPalette()).
+ * 
+ * @param palette The palette, up to Output::paletteSize entries.
+ * @return Number of colours set.
+ */
+int Playing::applyPalette(JsonArray palette)
+{
+    output.resetPalette();
+    int index = 0;
+    for (JsonVariant entry : palette)
+    {
+        if (index >= Output::paletteSize)
+        {
+            break;
+        }
+
+        uint32_t rgb = 0;
+        if (entry.is<const char *>())
+        {
+            const char *text = entry.as<const char *>();
+            rgb = strtoul(text[0] == '#' ? text + 1 : text, nullptr, 16);
+        }
+        else
+        {
+            rgb = (entry[0].as<uint32_t>() & 0xff) << 16 | (entry[1].as<uint32_t>() & 0xff) << 8 | (entry[2].as<uint32_t>() & 0xff);
+        }
+        output.setPaletteColour(index, rgb >> 16, rgb >> 8, rgb);
+        index++;
+    }
+    return index;
+}
+
+
+/**
+ * @brief Sets the palette cached in LittleFS by the last timeline that brought one, if any.
+ */
+void Playing::loadCachedPalette()
+{
+    String paletteData = storage.load(paletteFilePath);
+    if (paletteData.isEmpty() || deserializeJson(led_doc, paletteData) || !led_doc.is<JsonArray>())
+    {
+        led_doc.clear();
+        return;
+    }
+    Serial.print("Cached palette colours: ");
+    Serial.println(applyPalette(led_doc.as<JsonArray>()));
+    led_doc.clear();
+    output.swapPalette(); // nothing is playing yet
+}
+
+
+/**
+ * @brief Resumes playback from the checkpoint in RTC memory.
+ * 
+ * RTC memory survives a watchdog, exception or reset button restart but not a power cycle,
+ * so a valid checkpoint for the loaded timeline means the device was reset mid-show.
+ * Playback continues from the position of the last cue shown, at the same rate, with each track
+ * showing its cue for that position.
+ * 
+ * A timeline armed to start at a wall-clock time isn't resumed: startScheduled() works out its
+ * position from the clock instead.
+ * 
+ * @return true if playback was resumed, false if there was no matching checkpoint.
+ */
+bool Playing::resumeFromCheckpoint()
+{
+    long position;
+    if (active->cueCount == 0 || armedStart != 0 ||
+        !PlaybackCheckpoint::load(active->id, active->loopLength, minRate, maxRate, position, rate))
+    {
+        return false;
+    }
+
+    setPosition(position);
+    seek(position);
+    Serial.print("Resuming after reset at ");
+    Serial.print(position);
+    Serial.println(" ms");
+    return true;
+}
+
+
+/**
+ * @brief Saves the current position to RTC memory, see PlaybackCheckpoint.
+ * 
+ * Called each time cues are shown.
+ */
+void Playing::saveCheckpoint()
+{
+    PlaybackCheckpoint::save(active->id, currentMillis2, rate);
+}
+
+
+/**
+ * @brief Normalises one track of the staged timeline's arrays.
+ * 
+ * Sorts the events by time (stable, so for duplicate times the last one in the file wins),
+ * drops duplicate times, and merges consecutive events with the same colour into one cue, unless
+ * they have effects (a cue with an effect starts it again).
+ * The cues are written from index to, which is never after from, so tracks can be packed
+ * together as they are normalised. Also makes sure the timeline's loopLength covers the track.
+ * 
+ * @param from Index of the track's first event in timings[] and colours[].
+ * @param count Number of valid events in the track.
+ * @param to Index to write the track's first cue to.
+ * @return Number of cues left after normalising.
+ */
+int Playing::normaliseTrack(int from, int count, int to)
+{
+    long *timings = staged->timings;
+    uint8_t *colours = staged->colours;
+    uint8_t *effects = staged->effects;
+    long *trackTimings = timings + from;
+    uint8_t *trackColours = colours + from;
+    uint8_t *trackEffects = effects + from;
+
+    // insertion sort - timelines are short and usually already in order
+    for (int i = 1; i < count; i++)
+    {
+        long time = trackTimings[i];
+        uint8_t colour = trackColours[i];
+        uint8_t effect = trackEffects[i];
+        int j = i - 1;
+        while (j >= 0 && trackTimings[j] > time)
+        {
+            trackTimings[j + 1] = trackTimings[j];
+            trackColours[j + 1] = trackColours[j];
+            trackEffects[j + 1] = trackEffects[j];
+            j--;
+        }
+        trackTimings[j + 1] = time;
+        trackColours[j + 1] = colour;
+        trackEffects[j + 1] = effect;
+    }
+
+    int out = to;
+    for (int i = from; i < from + count; i++)
+    {
+        if (out > to && timings[out - 1] == timings[i])
+        {
+            colours[out - 1] = colours[i]; // duplicate time: last one wins
+            effects[out - 1] = effects[i];
+            if (out > to + 1 && colours[out - 2] == colours[out - 1] && effects[out - 2] == 0 && effects[out - 1] == 0)
+            {
+                out--; // now the same as the cue before it
+            }
+            continue;
+        }
+        if (out > to && colours[out - 1] == colours[i] && effects[out - 1] == 0 && effects[i] == 0)
+        {
+            continue; // same colour is still showing
+        }
+        timings[out] = timings[i];
+        colours[out] = colours[i];
+        effects[out] = effects[i];
+        out++;
+    }
+
+    // hold the last cue as long as the gap before it, so it is actually seen before looping
+    long trackLength = 0;
+    if (out - to > 1)
+    {
+        trackLength = timings[out - 1] + (timings[out - 1] - timings[out - 2]);
+    }
+    else if (out - to == 1)
+    {
+        trackLength = timings[to] + defaultCueHold;
+    }
+    if (trackLength > staged->loopLength)
+    {
+        staged->loopLength = trackLength;
+    }
+
+    return out - to;
+}
+
+/**
+ * @brief Starts playing a timeline built into the firmware.
+ * 
+ * Embedded timelines come from the .json files in timelines/, validated and normalised at build time
+ * (see tools/embed_timelines.py). They are played straight from flash: no network,
+ * file system or JSON parsing is involved. Choosing one is a deliberate switch, so it takes over
+ * straight away from the beginning whatever the swap mode.
+ * 
+ * @param index Index of the embedded timeline, in file name order.
+ * @return true if the timeline exists, false otherwise.
+ */
+bool Playing::setupEmbedded(int index)
+{
+#if EMBEDDED_TIMELINE_COUNT > 0
+    if (index < 0 || index >= EMBEDDED_TIMELINE_COUNT)
+    {
+        Serial.print("No embedded timeline ");
+        Serial.println(index);
+        return false;
+    }
+
+    EmbeddedTimeline timeline;
+    memcpy_P(&timeline, &embeddedTimelines[index], sizeof(timeline));
+    staged->cues = timeline.cues;
+    staged->embeddedIndex = index;
+    staged->cueCount = timeline.count;
+    staged->loopLength = timeline.loopLength;
+    staged->id = timeline.id;
+    staged->hasPalette = timeline.paletteSize > 0;
+    staged->startAt = 0;
+    staged->effectCount = 0; // embedded cues are just colours
+    if (staged->hasPalette)
+    {
+        output.resetPalette();
+        for (uint32_t i = 0; i < timeline.paletteSize; i++)
+        {
+            output.setPaletteColour(i, pgm_read_byte(&timeline.palette[i][0]), pgm_read_byte(&timeline.palette[i][1]),
+                                    pgm_read_byte(&timeline.palette[i][2]));
+        }
+    }
+    staged->trackCount = min((int)timeline.trackCount, maxTracks);
+    int first = 0;
+    for (int t = 0; t < staged->trackCount; t++)
+    {
+        staged->tracks[t].first = first;
+        staged->tracks[t].count = pgm_read_dword(&timeline.trackCues[t]);
+        first += staged->tracks[t].count;
+    }
+    Serial.print("Playing embedded timeline ");
+    Serial.print(index);
+    Serial.print(", cues: ");
+    Serial.print(staged->cueCount);
+    Serial.print(", tracks: ");
+    Serial.println(staged->trackCount);
+
+    setPosition(0);
+    swapTimeline();
+    resumeFromCheckpoint();
+    return true;
+#else
+    Serial.println("No embedded timelines in this build");
+    return false;
+#endif
+}
+
+
+/**
+ * @brief Switches to the next timeline.
+ * 
+ * Goes through the downloaded timeline saved in LittleFS and then each embedded timeline in turn,
+ * starting each one from the beginning.
+ * 
+ * @return true if another timeline was started, false if there is no other timeline.
+ */
+bool Playing::nextTimeline()
+{
+#if EMBEDDED_TIMELINE_COUNT > 0
+    int next = active->embeddedIndex + 1;
+    if (next < EMBEDDED_TIMELINE_COUNT)
+    {
+        return setupEmbedded(next);
+    }
+    if (!loadTimeline().isEmpty())
+    {
+        if (swapPending)
+        {
+            swapTimeline();
+        }
+        restart();
+        return true;
+    }
+    return active->embeddedIndex != 0 && setupEmbedded(0); // no downloaded timeline, back to the first embedded one
+#else
+    Serial.println("No other timelines in this build");
+    return false;
+#endif
+}
+
+
+/**
+ * @brief Starts playing the timeline from the beginning, straight away even if it is armed to start later.
+ */
+void Playing::start()
+{
+    playing = true;
+    armedStart = 0;
+    restart();
+    Serial.println("Started");
+}
+
+
+/**
+ * @brief Stops playing and switches the LEDs off.
+ */
+void Playing::stop()
+{
+    playing = false;
+    output.clear();
+    output.show();
+    Serial.println("Stopped");
+}
+
+
+/**
+ * @brief Checks whether the timeline is playing.
+ * 
+ * @return true if playing, false if stopped.
+ */
+bool Playing::isPlaying()
+{
+    return playing;
+}
+
+
+/**
+ * @brief Jumps back to the beginning of the timeline now.
+ * 
+ * Used to line the timeline up with the music again.
+ */
+void Playing::restart()
+{
+    setPosition(0);
+    stopEffects();
+    startPass();
+}
+
+
+/**
+ * @brief Sets when a newly loaded timeline takes over from the one playing.
+ * 
+ * Swapping at a cue time lets an edited show take over mid-run at a point where the change
+ * doesn't show, e.g. the start of a section. If the current pass is already past that time,
+ * the swap waits for the next pass to get there.
+ * 
+ * @param mode When to swap.
+ * @param position For SWAP_AT_CUE, the position in ms in the current timeline to swap at.
+ */
+void Playing::setSwapMode(SwapMode mode, long position)
+{
+    swapMode = mode;
+    swapPosition = position;
+    if (swapPending && swapMode == SWAP_NOW)
+    {
+        swapTimeline();
+    }
+    printSwapMode();
+}
+
+
+/**
+ * @brief Prints when a newly loaded timeline takes over.
+ */
+void Playing::printSwapMode()
+{
+    Serial.print(swapPending ? "swapping " : "new timelines swap ");
+    switch (swapMode)
+    {
+    case SWAP_NOW:
+        Serial.println("straight away");
+        break;
+    case SWAP_AT_LOOP_END:
+        Serial.println("at the end of the loop");
+        break;
+    case SWAP_AT_CUE:
+        Serial.print("at ");
+        Serial.print(swapPosition);
+        Serial.println(" ms");
+        break;
+    }
+}
+
+
+/**
+ * @brief Checks whether a newly loaded timeline is waiting to take over.
+ * 
+ * @return true if a timeline is staged and waiting for its swap.
+ */
+bool Playing::isSwapPending()
+{
+    return swapPending;
+}
+
+
+/**
+ * @brief Returns the current position in the timeline.
+ * 
+ * @return Position in milliseconds from the start of the current pass, at the current rate.
+ */
+long Playing::getPosition()
+{
+    return (rebasePosition + (int64_t)(millis() - rebaseTime) * rate) >> 16;
+}
 
-// Constructor definition
-Playing::Playing()
+
+/**
+ * @brief Sets the position in the timeline, from now.
+ * 
+ * @param position Position in milliseconds from the start of the timeline.
+ */
+void Playing::setPosition(long position)
 {
-    // String currentTimelineData = loadTimeline();
-    // Serial.print("Got timeline Data from disk: ");
-    // Serial.println(currentTimelineData);
+    currentMillis2 = position;
+    rebaseTime = millis();
+    rebasePosition = (int64_t)position << 16;
 }
 
 
 /**
- * @brief Processes the timeline data received from the server.
+ * @brief Changes the playback rate, e.g. to follow a musician playing faster or slower.
  * 
- * This method processes the timeline data received from the server. It deserializes the JSON data,
- * extracts key-value pairs, and stores the LED colors and timings for each event in the timeline.
+ * The timeline carries on from where it is now: the position up to now is banked at the old
+ * rate, exactly (the fraction of a millisecond is kept), and only what follows plays at the
+ * new rate, so there is no jump and no drift however many times the rate changes.
  * 
- * @param timelineData The timeline data received from the server.
+ * @param newRate The rate in Q16 fixed point (rateOne is the recorded speed), limited to minRate..maxRate.
+ */
+void Playing::setRate(uint32_t newRate)
+{
+    newRate = constrain(newRate, minRate, maxRate);
+    unsigned long now = millis();
+    rebasePosition += (int64_t)(now - rebaseTime) * rate;
+    rebaseTime = now;
+    rate = newRate;
+    Serial.print("Rate: ");
+    Serial.print(rate * 100.0 / rateOne, 1);
+    Serial.println("%");
+}
+
+
+/**
+ * @brief Returns the playback rate.
+ * 
+ * @return The rate in Q16 fixed point, rateOne is the recorded speed.
+ */
+uint32_t Playing::getRate()
+{
+    return rate;
+}
+
+
+/**
+ * @brief Returns the time of a cue, from RAM or from an embedded timeline in flash.
+ * 
+ * @param index Index of the cue.
+ * @return Time of the cue in milliseconds from the start of the timeline.
+ */
+long Playing::cueTime(int index)
+{
+    if (active->cues)
+    {
+        return pgm_read_dword(&active->cues[index].time);
+    }
+    return active->timings[index];
+}
+
+
+/**
+ * @brief Returns the colour of a cue, from RAM or from an embedded timeline in flash.
+ * 
+ * @param index Index of the cue.
+ * @return Colour of the cue.
  */
-void Playing::processTimelineData(const String &timelineData)
+uint8_t Playing::cueColour(int index)
 {
-    // Serial.println("processTimelineData");
-    // DynamicJsonDocument led_doc(1500);
-    deserializeJson(led_doc, timelineData);
-    root = led_doc.as<JsonObject>();
+    if (active->cues)
+    {
+        return pgm_read_byte(&active->cues[index].colour);
+    }
+    return active->colours[index];
+}
 
-    iter = 0;
-    for (JsonPair kv : root)
+
+/**
+ * @brief Returns the effect of a cue. Embedded timelines have none.
+ * 
+ * @param index Index of the cue.
+ * @return 1 + the index of the effect in the active timeline's effectTable, or 0 for just the colour.
+ */
+uint8_t Playing::cueEffect(int index)
+{
+    if (active->cues)
     {
-        // String key = kv.key().c_str();
-        // JsonObject subDict = kv.value().as<JsonObject>();
-        // iter = 0;
-        // // Process the sub-dictionary
-        // for (JsonPair subKv : subDict) {
-        Serial.print("got ");
-        Serial.println(kv.key().c_str());
-        timeline_keys[iter] = kv.key().c_str(); // should be the last one here..
-        iter++;
-        // }
+        return 0;
     }
-    Serial.print("iter: ");
-    Serial.print(iter);
+    return active->effects[index];
+}
 
-    maxTimingsNum = iter;
 
-    for (int i = 0; i < iter; i++)
+/**
+ * @brief Starts the effect of a cue on its track's output, or ends the one running there if it has none.
+ * 
+ * The frames are timed from the cue's time in the timeline, not from when it was shown, so poi
+ * playing the same timeline stay in step. The first frame is shown by the next showFrames(). The
+ * cue ends the effects of other tracks layered onto the same output, as the most recent cue wins.
+ * 
+ * @param track Index of the track.
+ * @param index Index of the cue.
+ */
+void Playing::startEffect(int track, int index)
+{
+    int lastChannel = max(output.getChannelCount() - 1, 0);
+    for (int t = lastChannel; t < active->trackCount; t++)
     {
-        if (strcmp(timeline_keys[i], "") == 0)
+        if (t != track && track >= lastChannel)
         {
-            Serial.println("end");
+            active->tracks[t].effect = 0;
+        }
+    }
+    Track &t = active->tracks[track];
+    t.effect = cueEffect(index);
+    t.effectStart = t.nextFrame = cueTime(index);
+}
+
+
+/**
+ * @brief Sets the frames of the effects that are due, to be shown by the next Output::show().
+ * 
+ * The frames come from the effect cache, so this costs the same whatever the effects are. A fade
+ * that has ended holds its last frame and needs no more.
+ * 
+ * @return true if a frame was set, false otherwise.
+ */
+bool Playing::showFrames()
+{
+    bool shown = false;
+    for (int t = 0; t < active->trackCount; t++)
+    {
+        Track &track = active->tracks[t];
+        if (track.effect == 0 || currentMillis2 < track.nextFrame)
+        {
+            continue;
+        }
+        const EffectCache::Effect &effect = active->effectTable[track.effect - 1];
+        long elapsed = currentMillis2 - track.effectStart;
+        output.setFrame(t, effectCache.frame(effect, elapsed));
+        shown = true;
+
+        long next = effectCache.nextFrame(effect, elapsed);
+        if (next < 0)
+        {
+            track.effect = 0;
         }
         else
         {
-            redVal = led_doc[timeline_keys[i]][0];
-            greenVal = led_doc[timeline_keys[i]][1];
-            blueVal = led_doc[timeline_keys[i]][2];
-
-            redInt = redVal.as<int>();
-            // initialise arrays for timings:
-            colours[i] = redInt;
-            timings[i] = atol(timeline_keys[i]);
-
-            // if (redInt == 13) {
-            //   Serial.println("LUCKY 13!!!");
-            // }
-            greenInt = greenVal.as<int>();
-            blueInt = blueVal.as<int>();
-            Serial.print("got colours for ");
-            Serial.print(timeline_keys[i]);
-            Serial.print(": ");
-            Serial.print(redInt);
-            Serial.print(", ");
-            Serial.print(greenInt);
-            Serial.print(", ");
-            Serial.println(blueInt);
+            track.nextFrame = track.effectStart + next;
         }
     }
-    // todo: errors from here?
+    return shown;
+}
 
-    // // Print the colours array
-    // Serial.print("Colours from disk: ");
-    // for (int i = 0; i < iter; i++)
-    // {
-    //     Serial.print(colours[i]);
-    //     Serial.print(" ");
-    // }
-    // Serial.println(); // Print a new line after the array
-    // // Print the timeline array
-    // Serial.print("Timings from disk: ");
-    // for (int i = 0; i < iter; i++)
-    // {
-    //     Serial.print(timings[i]);
-    //     Serial.print(" ");
-    // }
-    // Serial.println(); // Print a new line after the array
-    already_got_data = true;
-    digitalWrite(led, LOW);
 
-    // todo: test:
-    playStartTime = millis();
+/**
+ * @brief Ends the effects running on every track, leaving their last frames showing.
+ */
+void Playing::stopEffects()
+{
+    for (int t = 0; t < active->trackCount; t++)
+    {
+        active->tracks[t].effect = 0;
+    }
 }
 
 /**
@@ -128,9 +938,9 @@ void Playing::processTimelineData(const String &timelineData)
  * 
  * @return Pointer to the array of LED colors.
  */
-int *Playing::getColours()
+uint8_t *Playing::getColours()
 {
-    return colours;
+    return active->colours;
 }
 
 /**
@@ -142,52 +952,128 @@ int *Playing::getColours()
  */
 long *Playing::getTimings()
 {
-    return timings;
+    return active->timings;
 }
 
 /**
  * @brief Returns the maximum number of timings in the timeline.
  * 
- * This method returns the maximum number of timings available in the timeline data.
+ * This method returns the maximum number of timings available in the timeline data,
+ * of the timeline loaded last (the staged one while it waits to take over).
  * 
  * @return Maximum number of timings in the timeline.
  */
 int Playing::getMaxTimingsNum()
 {
-    return maxTimingsNum;
+    return swapPending ? staged->cueCount : active->cueCount;
+}
+
+/**
+ * @brief Returns the path of the timeline file in LittleFS.
+ * 
+ * @return Path of the file the timeline is loaded from.
+ */
+const String &Playing::getTimelineFilePath()
+{
+    return timelineFilePath;
+}
+
+/**
+ * @brief Returns the time until the next cue.
+ * 
+ * The next cue is the earliest one of any track, or the next frame of an effect if that comes first.
+ * At the end of the timeline this is the time until it loops back to the first cue.
+ * 
+ * While the timeline is armed, the next cue is its start.
+ * 
+ * @return Milliseconds until the next cue is due (0 if it is already due), or -1 if there is no timeline,
+ *         playing is stopped, or it is armed and the clock isn't synced yet.
+ */
+long Playing::msUntilNextCue()
+{
+    if (active->cueCount == 0 || !playing)
+    {
+        return -1;
+    }
+    if (armedStart != 0)
+    {
+        return wallClock.isSynced() ? max(wallClock.msUntil(armedStart), 0L) : -1;
+    }
+    int64_t position = rebasePosition + (int64_t)(millis() - rebaseTime) * rate;
+    long nextTime = scheduler.isEmpty() ? active->loopLength : scheduler.nextTime();
+    if (swapPending && swapMode == SWAP_AT_CUE && swapPosition > currentMillis2 && swapPosition < nextTime)
+    {
+        nextTime = swapPosition;
+    }
+    for (int t = 0; t < active->trackCount; t++)
+    {
+        if (active->tracks[t].effect != 0 && active->tracks[t].nextFrame < nextTime)
+        {
+            nextTime = active->tracks[t].nextFrame;
+        }
+    }
+    int64_t next = (int64_t)nextTime << 16;
+    return next > position ? (long)((next - position + rate - 1) / rate) : 0; // real ms, rounded up
+}
+
+/**
+ * @brief Returns when the timeline is armed to start.
+ * 
+ * @return Unix time in ms, or 0 if it isn't waiting to start.
+ */
+uint64_t Playing::getScheduledStart()
+{
+    return armedStart;
+}
+
+/**
+ * @brief Prints cue timing accuracy since the last report and resets it.
+ * 
+ * Lateness is how long after its scheduled time a cue was actually shown.
+ */
+void Playing::reportCueTiming()
+{
+    Serial.print("cues: ");
+    Serial.print(cuesFired);
+    if (cuesFired > 0)
+    {
+        Serial.print(", lateness avg ");
+        Serial.print(totalLateness / (long)cuesFired);
+        Serial.print(" ms, max ");
+        Serial.print(maxLateness);
+        Serial.print(" ms");
+    }
+    Serial.println();
+    cuesFired = 0;
+    totalLateness = 0;
+    maxLateness = 0;
 }
 
 /**
  * @brief Loads the timeline data from the disk.
  * 
  * This method loads the timeline data from the disk using the LittleFS (Little File System).
- * If LittleFS initialization succeeds and the file exists, the method reads the data from the file,
- * processes it using the processTimelineData() method, and returns the timeline data as a string.
- * If the file doesn't exist or if there's any failure during the file system operation, an empty string
- * is returned.
+ * If the file exists and passes its CRC check, the method processes it using the
+ * processTimelineData() method and returns the timeline data as a string. If the file doesn't
+ * exist, is truncated, corrupt or not a valid timeline, an empty string is returned and the current
+ * timeline is kept.
  * 
  * @return A string containing the loaded timeline data, or an empty string if the data couldn't be loaded.
  */
 String Playing::loadTimeline() // load from disk
 {
-    Serial.print("Loading Timeline from LittleFS ");
+    Serial.print("Loading Timeline ");
     Serial.println(timelineFilePath);
-    String timelineData = "";
-    if (LittleFS.begin())
+    String timelineData = timelineStore.load(timelineFilePath);
+    if (!timelineData.isEmpty())
     {
-        if (LittleFS.exists(timelineFilePath))
+        Serial.print("Timeline data: ");
+        Serial.print(timelineData.length());
+        Serial.println(" bytes"); // not the data itself, which takes up to a second to print
+        if (!processTimelineData(timelineData)) // Process the timeline data
         {
-            File file = LittleFS.open(timelineFilePath, "r");
-            if (file)
-            {
-                timelineData = file.readString();
-                file.close();
-                Serial.println("Timeline data:");
-                Serial.println(timelineData);
-                processTimelineData(timelineData); // Process the timeline data. Todo: error here?
-            }
+            timelineData = "";
         }
-        LittleFS.end();
     }
     return timelineData;
 }
@@ -197,9 +1083,10 @@ String Playing::loadTimeline() // load from disk
  * @brief Sets up the playing process.
  * 
  * This method sets up the playing process by initializing necessary components,
- * loading timeline data from the disk, and processing it.
+ * loading timeline data from the disk, and processing it. On the first load after a reset
+ * it sets the cached palette first, and resumes from the RTC memory checkpoint if there is one for this timeline.
  * 
- * @return true if setup is successful, false otherwise.
+ * @return true if a timeline was loaded, false otherwise.
  */
 bool Playing::setup()
 {
@@ -207,189 +1094,312 @@ bool Playing::setup()
     // Simulate playing process
     Serial.println("Playing...");
     // Main function of the app here
-    String currentTimelineData = loadTimeline();
-    Serial.print("Got timeline Data from disk: ");
-    Serial.println(currentTimelineData);
-    processTimelineData(currentTimelineData);
+    bool firstLoad = !already_got_data;
+    if (firstLoad)
+    {
+        loadCachedPalette();
+    }
+    String currentTimelineData = loadTimeline(); // also processes it
+    if (currentTimelineData.isEmpty())
+    {
+        return false;
+    }
+    if (firstLoad)
+    {
+        resumeFromCheckpoint();
+    }
+    return true;
+}
+
+
+/**
+ * @brief Sets up the playing process with a timeline that was just fetched, instead of the saved one.
+ *
+ * Like setup(), but nothing is read from or written to the file system, so a fetched timeline can be
+ * checked before it replaces the saved one: save it only if this returns true.
+ *
+ * @param timelineData The timeline data, e.g. from the server or the sync leader.
+ * @return true if the timeline was loaded, false otherwise (the current timeline is kept).
+ */
+bool Playing::setup(const String &timelineData)
+{
+    digitalWrite(led, HIGH);
+    Serial.println("Playing...");
+    bool firstLoad = !already_got_data;
+    if (firstLoad)
+    {
+        loadCachedPalette();
+    }
+    if (!processTimelineData(timelineData))
+    {
+        return false;
+    }
+    if (firstLoad)
+    {
+        resumeFromCheckpoint();
+    }
     return true;
 }
 
 
 /**
- * @brief Changes the colors of the RGB LED based on the provided choice.
+ * @brief Changes the colour of a track's RGB LED.
  * 
- * This method changes the colors of the RGB LED based on the provided choice.
+ * The colour is shown by the next Output::show(), together with any other cues due at the same time.
  * 
- * @param choice An integer representing the color choice:
- *               - 0: Red
- *               - 1: Green
- *               - 2: Blue
- *               - 3: Cyan
- *               - 4: Magenta
- *               - 5: Yellow
- *               - 6: White
- *               - Any other value: Default (turn off the LED)
+ * @param track Index of the track.
+ * @param choice The colour number, an index into the palette.
  */
-void Playing::changeColours(int choice)
+void Playing::changeColours(int track, uint8_t choice)
 {
-    switch (choice)
+    output.setColour(track, choice);
+    if (!telemetry.isEnabled())
     {
-    case 0: // red
-        analogWrite(redLEDPin, 255);
-        analogWrite(greenLEDPin, 0);
-        analogWrite(blueLEDPin, 0);
-        Serial.println("RED");
-        break;
-    case 1: // green
-        analogWrite(redLEDPin, 0);
-        analogWrite(greenLEDPin, 255);
-        analogWrite(blueLEDPin, 0);
-        Serial.println("GREEN");
-        break;
-    case 2: // blue
-        analogWrite(redLEDPin, 0);
-        analogWrite(greenLEDPin, 0);
-        analogWrite(blueLEDPin, 255);
-        Serial.println("BLUE");
-        break;
-    case 3: // cyan
-        analogWrite(redLEDPin, 0);
-        analogWrite(greenLEDPin, 255);
-        analogWrite(blueLEDPin, 255);
-        Serial.println("CYAN");
-        break;
-    case 4: // magenta
-        analogWrite(redLEDPin, 255);
-        analogWrite(greenLEDPin, 0);
-        analogWrite(blueLEDPin, 255);
-        Serial.println("MAGENTA");
-        break;
-    case 5: // yellow
-        analogWrite(redLEDPin, 255);
-        analogWrite(greenLEDPin, 255);
-        analogWrite(blueLEDPin, 0);
-        Serial.println("YELLOW");
-        break;
-    case 6: // white
-        analogWrite(redLEDPin, 255);
-        analogWrite(greenLEDPin, 255);
-        analogWrite(blueLEDPin, 255);
-        Serial.println("WHITE");
-        break;
-    default:
-    //todo: add more colours - default is shown for all strobe effects currently
-        analogWrite(redLEDPin, 0);
-        analogWrite(greenLEDPin, 0);
-        analogWrite(blueLEDPin, 0);
-        Serial.println("DEFAULT");
-        break;
+        Serial.print("colour ");
+        Serial.println(choice);
+    }
+}
+
+
+/**
+ * @brief Starts a pass of the timeline from the first cue of each track.
+ */
+void Playing::startPass()
+{
+    scheduler.clear();
+    for (int t = 0; t < active->trackCount; t++)
+    {
+        Track &track = active->tracks[t];
+        track.next = 0;
+        if (track.count > 0)
+        {
+            scheduler.push(t, cueTime(track.first));
+        }
+    }
+}
+
+
+/**
+ * @brief Jumps to a position in the current pass of the timeline.
+ * 
+ * Each track shows its cue for that position straight away, with the frame of its effect for the
+ * position if it has one, and the scheduler is set up with the cues after it.
+ * 
+ * @param position Position in milliseconds from the start of the timeline.
+ */
+void Playing::seek(long position)
+{
+    scheduler.clear();
+    for (int t = 0; t < active->trackCount; t++)
+    {
+        Track &track = active->tracks[t];
+        track.next = 0;
+        while (track.next < track.count && cueTime(track.first + track.next) <= position)
+        {
+            track.next++;
+        }
+        track.effect = 0;
+        if (track.next > 0)
+        {
+            changeColours(t, cueColour(track.first + track.next - 1));
+            startEffect(t, track.first + track.next - 1);
+        }
+        if (track.next < track.count)
+        {
+            scheduler.push(t, cueTime(track.first + track.next));
+        }
     }
+    showFrames();
+    output.show();
 }
 
 
+/**
+ * @brief Shows a cue that is due, and records how late it is.
+ * 
+ * @param track Index of the track the cue belongs to.
+ * @param index Index of the cue in timings[] and colours[] (or the embedded cues).
+ */
+void Playing::fireCue(int track, int index)
+{
+    // measure how late the cue is, for checking timing accuracy
+    long lateness = currentMillis2 - cueTime(index);
+    if (lateness > maxLateness)
+    {
+        maxLateness = lateness;
+    }
+    totalLateness += lateness;
+    cuesFired++;
+
+    telemetry.cueFired(index, cueColour(index), lateness);
+    metrics.cueFired(lateness);
+    if (!telemetry.isEnabled())
+    {
+        if (active->trackCount > 1)
+        {
+            Serial.print("track ");
+            Serial.print(track);
+            Serial.print(" ");
+        }
+        Serial.print(cueTime(index));
+        Serial.print(": ");
+    }
+    // Change the colors based on the cue
+    changeColours(track, cueColour(index));
+    startEffect(track, index);
+}
 
 
 /**
  * @brief Uses the timeline data to change LED colors over time.
  * 
- * This method uses the timeline data to change LED colors over time. It checks if it's time
- * to change colors based on the timings in the timeline data. If it's time, it changes the colors
- * according to the current index in the timeline data and moves to the next index. If the end of the
- * timeline data is reached, it loops back to the beginning.
+ * This method uses the timeline data to change LED colors over time. Timings are offsets from
+ * the start of the timeline, played at the current rate (see setRate()). The scheduler hands over the tracks in order of their
+ * next cue, so each due cue costs O(log k) for k tracks and a call with nothing due costs O(1).
+ * When a track has several cues due, the latest one is shown and the rest are skipped, so a late
+ * call catches up instead of lagging behind. All cues due in one call are shown in the same frame.
+ * Once the longest track has been held for its share of loopLength, the timeline loops back to the beginning.
+ * A staged timeline waiting for its swap takes over when the position crosses the swap point.
+ * Between cues, the effects running on the tracks get their next frames at the frame clock (see showFrames()).
  */
 void Playing::useTimelineData()
 {
-    // Get the current time
-    currentMillis2 = millis();
+    if (active->cueCount == 0 || !playing || (armedStart != 0 && !startScheduled()))
+    {
+        return;
+    }
+
+    // Get the current position in the timeline
+    long previous = currentMillis2;
+    currentMillis2 = getPosition();
+
+    bool loopEnd = scheduler.isEmpty() && currentMillis2 >= active->loopLength;
+    if (loopEnd)
+    {
+        // loop back to the beginning
+        rebasePosition -= (int64_t)active->loopLength << 16;
+        currentMillis2 -= active->loopLength;
+        previous = -1;
+        for (int t = 0; t < active->trackCount; t++)
+        {
+            active->tracks[t].effectStart -= active->loopLength; // effects carry on into the next pass
+            active->tracks[t].nextFrame -= active->loopLength;
+        }
+    }
+
+    if (swapPending && (swapMode == SWAP_AT_CUE && swapPosition < active->loopLength
+                            ? previous < swapPosition && currentMillis2 >= swapPosition
+                            : loopEnd))
+    {
+        swapTimeline(); // shows the new timeline's cues for the position
+        return;
+    }
+    if (loopEnd)
+    {
+        startPass();
+    }
 
     // Check if it's time to change colors
-    if (currentMillis2 - previousMillis >= timings[currentIndex]) {
-        // Update the previousMillis for the next iteration
-        previousMillis = currentMillis2;
-        Serial.print(timings[currentIndex]);
-        Serial.print(": ");
-        // Change the colors based on the current index
-        changeColours(colours[currentIndex]);
-
-        // Move to the next index
-        currentIndex++;
-
-        // If we reach the end of the array, loop back to the beginning
-        if (currentIndex >= maxTimingsNum) {
-            currentIndex = 0;
-        }
-    }
-//     Serial.println("play");
-//   // test:
-//   if (playing)
-//   {
-//     Serial.println("checking Timeline here");
-//     if (runNum > maxTimingsNum - 2) // todo: ???
-//     {
-//       // Serial.println("initialising runNum and playStartTime");s
-//       runNum = 0;
-//       playStartTime = millis();
-//     }
-//     // another sanity check:
-//     if (timings[runNum] > 0)
-//     {
-//       Serial.print("Checking timing for ");
-//       Serial.print(timings[runNum]);
-//       currentMillis2 = millis() - playStartTime; // reset the clock! At the beginning of play this should be 0!
-
-//       if (currentMillis2 < timings[0])
-//       {
-//         Serial.print("< ");
-//         Serial.println(runNum);
-//         runNum++;
-//       }
-//       //   I think currently timings[] array must be in time order to work. If the last time is smaller than the previous nothing happens? todo: sort?
-//       else if (currentMillis2 >= timings[runNum] && currentMillis2 <= timings[runNum + 1]) // todo: this omits the last signal..?
-//       {                                                                                    // saved signal
-//                                                                                            // Serial.print("== ");
-//         Serial.print(runNum);
-//         Serial.print(" of: ");
-//         Serial.println(maxTimingsNum - 1);
-//         // sanity check:
-//         // if (colours[runNum] < 13)
-//         // { // max is 22 otherwise it's a bogus signal
-//         signal = colours[runNum];
-//         // long time = timings[runNum];
-//         // flashy = flashes[runNum];
-//         Serial.print("colour is set to: ");
-//         Serial.println(colours[runNum]);
-//         Serial.print("timings is set to: ");
-//         Serial.println(timings[runNum]);
-//         changeColours(colours[runNum]);
-//         runNum++;
-//         // todo: deal with colours here - separate funciton
-//         // }
-//       }
-//       else if (currentMillis2 >= timings[runNum + 1])
-//       {
-//         runNum = maxTimingsNum; // went over - trigger reset
-//       }
-//       else
-//       {
-//         // test code:
-//         //  Serial.println("what else? ");
-//         //  Serial.println("runNum: ");
-//         //  Serial.println(runNum);
-//         //  Serial.print("millis: ");
-//         //  Serial.println(millis());
-//         //  Serial.print("currentMillis2: ");
-//         //  Serial.println(currentMillis2);
-//         //  Serial.print("timings[runNum]: ");
-//         //  Serial.println(timings[runNum]);
-//         //  Serial.print("timings[runNum + 1]: ");
-//         //  Serial.println(timings[runNum + 1]);
-
-//         playStartTime = millis();
-//         Serial.println("resetting playStartTime");
-//         runNum++;
-//       }
-//     }
-//   }
+    bool shown = false;
+    while (!scheduler.isEmpty() && currentMillis2 >= scheduler.nextTime())
+    {
+        int t = scheduler.pop();
+        Track &track = active->tracks[t];
+        int index = track.first + track.next;
+        int last = track.first + track.count - 1;
+        while (index < last && currentMillis2 >= cueTime(index + 1))
+        {
+            index++; // missed cue, skip to the latest one that is due
+        }
+        fireCue(t, index);
+        shown = true;
+
+        // Move this track on to its next cue
+        track.next = index - track.first + 1;
+        if (index < last)
+        {
+            scheduler.push(t, cueTime(index + 1));
+        }
+    }
+
+    if (showFrames() || shown)
+    {
+        output.show();
+    }
+    if (shown)
+    {
+        saveCheckpoint();
+    }
+}
+
+
+/**
+ * @brief Starts a timeline armed to start at a wall-clock time, once that time comes.
+ * 
+ * Every poi with the same timeline starts it at the same moment, to within the accuracy of their
+ * clocks, with no link between them during the show. Playback waits for the clock to be synced.
+ * A poi that comes to it late (e.g. after a reset mid-show) starts at the position the others are
+ * at, so it joins in step.
+ * 
+ * @return true if it has started, false while it is still waiting.
+ */
+bool Playing::startScheduled()
+{
+    if (!wallClock.isSynced())
+    {
+        return false;
+    }
+    long until = wallClock.msUntil(armedStart);
+    if (until > 0)
+    {
+        return false;
+    }
+
+    armedStart = 0;
+    long position = (long)(((int64_t)-until * rate >> 16) % active->loopLength);
+    setPosition(position);
+    seek(position);
+    saveCheckpoint();
+    Serial.print("Scheduled start, ");
+    Serial.print(-until);
+    Serial.println(" ms after the start time");
+    return true;
+}
+
+
+/**
+ * @brief Gets the effects of the next cues of each track ready, a few frames at a time.
+ * 
+ * Step of a task that runs in the idle time between cues: each step makes room in the effect
+ * cache for the effects of the next lookaheadCues cues of each track (going round to the start of
+ * the track near the end of a pass), and renders up to framesPerStep of their frames.
+ * 
+ * @return Milliseconds until the next step, 0 if there are frames left to render.
+ */
+unsigned long Playing::renderAhead()
+{
+    if (active->cues || active->effectCount == 0)
+    {
+        return renderInterval;
+    }
+    for (int t = 0; t < active->trackCount; t++)
+    {
+        Track &track = active->tracks[t];
+        if (track.effect != 0)
+        {
+            effectCache.prepare(active->effectTable[track.effect - 1]);
+        }
+        int next = armedStart != 0 ? 0 : track.next; // armed: the start has not been seeked to yet
+        for (int i = 0; i < min((int)lookaheadCues, track.count); i++)
+        {
+            uint8_t effect = cueEffect(track.first + (next + i) % track.count);
+            if (effect != 0)
+            {
+                effectCache.prepare(active->effectTable[effect - 1]);
+            }
+        }
+    }
+    return effectCache.render(framesPerStep) ? 0 : renderInterval;
 }
 
 
@@ -3,6 +3,12 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <EmbeddedTimeline.h>
+#include <Storage.h>
+#include <FlashStore.h>
+#include <CueScheduler.h>
+#include <Output.h>
+#include <EffectCache.h>
 
 /**
  * @file Playing.h
@@ -12,87 +18,245 @@
 class Playing
 {
 public:
-    Playing(); // Constructor declaration
-    void processTimelineData(const String &timelineData);
-    int *getColours();
+    /**
+     * @brief When a newly loaded timeline takes over from the one playing.
+     */
+    enum SwapMode : uint8_t {
+        SWAP_NOW,         ///< straight away, carrying on from the same position
+        SWAP_AT_LOOP_END, ///< when the current pass ends, starting from the beginning
+        SWAP_AT_CUE       ///< when the current pass gets to a cue time (see setSwapMode()), carrying on from there
+    };
+
+    Playing(Output &output); // Constructor declaration
+    bool processTimelineData(const String &timelineData);
+    uint8_t *getColours();
     long *getTimings();
     int getMaxTimingsNum();
+    const String &getTimelineFilePath();
+    long msUntilNextCue();
+    uint64_t getScheduledStart();
+    void reportCueTiming();
     String loadTimeline();
     bool setup();
+    bool setup(const String &timelineData);
+    bool setupEmbedded(int index);
+    bool nextTimeline();
+    void start();
+    void stop();
+    bool isPlaying();
+    void restart();
+    void setSwapMode(SwapMode mode, long position = 0);
+    void printSwapMode();
+    bool isSwapPending();
+    long getPosition();
+    void setRate(uint32_t newRate);
+    uint32_t getRate();
     void play();
-    void changeColours(int choice);
+    unsigned long renderAhead();
+    void changeColours(int track, uint8_t choice);
     void useTimelineData();
 
-private:
     /**
-     * @brief Number of timings in the timeline.
-     *
-     * This variable stores the maximum number of timings in the timeline.
-     * It is used to limit the size of the timings array.
+     * @brief Playback rate of 1.0 (recorded speed), in Q16 fixed point.
      */
-    int maxTimingsNum = 50;
+    static const uint32_t rateOne = 65536;
 
     /**
-     * @brief Variable to use int tinelineFilePath.
+     * @brief Slowest playback rate, 0.25, in Q16 fixed point.
+     */
+    static const uint32_t minRate = rateOne / 4;
+
+    /**
+     * @brief Fastest playback rate, 4.0, in Q16 fixed point.
+     */
+    static const uint32_t maxRate = rateOne * 4;
+
+    /**
+     * @brief Largest timeline accepted, in bytes of JSON.
      *
-     * This variable is a number which allows mulitple timelines to be stored in sequence.
+     * Bounds the heap the parsed document takes: maxEvents cues, a full palette and some slack.
      */
-    String timelineNumber = "0";
-    
+    static const size_t maxTimelineSize = 8192;
+
+private:
     /**
-     * @brief File path of the timeline file.
+     * @brief One track of the timeline: a range of cues in timings[] and colours[], in time order.
+     */
+    struct Track {
+        int first;
+        int count;
+        int next;         ///< offset from first of the next cue to show in this pass
+        uint8_t effect;   ///< effect running on its output, see Timeline::effects, or 0 for none
+        long effectStart; ///< time of the cue that started it, in ms from the start of the pass
+        long nextFrame;   ///< time its next frame is due, in ms from the start of the pass
+    };
+
+    /**
+     * @brief Capacity of the timings and colours arrays, shared by all tracks.
+     */
+    static const int maxEvents = 100;
+
+    /**
+     * @brief Largest number of tracks in a timeline.
+     */
+    static const int maxTracks = CueScheduler::maxEntries;
+
+    /**
+     * @brief Largest number of different effects in a timeline.
+     */
+    static const int maxEffects = 16;
+
+    /**
+     * @brief A timeline slot: a validated, normalised timeline, ready to play.
      *
-     * This variable stores the file path of the timeline data file.
+     * There are two, so a new timeline can be loaded into one while the other one plays.
      */
-    
-    String timelineFilePath = "/timeline" + timelineNumber + ".txt";
+    struct Timeline {
+        long timings[maxEvents];     ///< cue times of each track in turn, in ms from the start
+        uint8_t colours[maxEvents];  ///< cue colours, as palette indexes
+        uint8_t effects[maxEvents];  ///< cue effects, 1 + an index in effectTable, or 0 for just the colour
+        EffectCache::Effect effectTable[maxEffects]; ///< each different effect of the cues once
+        int effectCount;
+        Track tracks[maxTracks];     ///< a timeline in the old single track format has one
+        int trackCount;
+        int cueCount;                ///< in all tracks, never larger than maxEvents
+        long loopLength;             ///< length of one pass in ms, the longest track, so they stay in step
+        uint32_t id;                 ///< checksum, to recognise the same timeline again
+        const EmbeddedCue *cues;     ///< cues of an embedded timeline in flash, or nullptr to use timings and colours
+        int embeddedIndex;           ///< index of the embedded timeline, or -1 for a downloaded one
+        bool hasPalette;             ///< whether it brought the staged palette (see Output::swapPalette())
+        uint64_t startAt;            ///< Unix time in ms to start playing at (see WallClock), or 0 to play straight away
+    };
+
+    int parseTrack(JsonObject track, int first);
+    uint8_t parseEffect(JsonVariant event, int colour);
+    int applyPalette(JsonArray palette);
+    void loadCachedPalette();
+    int normaliseTrack(int from, int count, int to);
+    long cueTime(int index);
+    uint8_t cueColour(int index);
+    uint8_t cueEffect(int index);
+    void startEffect(int track, int index);
+    bool showFrames();
+    void stopEffects();
+    void setPosition(long position);
+    void startPass();
+    void seek(long position);
+    void offerTimeline();
+    void swapTimeline();
+    void fireCue(int track, int index);
+    bool resumeFromCheckpoint();
+    bool startScheduled();
+    void saveCheckpoint();
 
     /**
-     * @brief Array of keys in the timeline JSON.
+     * @brief Largest accepted event time in milliseconds (24 hours).
      *
-     * This array stores the keys extracted from the timeline JSON data.
+     * Anything later is treated as a corrupt key and skipped.
+     */
+    static const long maxEventTime = 86400000L;
+
+    /**
+     * @brief How long the last cue is held when the timeline has only one cue.
+     */
+    static const long defaultCueHold = 1000;
+
+    /**
+     * @brief Cues of each track whose effects renderAhead() gets ready, from the next one on.
+     */
+    static const int lookaheadCues = 2;
+
+    /**
+     * @brief Most frames renderAhead() renders in one step, so a step stays well under a millisecond.
+     */
+    static const int framesPerStep = 8;
+
+    /**
+     * @brief Time between renderAhead() steps with nothing left to render, in ms.
+     */
+    static const unsigned long renderInterval = 50;
+
+    /**
+     * @brief The two timeline slots.
+     */
+    Timeline slots[2];
+
+    /**
+     * @brief The timeline playing, one of slots.
+     */
+    Timeline *active = &slots[0];
+
+    /**
+     * @brief The other slot, that new timelines are loaded into.
      */
-    const char *timeline_keys[50]; // array for keys
+    Timeline *staged = &slots[1];
 
     /**
-     * @brief Red color value extracted from JSON.
+     * @brief Whether the staged timeline is waiting to take over (see swapMode).
      */
-    JsonVariant redVal;
+    bool swapPending = false;
 
     /**
-     * @brief Green color value extracted from JSON.
+     * @brief When a newly loaded timeline takes over.
      */
-    JsonVariant greenVal;
+    SwapMode swapMode = SWAP_NOW;
 
     /**
-     * @brief Blue color value extracted from JSON.
+     * @brief Position in ms to swap at, for SWAP_AT_CUE.
      */
-    JsonVariant blueVal;
+    long swapPosition = 0;
 
     /**
-     * @brief Red color value as an integer.
+     * @brief Unix time in ms the active timeline is armed to start at, or 0 if it isn't waiting to start.
      */
-    int redInt = 1;
+    uint64_t armedStart = 0;
 
     /**
-     * @brief Green color value as an integer.
+     * @brief Merges the tracks' cues in time order.
+     *
+     * Holds the next cue of each track with cues left in the current pass.
+     */
+    CueScheduler scheduler;
+
+    /**
+     * @brief Output layer the tracks drive.
+     */
+    Output &output;
+
+    /**
+     * @brief Frames of the effects of the cues, rendered ahead by renderAhead().
+     */
+    EffectCache effectCache;
+
+    /**
+     * @brief Variable to use int tinelineFilePath.
+     *
+     * This variable is a number which allows mulitple timelines to be stored in sequence.
+     */
+    String timelineNumber = "0";
+    
+    /**
+     * @brief File path of the timeline file.
+     *
+     * This variable stores the file path of the timeline data file.
      */
-    int greenInt = 1;
+    
+    String timelineFilePath = "/timeline" + timelineNumber + ".txt";
 
     /**
-     * @brief Blue color value as an integer.
+     * @brief File path of the palette cached from the last timeline that brought one.
      */
-    int blueInt = 1;
+    const char *paletteFilePath = "/palette.txt";
 
     /**
-     * @brief Array storing timings extracted from JSON.
+     * @brief Storage used to save and load the palette.
      */
-    long timings[50];
+    Storage storage;
 
     /**
-     * @brief Array storing colors extracted from JSON.
+     * @brief Storage used to load the timeline.
      */
-    int colours[50];
+    TimelineStore timelineStore;
 
     /**
      * @brief Flag indicating whether timeline data has been loaded.
@@ -100,19 +264,22 @@ private:
     bool already_got_data = false;
 
     /**
-     * @brief Timestamp when timeline playing started.
+     * @brief millis() when the position was last set or the rate last changed.
      */
-    long playStartTime = 0;
+    unsigned long rebaseTime = 0;
 
     /**
-     * @brief JSON object root.
+     * @brief Position in the timeline at rebaseTime, in Q16 fixed point milliseconds.
+     *
+     * The position is always worked out from here as rebasePosition + (millis() - rebaseTime) * rate,
+     * with the fraction kept, so rate changes and loops never add up rounding errors.
      */
-    JsonObject root;
+    int64_t rebasePosition = 0;
 
     /**
-     * @brief Iterator for timeline data.
+     * @brief Playback rate in Q16 fixed point, rateOne is the recorded speed.
      */
-    int iter = 0;
+    uint32_t rate = rateOne;
 
     /**
      * @brief Signal indicator.
@@ -120,17 +287,14 @@ private:
     uint8_t signal;
 
     /**
-     * @brief Timestamp of the last LED update.
-     */
-    long previousMillis = 0;
-
-    /**
-     * @brief Current timestamp.
+     * @brief Current position in the timeline, in milliseconds.
      */
     long currentMillis2 = 0;
 
     /**
      * @brief Flag indicating whether playing is active.
+     *
+     * Cleared by stop(), set again by start().
      */
     bool playing = true;
 
@@ -140,9 +304,19 @@ private:
     int runNum = 0;
 
     /**
-     * @brief Current index in the timeline data arrays.
+     * @brief Number of cues shown since the last timing report.
+     */
+    unsigned long cuesFired = 0;
+
+    /**
+     * @brief Sum of cue lateness in milliseconds since the last timing report.
+     */
+    long totalLateness = 0;
+
+    /**
+     * @brief Largest cue lateness in milliseconds since the last timing report.
      */
-    int currentIndex = 0;
+    long maxLateness = 0;
 };
 
 #endif
@@ -0,0 +1,116 @@
+/**
+ * @file PowerManager.cpp
+ * @brief Implementation of the PowerManager class.
+ * 
+ * Puts the ESP8266 to sleep between cues. The time of the next cue is known from the timeline,
+ * so loop() idles until just before it. With WiFi in light sleep mode, the SDK sleeps the CPU
+ * and modem during delay() and keeps the connection alive between access point beacons.
+ * Every minute the duty cycle, an estimate of the current it saves, and the cue timing accuracy
+ * are printed to the Serial monitor.
+ */
+
+
+#include "PowerManager.h"
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+/**
+ * @brief Constructor for PowerManager class.
+ * 
+ * @param playing The Playing object to get cue times from.
+ * @param connection The WiFi connection.
+ * @param output The LED outputs.
+ */
+PowerManager::PowerManager(Playing &playing, Connection &connection, Output &output)
+    : playing(playing), connection(connection), output(output)
+{
+}
+
+
+/**
+ * @brief Enables light sleep for the WiFi modem and CPU.
+ * 
+ * Call this once from setup().
+ */
+void PowerManager::begin()
+{
+    WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+    started = true;
+    lightSleepEnabled = true;
+    reportStartTime = millis();
+}
+
+
+/**
+ * @brief Idles until shortly before the next cue.
+ * 
+ * Call this at the end of loop() instead of delay(). Within wakeMargin of a cue it only yields,
+ * so loop() keeps checking until the cue is due. While a palette colour dims an LED, only the
+ * modem sleeps, because the PWM waveform would stop with the CPU.
+ * 
+ * @param maxIdle Longest time to idle for, in milliseconds, so other work in loop() still gets done.
+ */
+void PowerManager::idle(unsigned long maxIdle)
+{
+    unsigned long sleepTime = maxIdle;
+    long untilCue = playing.msUntilNextCue();
+    if (untilCue >= 0)
+    {
+        sleepTime = (unsigned long)untilCue > wakeMargin ? min((unsigned long)untilCue - wakeMargin, maxIdle) : 0;
+    }
+
+    if (started && output.isDimmed() == lightSleepEnabled)
+    {
+        lightSleepEnabled = !lightSleepEnabled;
+        WiFi.setSleepMode(lightSleepEnabled ? WIFI_LIGHT_SLEEP : WIFI_MODEM_SLEEP);
+    }
+
+    if (sleepTime > 0)
+    {
+        bool lightSleep = lightSleepEnabled && connection.isConnected();
+        unsigned long start = millis();
+        delay(sleepTime);
+        if (lightSleep)
+        {
+            lightSleepTime += millis() - start;
+        }
+        else
+        {
+            awakeIdleTime += millis() - start;
+        }
+    }
+    else
+    {
+        yield();
+    }
+
+    if (millis() - reportStartTime >= reportInterval)
+    {
+        report();
+    }
+}
+
+
+/**
+ * @brief Prints the duty cycle, estimated current and cue timing, and starts a new report period.
+ */
+void PowerManager::report()
+{
+    unsigned long total = millis() - reportStartTime;
+    unsigned long awake = total - lightSleepTime;
+    int sleepPercent = (int)(lightSleepTime * 100 / total);
+    unsigned long current = (awake * awakeCurrent + lightSleepTime * lightSleepCurrent) / total;
+
+    Serial.print("power: light sleep ");
+    Serial.print(sleepPercent);
+    Serial.print("%, idle awake ");
+    Serial.print(awakeIdleTime * 100 / total);
+    Serial.print("%, estimated ");
+    Serial.print(current);
+    Serial.println(" mA without LEDs");
+    playing.reportCueTiming();
+
+    reportStartTime = millis();
+    lightSleepTime = 0;
+    awakeIdleTime = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+
+#include <Arduino.h>
+#include <Playing.h>
+#include <Connection.h>
+#include <Output.h>
+
+/**
+ * @file PowerManager.h
+ * @brief Declaration of the PowerManager class.
+ */
+
+class PowerManager {
+public:
+    PowerManager(Playing &playing, Connection &connection, Output &output); // Constructor declaration
+    void begin();
+    void idle(unsigned long maxIdle);
+
+private:
+    void report();
+
+    /**
+     * @brief How long before a cue to wake up, in milliseconds.
+     *
+     * Covers the light sleep wake-up time and the rest of loop(), so the cue is shown on time.
+     */
+    static const unsigned long wakeMargin = 5;
+
+    /**
+     * @brief Time between power and cue timing reports, in milliseconds.
+     */
+    static const unsigned long reportInterval = 60000;
+
+    /**
+     * @brief Estimated current while awake with WiFi on, in mA (LEDs not included).
+     */
+    static const int awakeCurrent = 70;
+
+    /**
+     * @brief Estimated current in light sleep with WiFi associated, in mA (LEDs not included).
+     */
+    static const int lightSleepCurrent = 1;
+
+    /**
+     * @brief Playing object, used to find the time of the next cue.
+     */
+    Playing &playing;
+
+    /**
+     * @brief Connection object. Light sleep only happens while WiFi is associated.
+     */
+    Connection &connection;
+
+    /**
+     * @brief Output object. Light sleep is switched off while an LED is dimmed, as PWM stops in light sleep.
+     */
+    Output &output;
+
+    /**
+     * @brief Whether begin() was called, i.e. WiFi is in use and its sleep mode can be changed.
+     */
+    bool started = false;
+
+    /**
+     * @brief Whether the WiFi sleep mode is light sleep (rather than modem sleep) at the moment.
+     */
+    bool lightSleepEnabled = false;
+
+    /**
+     * @brief Timestamp when the current report period started.
+     */
+    unsigned long reportStartTime = 0;
+
+    /**
+     * @brief Time spent idle in light sleep since the last report, in milliseconds.
+     */
+    unsigned long lightSleepTime = 0;
+
+    /**
+     * @brief Time spent idle without light sleep since the last report, in milliseconds.
+     */
+    unsigned long awakeIdleTime = 0;
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef RTCLAYOUT_H
+#define RTCLAYOUT_H
+
+/**
+ * @file RtcLayout.h
+ * @brief Layout of the ESP8266 RTC user memory.
+ *
+ * RTC user memory is 512 bytes (128 blocks of 4 bytes) that survive a reset but not a power cycle.
+ * Offsets are in blocks, as used by ESP.rtcUserMemoryRead() and ESP.rtcUserMemoryWrite().
+ */
+
+/**
+ * @brief Block offset of the WiFi connection cache (Connection), 8 blocks.
+ */
+#define RTC_WIFI_CACHE_BLOCK 0
+
+/**
+ * @brief Block offset of the playback checkpoint (Playing), 4 blocks.
+ */
+#define RTC_PLAYBACK_BLOCK 8
+
+#endif
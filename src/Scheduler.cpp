@@ -0,0 +1,228 @@
+/**
+ * @file Scheduler.cpp
+ * @brief Implementation of the Scheduler class.
+ *
+ * Cooperative scheduler for loop(). Each task is a step function that does a bounded piece of
+ * work and returns how long until it wants to run again, keeping its own state between steps
+ * (an explicit state machine, like Connection), so nothing else ever waits for it to finish.
+ *
+ * Playback is the deadline task: it runs on every run() and again before every other step.
+ * Any other task only gets a step if its longest recent step fits in the time left before the
+ * next cue. Steps that cost very different amounts (a server request, then reading the response
+ * a chunk at a time) are told apart by the task with setPhase(), and timed per phase.
+ * Otherwise it waits for the cue to be shown and runs straight after it, with the whole gap to the next cue. A task held back for maxDeferral runs anyway, so one whose steps
+ * are longer than the gaps between cues (a server request with fast cues) still gets through.
+ * Steps are not pre-empted: a step that takes longer than it ever did before still makes a cue late.
+ */
+
+
+#include "Scheduler.h"
+#include <Arduino.h>
+
+/**
+ * @brief Constructor for Scheduler class.
+ *
+ * @param untilDeadline Function returning the milliseconds until the next deadline (e.g. the next cue), or -1 if there is none.
+ */
+Scheduler::Scheduler(long (*untilDeadline)()) : untilDeadline(untilDeadline)
+{
+}
+
+
+/**
+ * @brief Adds a task, due straight away.
+ *
+ * @param name Name for report().
+ * @param step The task's step function.
+ * @param priority Its priority. PRIORITY_PLAYBACK tasks are the deadline tasks.
+ * @param section Profiler section its steps are charged to.
+ * @return Id of the task, for wake(), or -1 if there are too many tasks.
+ */
+int Scheduler::add(const char *name, Step step, Priority priority, LoopProfiler::Section section)
+{
+    if (taskCount >= maxTasks)
+    {
+        return -1;
+    }
+    int id = taskCount++;
+    Task &task = tasks[id];
+    memset(&task, 0, sizeof(task));
+    task.name = name;
+    task.step = step;
+    task.priority = priority;
+    task.section = section;
+    task.nextRun = millis();
+
+    // keep order[] sorted by priority, later tasks after earlier ones of the same priority
+    int i = id;
+    while (i > 0 && tasks[order[i - 1]].priority > priority)
+    {
+        order[i] = order[i - 1];
+        i--;
+    }
+    order[i] = id;
+    return id;
+}
+
+
+/**
+ * @brief Makes a task due straight away, e.g. one that returned asleep.
+ *
+ * @param id Id of the task, from add().
+ */
+void Scheduler::wake(int id)
+{
+    if (id >= 0 && id < taskCount)
+    {
+        tasks[id].sleeping = false;
+        tasks[id].nextRun = millis();
+    }
+}
+
+
+/**
+ * @brief Sets the phase of the next step of the task that is running, so its time is predicted from
+ * earlier steps of that phase. Call it from a step; tasks that never call it only have phase 0.
+ *
+ * @param phase The phase, below maxPhases.
+ */
+void Scheduler::setPhase(uint8_t phase)
+{
+    if (current && phase < maxPhases)
+    {
+        current->phase = phase;
+    }
+}
+
+
+/**
+ * @brief Runs one step of every task that is due, most urgent first.
+ *
+ * Call this from loop().
+ */
+void Scheduler::run()
+{
+    runDeadlineTasks();
+    for (int i = 0; i < taskCount; i++)
+    {
+        Task &task = tasks[order[i]];
+        unsigned long now = millis();
+        if (task.priority == PRIORITY_PLAYBACK || task.sleeping || (long)(now - task.nextRun) < 0)
+        {
+            continue;
+        }
+        if (!fitsBeforeDeadline(task, now))
+        {
+            continue;
+        }
+        runStep(task);
+        runDeadlineTasks(); // a cue may have come due during the step
+    }
+}
+
+
+/**
+ * @brief Works out how long loop() can idle before a task is due. Deadline tasks are left to PowerManager.
+ *
+ * @return Milliseconds until the next task is due, 0 if one is due now.
+ */
+unsigned long Scheduler::msUntilNextRun()
+{
+    unsigned long now = millis();
+    unsigned long wait = asleep;
+    for (int i = 0; i < taskCount; i++)
+    {
+        Task &task = tasks[i];
+        if (task.priority == PRIORITY_PLAYBACK || task.sleeping)
+        {
+            continue;
+        }
+        long until = (long)(task.nextRun - now);
+        wait = min(wait, until > 0 ? (unsigned long)until : 0UL);
+    }
+    return wait;
+}
+
+
+/**
+ * @brief Prints the steps of each task since the last report, then starts counting again.
+ */
+void Scheduler::report()
+{
+    Serial.println("Tasks (times in us):");
+    Serial.println("task        steps  longest  held back");
+    for (int i = 0; i < taskCount; i++)
+    {
+        Task &task = tasks[order[i]];
+        char line[64];
+        snprintf(line, sizeof(line), "%-9s %7lu %8lu %10lu%s", task.name, (unsigned long)task.steps,
+                 (unsigned long)task.longestStep, (unsigned long)task.deferrals, task.sleeping ? "  (asleep)" : "");
+        Serial.println(line);
+        task.steps = 0;
+        task.longestStep = 0;
+        task.deferrals = 0;
+    }
+}
+
+
+/**
+ * @brief Runs a step of each deadline task.
+ */
+void Scheduler::runDeadlineTasks()
+{
+    for (int i = 0; i < taskCount && tasks[order[i]].priority == PRIORITY_PLAYBACK; i++)
+    {
+        runStep(tasks[order[i]]);
+    }
+}
+
+
+/**
+ * @brief Runs one step of a task and works out when it runs next.
+ *
+ * @param task The task.
+ */
+void Scheduler::runStep(Task &task)
+{
+    uint8_t phase = task.phase;
+    current = &task;
+    profiler.enter(task.section);
+    uint32_t start = micros();
+    unsigned long wait = task.step();
+    uint32_t duration = micros() - start;
+    profiler.leave();
+    current = nullptr;
+
+    task.steps++;
+    task.deferred = false;
+    task.longestStep = max(task.longestStep, duration);
+    uint32_t &worst = task.worstStep[phase];
+    worst = max(duration, worst - worst / 16); // one slow step is forgotten over a few dozen steps
+    task.sleeping = wait == asleep;
+    task.nextRun = millis() + (task.sleeping ? 0 : wait);
+}
+
+
+/**
+ * @brief Checks whether a step of a task can run without making the next cue late.
+ *
+ * @param task The task.
+ * @param now The current millis().
+ * @return true if the step should run now, false to hold it back until after the cue.
+ */
+bool Scheduler::fitsBeforeDeadline(Task &task, unsigned long now)
+{
+    long untilCue = untilDeadline();
+    if (untilCue < 0 || (uint64_t)task.worstStep[task.phase] + deadlineMargin <= (uint64_t)untilCue * 1000) // 64 bits: a scheduled start can be hours away
+    {
+        return true;
+    }
+    if (!task.deferred)
+    {
+        task.deferred = true;
+        task.deferredSince = now;
+        task.deferrals++;
+        return false;
+    }
+    return now - task.deferredSince >= maxDeferral;
+}
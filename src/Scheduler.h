@@ -0,0 +1,111 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <LoopProfiler.h>
+
+/**
+ * @file Scheduler.h
+ * @brief Declaration of the Scheduler class.
+ */
+
+class Scheduler {
+public:
+    /**
+     * @brief One step of a task. Does a bounded piece of work and returns.
+     *
+     * @return Milliseconds until the task wants to run again, 0 for as soon as possible, or asleep to wait for wake().
+     */
+    typedef unsigned long (*Step)();
+
+    /**
+     * @brief Priorities, most urgent first. Tasks of the same priority run in the order they were added.
+     */
+    enum Priority : uint8_t {
+        PRIORITY_PLAYBACK = 0,  ///< deadline task: runs every time, before every other step
+        PRIORITY_INPUT,         ///< buttons and Serial commands
+        PRIORITY_NETWORK,       ///< WiFi, sync and the local web server
+        PRIORITY_REFRESH,       ///< fetching, saving and decoding a timeline
+        PRIORITY_LOGGING,       ///< telemetry
+        PRIORITY_IDLE           ///< rendering effects ahead of their cues
+    };
+
+    /**
+     * @brief Returned by a step to sleep until wake() is called.
+     */
+    static const unsigned long asleep = 0xffffffff;
+
+    Scheduler(long (*untilDeadline)()); // Constructor declaration
+    int add(const char *name, Step step, Priority priority, LoopProfiler::Section section);
+    void wake(int task);
+    void setPhase(uint8_t phase);
+    void run();
+    unsigned long msUntilNextRun();
+    void report();
+
+private:
+    /**
+     * @brief Number of phases a task can have, see setPhase().
+     */
+    static const uint8_t maxPhases = 8;
+
+    /**
+     * @brief A task and its timing.
+     */
+    struct Task {
+        const char *name;
+        Step step;
+        Priority priority;
+        LoopProfiler::Section section;
+        unsigned long nextRun;     ///< millis() when it wants to run
+        bool sleeping;             ///< waiting for wake()
+        uint8_t phase;             ///< what its next step does, see setPhase()
+        uint32_t worstStep[maxPhases]; ///< longest recent step of each phase in microseconds, slowly forgotten
+        uint32_t longestStep;      ///< longest step since the last report, in microseconds
+        uint32_t steps;            ///< steps since the last report
+        uint32_t deferrals;        ///< times it was held back for a deadline since the last report
+        bool deferred;             ///< held back now
+        unsigned long deferredSince;
+    };
+
+    void runDeadlineTasks();
+    void runStep(Task &task);
+    bool fitsBeforeDeadline(Task &task, unsigned long now);
+
+    /**
+     * @brief Largest number of tasks.
+     */
+    static const int maxTasks = 8;
+
+    /**
+     * @brief Time kept free before the deadline, in microseconds, for the rest of loop() and the output.
+     */
+    static const uint32_t deadlineMargin = 2000;
+
+    /**
+     * @brief Longest a task is held back for the deadline, in milliseconds.
+     *
+     * With cues closer together than a step takes, the step would never fit; after this long it runs
+     * anyway, so a refresh still finishes.
+     */
+    static const unsigned long maxDeferral = 1000;
+
+    /**
+     * @brief Returns the milliseconds until the deadline (the next cue), or -1 if there is none.
+     */
+    long (*untilDeadline)();
+
+    /**
+     * @brief The tasks, in the order they were added (their ids), and their ids most urgent first.
+     */
+    Task tasks[maxTasks];
+    uint8_t order[maxTasks];
+    int taskCount = 0;
+
+    /**
+     * @brief Task whose step is running, or nullptr.
+     */
+    Task *current = nullptr;
+};
+
+#endif
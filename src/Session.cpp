@@ -0,0 +1,166 @@
+/**
+ * @file Session.cpp
+ * @brief Implementation of the Session class.
+ *
+ * This class owns the JWT token and the WiFi client used to talk to the Magic Poi Lite server api.
+ * One instance is shared by reference between Authentication and Loading, so the token saved
+ * after a login is always the one used for loading.
+ */
+
+
+#include "Session.h"
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiClient.h>
+#include <ESP8266HTTPClient.h>
+#include <secrets.h>
+#include <Connection.h>
+#include <Tracer.h>
+#include <Metrics.h>
+
+/**
+ * @brief Default constructor for Session class.
+ *
+ * This constructor only clears the token buffer. The saved token is read from LittleFS
+ * the first time it is needed, not during static initialisation.
+ */
+Session::Session()
+{
+    memset(token, 0, sizeof(token)); // Clear token buffer
+}
+
+
+/**
+ * @brief Returns the current JWT token.
+ *
+ * On first use this loads the saved token from LittleFS.
+ *
+ * @return The JWT token, or an empty string if there is none.
+ */
+const char *Session::getToken()
+{
+    if (!tokenLoaded)
+    {
+        readTokenFromFile();
+    }
+    return token;
+}
+
+
+/**
+ * @brief Checks whether a JWT token is available.
+ *
+ * @return true if a token is held in memory or could be loaded from LittleFS, false otherwise.
+ */
+bool Session::hasToken()
+{
+    return getToken()[0] != '\0';
+}
+
+
+/**
+ * @brief Stores a new JWT token and saves it to LittleFS.
+ *
+ * @param newToken The JWT token received from the server.
+ */
+void Session::setToken(const char *newToken)
+{
+    strncpy(token, newToken, sizeof(token) - 1);
+    token[sizeof(token) - 1] = '\0'; // Null-terminate the token string
+    tokenLoaded = true;
+    saveTokenToFile(); //save for next time, so we won't need to do this again.
+}
+
+
+/**
+ * @brief Discards the token in memory and reads the saved one from LittleFS again.
+ *
+ * @return true if a saved token was loaded, false otherwise.
+ */
+bool Session::reloadToken()
+{
+    memset(token, 0, sizeof(token));
+    return readTokenFromFile();
+}
+
+
+/**
+ * @brief Returns the shared WiFi client.
+ *
+ * @return Reference to the WiFi client used for all server requests.
+ */
+WiFiClient &Session::getClient()
+{
+    return client;
+}
+
+
+/**
+ * @brief Starts an HTTP request to the Magic Poi Lite server api.
+ * 
+ * Uses the shared WiFi client and sets the request timeout, so a slow or dead server
+ * can't block for longer than Connection::httpTimeout per phase. With TRACE_DNS the server name
+ * is resolved first, so the DNS lookup shows up on its own in the trace (lwIP caches the answer for
+ * the request); that costs a blocking lookup per request, so otherwise it is left to the connect.
+ * Every request has to be ended with endRequest(), whatever happened to it.
+ * 
+ * @param http The HTTPClient to set up.
+ * @param path Path of the api endpoint, starting with "/".
+ * @return true if the request could be set up, false otherwise.
+ */
+bool Session::beginRequest(HTTPClient &http, const String &path)
+{
+#ifdef TRACE_DNS
+    {
+        Tracer::Span span(Tracer::DNS);
+        IPAddress address;
+        WiFi.hostByName(serverIP, address);
+    }
+#endif
+    http.setTimeout(Connection::httpTimeout);
+    metrics.opened(Metrics::HTTP_REQUEST);
+    return http.begin(client, "http://" + String(serverIP) + ":" + String(serverPort) + path);
+}
+
+
+/**
+ * @brief Ends an HTTP request started with beginRequest(), closing the connection and freeing its buffers.
+ * 
+ * @param http The HTTPClient of the request.
+ */
+void Session::endRequest(HTTPClient &http)
+{
+    http.end();
+    metrics.closed(Metrics::HTTP_REQUEST);
+}
+
+
+/**
+ * @brief Reads JWT token from a file stored on LittleFS.
+ *
+ * This method reads the saved token into the token buffer. If the file does not exist,
+ * is corrupt, or if there's any failure during the file system operation, the buffer is left empty.
+ *
+ * @return true if a token was read, false otherwise.
+ */
+bool Session::readTokenFromFile()
+{
+    tokenLoaded = true;
+
+    String savedToken = storage.load(jwtFilePath);
+    strncpy(token, savedToken.c_str(), sizeof(token) - 1);
+    token[sizeof(token) - 1] = '\0'; // Null-terminate the token string
+
+    return token[0] != '\0';
+}
+
+
+/**
+ * @brief Saves the JWT token to a file on LittleFS.
+ *
+ * Nothing is written if the saved token is already the same.
+ */
+void Session::saveTokenToFile()
+{
+    storage.save(jwtFilePath, token);
+}
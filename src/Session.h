@@ -0,0 +1,63 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <ESP8266HTTPClient.h>
+#include <Storage.h>
+
+/**
+ * @file Session.h
+ * @brief Declaration of the Session class.
+ */
+
+class Session {
+public:
+    Session(); // Constructor declaration
+    const char *getToken();
+    bool hasToken();
+    void setToken(const char *newToken);
+    bool reloadToken();
+    WiFiClient &getClient();
+    bool beginRequest(HTTPClient &http, const String &path);
+    void endRequest(HTTPClient &http);
+
+private:
+    bool readTokenFromFile();
+    void saveTokenToFile();
+
+    /**
+     * @brief Buffer for JWT token.
+     *
+     * This is the only copy of the JWT token in RAM, shared by Authentication and Loading.
+     */
+    char token[512];
+
+    /**
+     * @brief Flag indicating whether LittleFS has already been checked for a saved token.
+     *
+     * The token is loaded lazily on first use so nothing touches LittleFS before setup().
+     */
+    bool tokenLoaded = false;
+
+    /**
+     * @brief Path to the file storing JWT token.
+     *
+     * This string represents the file path of the file storing the JWT token in LittleFS.
+     */
+    const char *jwtFilePath = "/jwt.txt";
+
+    /**
+     * @brief Storage used to save and load the token file.
+     */
+    Storage storage;
+
+    /**
+     * @brief WiFi client object.
+     *
+     * This object is used for all network communication with the server.
+     */
+    WiFiClient client;
+};
+
+#endif
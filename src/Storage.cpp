@@ -0,0 +1,292 @@
+/**
+ * @file Storage.cpp
+ * @brief Implementation of the Storage class.
+ * 
+ * Safe file saving on LittleFS for timelines and tokens. New data is written to a temporary file,
+ * with a trailer holding its length and CRC, and then renamed over the old file, so a power loss
+ * mid-write never leaves a torn file in place. Saving data that is the same as what is already
+ * stored is skipped, which saves flash time and wear on every refresh. load() checks the trailer
+ * and returns nothing for a missing, truncated or corrupt file.
+ * LittleFS is mounted only while a file is in use; mounts and open files are counted in the metrics,
+ * so one left behind shows up there.
+ */
+
+
+#include "Storage.h"
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <coredecls.h>
+#include <LoopProfiler.h>
+#include <Metrics.h>
+
+/**
+ * @brief Default constructor for Storage class.
+ */
+Storage::Storage()
+{
+}
+
+
+/**
+ * @brief Saves data to a file, unless the file already holds the same data.
+ * 
+ * @param path Path of the file in LittleFS.
+ * @param data The data to save.
+ * @return true if the file holds the data afterwards, false if saving failed.
+ */
+bool Storage::save(const String &path, const String &data)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    if (!LittleFS.begin())
+    {
+        Serial.println("Couldn't open LittleFS to save");
+        return false;
+    }
+    metrics.opened(Metrics::FS_MOUNT);
+
+    Trailer newTrailer = {data.length(), crc32(data.c_str(), data.length()), trailerMagic};
+    Trailer oldTrailer;
+    File oldFile = LittleFS.open(path, "r");
+    bool same = false;
+    if (oldFile)
+    {
+        metrics.opened(Metrics::OPEN_FILE);
+        same = readTrailer(oldFile, oldTrailer) && oldTrailer.length == newTrailer.length && oldTrailer.crc == newTrailer.crc;
+        oldFile.close();
+        metrics.closed(Metrics::OPEN_FILE);
+    }
+    LittleFS.end();
+    metrics.closed(Metrics::FS_MOUNT);
+
+    if (same)
+    {
+        Serial.print("Unchanged, not saving ");
+        Serial.println(path);
+        return true;
+    }
+
+    if (!beginSave(path))
+    {
+        return false;
+    }
+    write((const uint8_t *)data.c_str(), data.length());
+    return endSave();
+}
+
+
+/**
+ * @brief Loads a file saved with save() or beginSave().
+ * 
+ * @param path Path of the file in LittleFS.
+ * @return The data, or an empty string if the file is missing, truncated or corrupt.
+ */
+String Storage::load(const String &path)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    String data = "";
+
+    if (LittleFS.begin())
+    {
+        metrics.opened(Metrics::FS_MOUNT);
+        File file = LittleFS.open(path, "r");
+        if (file)
+        {
+            metrics.opened(Metrics::OPEN_FILE);
+            Trailer trailer;
+            if (readTrailer(file, trailer) && data.reserve(trailer.length))
+            {
+                file.seek(0);
+                char buf[128];
+                uint32_t remaining = trailer.length;
+                while (remaining > 0)
+                {
+                    size_t len = file.readBytes(buf, min(remaining, (uint32_t)sizeof(buf)));
+                    if (len == 0)
+                    {
+                        break;
+                    }
+                    data.concat(buf, len);
+                    remaining -= len;
+                }
+                if (remaining > 0 || crc32(data.c_str(), data.length()) != trailer.crc)
+                {
+                    data = "";
+                }
+            }
+            file.close();
+            metrics.closed(Metrics::OPEN_FILE);
+            if (data.isEmpty())
+            {
+                Serial.print("Corrupt or incomplete file: ");
+                Serial.println(path);
+            }
+        }
+        LittleFS.end();
+        metrics.closed(Metrics::FS_MOUNT);
+    }
+    else
+    {
+        Serial.println("LittleFS Failed to begin");
+    }
+
+    return data;
+}
+
+
+/**
+ * @brief Starts saving a file in chunks, for data that arrives in pieces.
+ * 
+ * Follow with write() for each chunk and endSave(), or abortSave() to keep the old file.
+ * LittleFS stays mounted until then.
+ * 
+ * @param path Path of the file in LittleFS.
+ * @return true if the temporary file could be created, false otherwise.
+ */
+bool Storage::beginSave(const String &path)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    abortSave(); // in case the last save was never finished
+    this->path = path;
+    tempPath = path + ".tmp";
+    crc = 0xffffffff;
+    length = 0;
+
+    if (!LittleFS.begin())
+    {
+        Serial.println("Couldn't open LittleFS to save");
+        return false;
+    }
+    metrics.opened(Metrics::FS_MOUNT);
+    file = LittleFS.open(tempPath, "w");
+    if (!file)
+    {
+        Serial.println("couldn't create file?");
+        LittleFS.end();
+        metrics.closed(Metrics::FS_MOUNT);
+        return false;
+    }
+    metrics.opened(Metrics::OPEN_FILE);
+    saving = true;
+    return true;
+}
+
+
+/**
+ * @brief Writes a chunk of data to the file being saved.
+ * 
+ * @param data The chunk of data.
+ * @param len Length of the chunk.
+ * @return Number of bytes written.
+ */
+size_t Storage::write(const uint8_t *data, size_t len)
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    if (!file)
+    {
+        return 0;
+    }
+    size_t written = file.write(data, len);
+    metrics.flashWrite(written);
+    crc = crc32(data, written, crc);
+    length += written;
+    return written;
+}
+
+
+/**
+ * @brief Finishes saving: adds the trailer and replaces the old file.
+ * 
+ * @return true if the file was saved completely, false otherwise (the old file is kept), or if no save was in progress.
+ */
+bool Storage::endSave()
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    if (!saving)
+    {
+        return false;
+    }
+    saving = false;
+    bool ok = finish();
+    LittleFS.end();
+    metrics.closed(Metrics::FS_MOUNT);
+    metrics.fileSaved(ok);
+    if (ok)
+    {
+        Serial.print("Saved ");
+        Serial.println(path);
+    }
+    else
+    {
+        Serial.print("Failed to save ");
+        Serial.println(path);
+    }
+    return ok;
+}
+
+
+/**
+ * @brief Abandons saving and keeps the old file. Does nothing if no save is in progress.
+ */
+void Storage::abortSave()
+{
+    LoopProfiler::Scope scope(LoopProfiler::STORAGE);
+    if (!saving)
+    {
+        return;
+    }
+    saving = false;
+    if (file)
+    {
+        file.close();
+        metrics.closed(Metrics::OPEN_FILE);
+        LittleFS.remove(tempPath);
+    }
+    LittleFS.end();
+    metrics.closed(Metrics::FS_MOUNT);
+}
+
+
+/**
+ * @brief Writes the trailer and renames the temporary file over the old one.
+ * 
+ * LittleFS renames atomically, so either the old or the new file is there afterwards, never a mix.
+ * 
+ * @return true if successful, false otherwise.
+ */
+bool Storage::finish()
+{
+    if (!file)
+    {
+        return false;
+    }
+    Trailer trailer = {length, crc, trailerMagic};
+    bool ok = file.write((const uint8_t *)&trailer, sizeof(trailer)) == sizeof(trailer);
+    metrics.flashWrite(sizeof(trailer));
+    file.close();
+    metrics.closed(Metrics::OPEN_FILE);
+    if (!ok || !LittleFS.rename(tempPath, path))
+    {
+        LittleFS.remove(tempPath);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Reads and checks the trailer at the end of a file.
+ * 
+ * @param file The open file.
+ * @param trailer Receives the trailer.
+ * @return true if the file has a valid trailer matching its size, false otherwise.
+ */
+bool Storage::readTrailer(File &file, Trailer &trailer)
+{
+    size_t size = file.size();
+    if (size < sizeof(trailer) || !file.seek(size - sizeof(trailer)) ||
+        file.read((uint8_t *)&trailer, sizeof(trailer)) != sizeof(trailer))
+    {
+        return false;
+    }
+    return trailer.magic == trailerMagic && trailer.length == size - sizeof(trailer);
+}
@@ -0,0 +1,74 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+/**
+ * @file Storage.h
+ * @brief Declaration of the Storage class.
+ */
+
+class Storage {
+public:
+    Storage(); // Constructor declaration
+    bool save(const String &path, const String &data);
+    String load(const String &path);
+    bool beginSave(const String &path);
+    size_t write(const uint8_t *data, size_t len);
+    bool endSave();
+    void abortSave();
+
+private:
+    /**
+     * @brief Trailer written after the data of every file.
+     *
+     * Holds the length and checksum of the data, so a truncated or corrupt file is detected on load,
+     * and an unchanged file can be detected without reading it all.
+     */
+    struct Trailer {
+        uint32_t length;
+        uint32_t crc;
+        uint32_t magic;
+    };
+
+    bool readTrailer(File &file, Trailer &trailer);
+    bool finish();
+
+    /**
+     * @brief Marks the end of a valid trailer.
+     */
+    static const uint32_t trailerMagic = 0x314c504d; // "MPL1"
+
+    /**
+     * @brief File being written, a temporary file next to the target.
+     */
+    File file;
+
+    /**
+     * @brief Path of the file being saved.
+     */
+    String path;
+
+    /**
+     * @brief Path of the temporary file being written.
+     */
+    String tempPath;
+
+    /**
+     * @brief Checksum of the data written so far.
+     */
+    uint32_t crc = 0;
+
+    /**
+     * @brief Number of bytes written so far.
+     */
+    uint32_t length = 0;
+
+    /**
+     * @brief Whether a save is in progress: LittleFS is mounted and file open until endSave() or abortSave().
+     */
+    bool saving = false;
+};
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * @file Telemetry.cpp
+ * @brief Implementation of the Telemetry class.
+ * 
+ * Compact binary telemetry on the Serial port. Each event is one frame:
+ * 
+ *     0xA5, event id, payload length, timestamp (micros, u32 little endian), payload, CRC-8
+ * 
+ * Frames are queued in a small ring buffer and sent from loop() only when the UART has room,
+ * so emitting never blocks. Frames are only ever sent whole, so they can be mixed with the
+ * text log; tools/telemetry_decode.py picks them out and turns them into CSV.
+ */
+
+
+#include "Telemetry.h"
+#include <Arduino.h>
+
+Telemetry telemetry;
+
+/**
+ * @brief Default constructor for Telemetry class.
+ */
+Telemetry::Telemetry()
+{
+}
+
+
+/**
+ * @brief Switches telemetry on. Until this is called, events are ignored.
+ */
+void Telemetry::begin()
+{
+    enabled = true;
+}
+
+
+/**
+ * @brief Checks whether telemetry is switched on.
+ * 
+ * Text logging on hot paths is skipped when it is, to keep the UART free.
+ * 
+ * @return true if telemetry is on, false otherwise.
+ */
+bool Telemetry::isEnabled()
+{
+    return enabled;
+}
+
+
+/**
+ * @brief Records a cue being shown.
+ * 
+ * @param index Index of the cue in the timeline.
+ * @param colour Colour shown.
+ * @param lateness How late the cue was shown, in milliseconds.
+ */
+void Telemetry::cueFired(uint16_t index, uint8_t colour, long lateness)
+{
+    int16_t late = constrain(lateness, -32768L, 32767L);
+    uint8_t payload[5];
+    memcpy(payload, &index, 2);
+    payload[2] = colour;
+    memcpy(payload + 3, &late, 2);
+    emit(CUE_FIRED, payload, sizeof(payload));
+}
+
+
+/**
+ * @brief Records the end of one phase of loading a timeline.
+ * 
+ * @param phase The phase.
+ * @param ok Whether it succeeded.
+ * @param duration How long it took, in milliseconds.
+ */
+void Telemetry::loadPhase(Phase phase, bool ok, uint32_t duration)
+{
+    uint8_t payload[6];
+    payload[0] = phase;
+    payload[1] = ok;
+    memcpy(payload + 2, &duration, 4);
+    emit(LOAD_PHASE, payload, sizeof(payload));
+}
+
+
+/**
+ * @brief Records a snapshot of the heap.
+ */
+void Telemetry::heap()
+{
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+    uint8_t payload[9];
+    memcpy(payload, &freeHeap, 4);
+    memcpy(payload + 4, &maxBlock, 4);
+    payload[8] = ESP.getHeapFragmentation();
+    emit(HEAP, payload, sizeof(payload));
+}
+
+
+/**
+ * @brief Records the result of a request to the server.
+ * 
+ * @param endpoint The endpoint requested.
+ * @param httpCode HTTP status code, or a negative HTTPClient error.
+ * @param bytes Size of the response body.
+ * @param duration How long the request took, in milliseconds.
+ */
+void Telemetry::netResult(Endpoint endpoint, int httpCode, uint32_t bytes, uint32_t duration)
+{
+    int16_t code = httpCode;
+    uint8_t payload[11];
+    payload[0] = endpoint;
+    memcpy(payload + 1, &code, 2);
+    memcpy(payload + 3, &bytes, 4);
+    memcpy(payload + 7, &duration, 4);
+    emit(NET_RESULT, payload, sizeof(payload));
+}
+
+
+/**
+ * @brief Sends as many whole frames as the UART can take without blocking.
+ * 
+ * Call this from loop().
+ */
+void Telemetry::flush()
+{
+    if (!enabled)
+    {
+        return;
+    }
+    if (dropped > 0 && used() + frameOverhead + 2 < bufferSize)
+    {
+        uint16_t count = dropped;
+        dropped = 0;
+        emit(DROPPED, (const uint8_t *)&count, 2);
+    }
+
+    int room = Serial.availableForWrite();
+    while (head != tail)
+    {
+        uint8_t frameLen = buffer[(tail + 2) % bufferSize] + frameOverhead;
+        if (frameLen > room)
+        {
+            break;
+        }
+        for (uint8_t i = 0; i < frameLen; i++)
+        {
+            Serial.write(buffer[tail]);
+            tail = (tail + 1) % bufferSize;
+        }
+        room -= frameLen;
+    }
+}
+
+
+/**
+ * @brief Queues a frame, or counts it as dropped if the buffer is full.
+ * 
+ * @param event Event ID.
+ * @param payload Event data.
+ * @param len Length of the event data.
+ */
+void Telemetry::emit(Event event, const uint8_t *payload, uint8_t len)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    if (used() + len + frameOverhead >= bufferSize)
+    {
+        dropped++;
+        return;
+    }
+
+    uint32_t timestamp = micros();
+    uint8_t header[6] = {event, len,
+                         (uint8_t)timestamp, (uint8_t)(timestamp >> 8),
+                         (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 24)};
+    uint8_t crc = 0;
+    put(frameSync);
+    for (uint8_t i = 0; i < sizeof(header); i++)
+    {
+        put(header[i]);
+        crc = crc8(crc, header[i]);
+    }
+    for (uint8_t i = 0; i < len; i++)
+    {
+        put(payload[i]);
+        crc = crc8(crc, payload[i]);
+    }
+    put(crc);
+}
+
+
+/**
+ * @brief Returns the number of bytes queued.
+ * 
+ * @return Bytes waiting to be sent.
+ */
+uint16_t Telemetry::used()
+{
+    return (head - tail) & (bufferSize - 1);
+}
+
+
+/**
+ * @brief Adds one byte to the buffer.
+ * 
+ * @param value The byte.
+ */
+void Telemetry::put(uint8_t value)
+{
+    buffer[head] = value;
+    head = (head + 1) % bufferSize;
+}
+
+
+/**
+ * @brief Updates a CRC-8 (polynomial 0x07) with one byte.
+ * 
+ * @param crc The CRC so far.
+ * @param value The next byte.
+ * @return The updated CRC.
+ */
+uint8_t Telemetry::crc8(uint8_t crc, uint8_t value)
+{
+    crc ^= value;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
@@ -0,0 +1,95 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+/**
+ * @file Telemetry.h
+ * @brief Declaration of the Telemetry class.
+ */
+
+class Telemetry {
+public:
+    /**
+     * @brief Event IDs. Keep in step with tools/telemetry_decode.py.
+     */
+    enum Event : uint8_t {
+        CUE_FIRED = 1,   ///< cue index (u16), colour (u8), lateness ms (i16)
+        LOAD_PHASE = 2,  ///< phase (u8), ok (u8), duration ms (u32)
+        HEAP = 3,        ///< free heap (u32), largest free block (u32), fragmentation % (u8)
+        NET_RESULT = 4,  ///< endpoint (u8), HTTP code (i16), bytes (u32), duration ms (u32)
+        DROPPED = 5      ///< number of frames dropped because the buffer was full (u16)
+    };
+
+    /**
+     * @brief Phases of loading a timeline, for LOAD_PHASE events.
+     */
+    enum Phase : uint8_t { PHASE_AUTH = 1, PHASE_NUMBER = 2, PHASE_DOWNLOAD = 3, PHASE_SAVE = 4, PHASE_DECODE = 5 };
+
+    /**
+     * @brief Server endpoints, for NET_RESULT events.
+     */
+    enum Endpoint : uint8_t { ENDPOINT_LOGIN = 1, ENDPOINT_NUMBER = 2, ENDPOINT_TIMELINE = 3 };
+
+    Telemetry(); // Constructor declaration
+    void begin();
+    bool isEnabled();
+    void cueFired(uint16_t index, uint8_t colour, long lateness);
+    void loadPhase(Phase phase, bool ok, uint32_t duration);
+    void heap();
+    void netResult(Endpoint endpoint, int httpCode, uint32_t bytes, uint32_t duration);
+    void flush();
+
+private:
+    void emit(Event event, const uint8_t *payload, uint8_t len);
+    void put(uint8_t value);
+    uint16_t used();
+    static uint8_t crc8(uint8_t crc, uint8_t value);
+
+    /**
+     * @brief First byte of every frame. Never appears in the text log, which is ASCII.
+     */
+    static const uint8_t frameSync = 0xA5;
+
+    /**
+     * @brief Bytes in a frame around the payload: sync, event, length, 4 byte timestamp, CRC-8.
+     */
+    static const uint8_t frameOverhead = 8;
+
+    /**
+     * @brief Size of the frame buffer, a power of two.
+     */
+    static const uint16_t bufferSize = 256;
+
+    /**
+     * @brief Frames waiting to be sent.
+     */
+    uint8_t buffer[bufferSize];
+
+    /**
+     * @brief Index where the next byte is added.
+     */
+    uint16_t head = 0;
+
+    /**
+     * @brief Index of the next byte to send, always the start of a frame.
+     */
+    uint16_t tail = 0;
+
+    /**
+     * @brief Frames dropped since the last DROPPED event.
+     */
+    uint16_t dropped = 0;
+
+    /**
+     * @brief Flag indicating whether telemetry is switched on.
+     */
+    bool enabled = false;
+};
+
+/**
+ * @brief The telemetry stream, shared by all classes like Serial.
+ */
+extern Telemetry telemetry;
+
+#endif
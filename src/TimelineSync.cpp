@@ -0,0 +1,606 @@
+/**
+ * @file TimelineSync.cpp
+ * @brief Implementation of the TimelineSync class.
+ *
+ * Shares one download between a troupe of poi on the same LAN. The leader (a poi with SYNC_LEADER
+ * in secrets.h, or tools/sync_leader.py on a laptop) fetches the timeline from the server as usual
+ * and broadcasts the timeline file over UDP; followers (SYNC_FOLLOWER) never log in to the server.
+ *
+ * The leader broadcasts an OFFER with the checksum and size of its timeline file, followed by the
+ * file in chunks, and offers it again every offerInterval. A follower that doesn't have that file
+ * collects the chunks, and when it stops getting them sends a NAK with a bitmap of the ones still
+ * missing. The leader merges the NAKs of all followers and broadcasts each missing chunk once, so
+ * the time to update the troupe hardly grows with its size. A follower with the whole file checks
+ * it against the checksum, saves it, loads it (see Playing::setup()) and confirms with an ACK.
+ *
+ * START and STOP commands are broadcast a few times with a sequence number; a START is scheduled
+ * startDelay ms ahead, so every poi (the leader included) starts at the same moment.
+ */
+
+
+#include "TimelineSync.h"
+#include <Arduino.h>
+#include <coredecls.h>
+#include <Metrics.h>
+
+/**
+ * @brief Body of an OFFER packet.
+ */
+struct OfferBody {
+    uint32_t size;
+    uint16_t chunkCount;
+    uint16_t chunkSize;
+} __attribute__((packed));
+
+/**
+ * @brief Body of a CHUNK packet, followed by the data.
+ */
+struct ChunkBody {
+    uint16_t index;
+    uint16_t length;
+} __attribute__((packed));
+
+/**
+ * @brief Body of a START packet. A STOP packet only has the sequence number.
+ */
+struct StartBody {
+    uint16_t seq;
+    uint16_t delay;
+} __attribute__((packed));
+
+/**
+ * @brief Constructor for TimelineSync class.
+ *
+ * @param playing The Playing object to load received timelines into, and to start and stop.
+ * @param leader true for the poi that fetches and distributes the timeline, false for a follower.
+ * @param port UDP port of the troupe.
+ */
+TimelineSync::TimelineSync(Playing &playing, bool leader, uint16_t port) : playing(playing), leader(leader), port(port)
+{
+}
+
+
+/**
+ * @brief Starts listening, and works out the checksum of the timeline file this poi already has.
+ *
+ * Call this once from setup().
+ */
+void TimelineSync::begin()
+{
+    udp.begin(port);
+    commandSeq = ESP.random(); // so followers don't take the first command after a leader restart for a repeat
+    if (!leader)
+    {
+        String saved = storage.load(playing.getTimelineFilePath());
+        hash = saved.isEmpty() ? 0 : crc32(saved.c_str(), saved.length());
+    }
+    Serial.print(leader ? "Sync leader" : "Sync follower");
+    Serial.print(" on UDP port ");
+    Serial.println(port);
+}
+
+
+/**
+ * @brief Handles incoming packets, sends what is due, and starts playing when a start is due.
+ *
+ * Call this from loop(); it never waits.
+ */
+void TimelineSync::poll()
+{
+    int size;
+    while ((size = udp.parsePacket()) > 0)
+    {
+        handlePacket(size);
+    }
+
+    unsigned long now = millis();
+    if (leader && chunkCount > 0)
+    {
+        if (now - lastOffer >= offerInterval) // before any chunks, so followers know what they are
+        {
+            OfferBody body = {data.length(), chunkCount, chunkSize};
+            sendPacket(WiFi.broadcastIP(), OFFER, hash, &body, sizeof(body));
+            lastOffer = now;
+        }
+        for (int i = 0; i < chunksPerPoll && sendMask != 0; i++)
+        {
+            uint16_t index = __builtin_ctz(sendMask);
+            sendMask &= ~(1UL << index);
+            sendChunk(index);
+        }
+    }
+
+    if (leader && repeatsLeft > 0 && now - lastRepeat >= startRepeatInterval)
+    {
+        if (command == START)
+        {
+            StartBody body = {commandSeq, (uint16_t)(startPending && startAt > now ? startAt - now : 0)};
+            sendPacket(WiFi.broadcastIP(), START, hash, &body, sizeof(body));
+        }
+        else
+        {
+            sendPacket(WiFi.broadcastIP(), STOP, hash, &commandSeq, sizeof(commandSeq));
+        }
+        repeatsLeft--;
+        lastRepeat = now;
+    }
+
+    if (receiveBuffer && now - lastActivity >= nakWait)
+    {
+        sendNak();
+    }
+    else if (!receiveBuffer && requestsLeft > 0 && now - lastRequest >= requestInterval)
+    {
+        sendRequest(); // the REQUEST or the OFFER in answer was lost
+    }
+
+    if (startPending && (long)(now - startAt) >= 0)
+    {
+        startPending = false;
+        playing.start();
+    }
+}
+
+
+/**
+ * @brief Offers the saved timeline file to the followers. Leader only.
+ *
+ * Call this after a timeline has been fetched. If the file is new, it is broadcast straight away
+ * and the list of followers that confirmed it starts again.
+ *
+ * @return true if there is a timeline to offer, false if there is none or it is too big.
+ */
+bool TimelineSync::offer()
+{
+    if (!leader)
+    {
+        return false;
+    }
+    data = storage.load(playing.getTimelineFilePath());
+    if (data.isEmpty() || data.length() > (uint32_t)maxChunks * chunkSize)
+    {
+        Serial.println(data.isEmpty() ? "No timeline to offer" : "Timeline too big to offer");
+        data = "";
+        chunkCount = 0;
+        return false;
+    }
+
+    uint32_t newHash = crc32(data.c_str(), data.length());
+    chunkCount = (data.length() + chunkSize - 1) / chunkSize;
+    if (newHash != hash)
+    {
+        hash = newHash;
+        followerCount = 0;
+        sendMask = allChunks(chunkCount);
+        Serial.print("Offering timeline to followers: ");
+        Serial.print(data.length());
+        Serial.print(" bytes in ");
+        Serial.print(chunkCount);
+        Serial.println(" chunks");
+    }
+    lastOffer = millis() - offerInterval; // offer it in the next poll()
+    return true;
+}
+
+
+/**
+ * @brief Asks the leader to offer its timeline. Follower only.
+ *
+ * Used instead of fetching from the server, e.g. when the update button is pressed. The request
+ * is repeated up to maxRequests times until an OFFER comes.
+ */
+void TimelineSync::requestTimeline()
+{
+    if (leader)
+    {
+        return;
+    }
+    bool idle = requestsLeft == 0;
+    requestsLeft = maxRequests;
+    if (idle || millis() - lastRequest >= requestInterval)
+    {
+        sendRequest();
+    }
+}
+
+
+/**
+ * @brief Broadcasts a REQUEST, one of those requestTimeline() asked for.
+ */
+void TimelineSync::sendRequest()
+{
+    lastRequest = millis();
+    requestsLeft--;
+    sendPacket(WiFi.broadcastIP(), REQUEST, hash);
+}
+
+
+/**
+ * @brief Starts every poi in the troupe from the beginning, startDelay ms from now. Leader only.
+ */
+void TimelineSync::sendStart()
+{
+    commandSeq++;
+    command = START;
+    repeatsLeft = startRepeats;
+    lastRepeat = millis() - startRepeatInterval;
+    startAt = millis() + startDelay;
+    startPending = true;
+}
+
+
+/**
+ * @brief Stops every poi in the troupe, this one straight away. Leader only.
+ */
+void TimelineSync::sendStop()
+{
+    commandSeq++;
+    command = STOP;
+    repeatsLeft = startRepeats;
+    lastRepeat = millis() - startRepeatInterval;
+    startPending = false;
+    playing.stop();
+}
+
+
+/**
+ * @brief Prints the state of the sync: the timeline offered and who confirmed it, or the transfer in progress.
+ */
+void TimelineSync::printStatus()
+{
+    Serial.print(leader ? "Sync leader, timeline " : "Sync follower, timeline ");
+    Serial.println(hash, HEX);
+    if (leader)
+    {
+        Serial.print("confirmed by ");
+        Serial.print(followerCount);
+        Serial.println(" followers:");
+        for (int i = 0; i < followerCount; i++)
+        {
+            Serial.print("  ");
+            Serial.println(followers[i].toString());
+        }
+    }
+    else if (receiveBuffer)
+    {
+        Serial.print("receiving ");
+        Serial.print(receiveHash, HEX);
+        Serial.print(": ");
+        Serial.print(__builtin_popcount(receivedMask));
+        Serial.print(" of ");
+        Serial.print(receiveChunks);
+        Serial.println(" chunks");
+    }
+}
+
+
+/**
+ * @brief Handles one incoming packet.
+ *
+ * @param size Size of the packet.
+ */
+void TimelineSync::handlePacket(int size)
+{
+    int len = udp.read(packet, sizeof(packet));
+    Header header;
+    if (len < (int)sizeof(header) || len < size)
+    {
+        return; // too short, or too long for any packet
+    }
+    memcpy(&header, packet, sizeof(header));
+    if (header.magic != packetMagic || header.version != packetVersion)
+    {
+        return;
+    }
+    const uint8_t *body = packet + sizeof(header);
+    len -= sizeof(header);
+
+    if (leader)
+    {
+        uint32_t mask;
+        switch (header.type)
+        {
+        case NAK:
+            if (header.hash == hash && len >= (int)sizeof(mask))
+            {
+                memcpy(&mask, body, sizeof(mask));
+                sendMask |= mask & allChunks(chunkCount);
+            }
+            break;
+        case ACK:
+            if (header.hash == hash)
+            {
+                confirm(udp.remoteIP());
+            }
+            break;
+        case REQUEST:
+            if (header.hash == hash && hash != 0)
+            {
+                confirm(udp.remoteIP());
+            }
+            else
+            {
+                lastOffer = millis() - offerInterval; // offer it in this poll()
+            }
+            break;
+        }
+        return;
+    }
+
+    StartBody start;
+    switch (header.type)
+    {
+    case OFFER:
+        leaderAddress = udp.remoteIP();
+        requestsLeft = 0;
+        handleOffer(header.hash, body, len);
+        break;
+    case CHUNK:
+        if (receiveBuffer && header.hash == receiveHash)
+        {
+            handleChunk(body, len);
+        }
+        else if (header.hash != hash)
+        {
+            requestTimeline(); // missed the offer
+        }
+        break;
+    case START:
+    case STOP:
+        if (len < (int)sizeof(start.seq))
+        {
+            break;
+        }
+        memcpy(&start, body, min(len, (int)sizeof(start)));
+        if (seqSeen && start.seq == lastSeq)
+        {
+            break; // a repeat
+        }
+        seqSeen = true;
+        lastSeq = start.seq;
+        if (header.type == STOP)
+        {
+            startPending = false;
+            playing.stop();
+        }
+        else
+        {
+            startAt = millis() + (len >= (int)sizeof(start) ? start.delay : 0);
+            startPending = true;
+        }
+        break;
+    }
+}
+
+
+/**
+ * @brief Handles an OFFER from the leader. Follower only.
+ *
+ * Confirms a timeline this poi already has, and starts receiving one it hasn't got.
+ *
+ * @param offeredHash Checksum of the offered timeline.
+ * @param body The packet after the header.
+ * @param len Length of body.
+ */
+void TimelineSync::handleOffer(uint32_t offeredHash, const uint8_t *body, int len)
+{
+    OfferBody offer;
+    if (len < (int)sizeof(offer))
+    {
+        return;
+    }
+    memcpy(&offer, body, sizeof(offer));
+
+    if (offeredHash == hash)
+    {
+        sendPacket(leaderAddress, ACK, hash);
+        return;
+    }
+    if (receiveBuffer && offeredHash == receiveHash)
+    {
+        return; // already receiving it
+    }
+    if (offer.size == 0 || offer.chunkSize != chunkSize || offer.chunkCount > maxChunks ||
+        offer.chunkCount != (offer.size + chunkSize - 1) / chunkSize)
+    {
+        Serial.println("Sync: can't take the offered timeline");
+        return;
+    }
+
+    abortReceive();
+    receiveBuffer = (uint8_t *)malloc(offer.size);
+    if (!receiveBuffer)
+    {
+        Serial.println("Sync: not enough memory for the offered timeline");
+        return;
+    }
+    receiveHash = offeredHash;
+    receiveSize = offer.size;
+    receiveChunks = offer.chunkCount;
+    receivedMask = 0;
+    receiveStartTime = lastActivity = millis();
+    nakWait = nakDelay + random(nakJitter);
+    naks = 0;
+    totalNaks = 0;
+    Serial.print("Sync: receiving timeline, ");
+    Serial.print(receiveSize);
+    Serial.println(" bytes");
+}
+
+
+/**
+ * @brief Handles a CHUNK of the timeline being received. Follower only.
+ *
+ * @param body The packet after the header.
+ * @param len Length of body.
+ */
+void TimelineSync::handleChunk(const uint8_t *body, int len)
+{
+    ChunkBody chunk;
+    if (len < (int)sizeof(chunk))
+    {
+        return;
+    }
+    memcpy(&chunk, body, sizeof(chunk));
+    uint32_t offset = (uint32_t)chunk.index * chunkSize;
+    uint32_t expected = min((uint32_t)chunkSize, receiveSize - offset);
+    if (chunk.index >= receiveChunks || chunk.length != expected || len < (int)(sizeof(chunk) + expected))
+    {
+        return;
+    }
+
+    memcpy(receiveBuffer + offset, body + sizeof(chunk), expected);
+    receivedMask |= 1UL << chunk.index;
+    lastActivity = millis();
+    naks = 0;
+    if (receivedMask == allChunks(receiveChunks))
+    {
+        finishReceive();
+    }
+}
+
+
+/**
+ * @brief Checks, loads and saves a completely received timeline, and confirms it to the leader.
+ *
+ * It is only saved once it has loaded, so a timeline that doesn't leaves the saved one alone.
+ */
+void TimelineSync::finishReceive()
+{
+    if (crc32(receiveBuffer, receiveSize) != receiveHash)
+    {
+        Serial.println("Sync: received timeline is corrupt, dropping it");
+        abortReceive();
+        return;
+    }
+
+    Serial.print("Sync: received timeline in ");
+    Serial.print(millis() - receiveStartTime);
+    Serial.print(" ms with ");
+    Serial.print(totalNaks);
+    Serial.println(" NAKs");
+
+    String timelineData;
+    bool loaded = timelineData.concat((const char *)receiveBuffer, receiveSize);
+    uint32_t newHash = receiveHash;
+    abortReceive(); // hand the buffer back before decoding
+    loaded = loaded && playing.setup(timelineData);
+    if (loaded && !storage.save(playing.getTimelineFilePath(), timelineData))
+    {
+        Serial.println("Sync: couldn't save the received timeline");
+        loaded = false;
+    }
+    metrics.refreshed(loaded, millis() - receiveStartTime);
+    if (loaded)
+    {
+        hash = newHash;
+        sendPacket(leaderAddress, ACK, hash);
+        sendPacket(leaderAddress, ACK, hash); // once more, otherwise a lost ACK waits for the next OFFER
+    }
+}
+
+
+/**
+ * @brief Drops the timeline being received, if any.
+ */
+void TimelineSync::abortReceive()
+{
+    free(receiveBuffer);
+    receiveBuffer = nullptr;
+}
+
+
+/**
+ * @brief Tells the leader which chunks are still missing, or gives up after maxNaks unanswered NAKs.
+ */
+void TimelineSync::sendNak()
+{
+    if (naks >= maxNaks)
+    {
+        Serial.println("Sync: leader stopped answering, dropping the transfer");
+        abortReceive();
+        return;
+    }
+    uint32_t missing = allChunks(receiveChunks) & ~receivedMask;
+    sendPacket(leaderAddress, NAK, receiveHash, &missing, sizeof(missing));
+    naks++;
+    totalNaks++;
+    lastActivity = millis();
+    nakWait = nakDelay + random(nakJitter);
+}
+
+
+/**
+ * @brief Broadcasts one chunk of the timeline. Leader only.
+ *
+ * @param index Index of the chunk.
+ */
+void TimelineSync::sendChunk(uint16_t index)
+{
+    uint32_t offset = (uint32_t)index * chunkSize;
+    ChunkBody chunk = {index, (uint16_t)min((uint32_t)chunkSize, data.length() - offset)};
+    uint8_t body[sizeof(chunk) + chunkSize];
+    memcpy(body, &chunk, sizeof(chunk));
+    memcpy(body + sizeof(chunk), data.c_str() + offset, chunk.length);
+    sendPacket(WiFi.broadcastIP(), CHUNK, hash, body, sizeof(chunk) + chunk.length);
+}
+
+
+/**
+ * @brief Records a follower that has the current timeline. Leader only.
+ *
+ * @param address IP address of the follower.
+ */
+void TimelineSync::confirm(IPAddress address)
+{
+    for (int i = 0; i < followerCount; i++)
+    {
+        if (followers[i] == address)
+        {
+            return;
+        }
+    }
+    if (followerCount < maxFollowers)
+    {
+        followers[followerCount++] = address;
+    }
+    Serial.print("Sync: ");
+    Serial.print(address.toString());
+    Serial.print(" has the timeline, ");
+    Serial.print(followerCount);
+    Serial.println(" followers confirmed");
+}
+
+
+/**
+ * @brief Sends a packet.
+ *
+ * @param address Where to, a follower, the leader or the broadcast address.
+ * @param type The packet type.
+ * @param hash Checksum of the timeline the packet is about.
+ * @param body The rest of the packet, or nullptr.
+ * @param len Length of body.
+ */
+void TimelineSync::sendPacket(IPAddress address, Type type, uint32_t hash, const void *body, size_t len)
+{
+    Header header = {packetMagic, packetVersion, type, 0, hash};
+    udp.beginPacket(address, port);
+    udp.write((const uint8_t *)&header, sizeof(header));
+    if (len > 0)
+    {
+        udp.write((const uint8_t *)body, len);
+    }
+    udp.endPacket();
+}
+
+
+/**
+ * @brief Returns the bitmap with a bit for each chunk.
+ *
+ * @param count Number of chunks, up to maxChunks.
+ * @return Bits 0 to count - 1 set.
+ */
+uint32_t TimelineSync::allChunks(uint16_t count)
+{
+    return count >= 32 ? 0xffffffffUL : (1UL << count) - 1;
+}
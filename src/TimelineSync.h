@@ -0,0 +1,260 @@
+#ifndef TIMELINESYNC_H
+#define TIMELINESYNC_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <FlashStore.h>
+#include <Playing.h>
+
+/**
+ * @file TimelineSync.h
+ * @brief Declaration of the TimelineSync class.
+ */
+
+class TimelineSync {
+public:
+    /**
+     * @brief Packet types. Keep in step with tools/sync_leader.py.
+     */
+    enum Type : uint8_t {
+        OFFER = 1,   ///< leader: the timeline it has, size (u32), chunk count (u16), chunk size (u16)
+        CHUNK = 2,   ///< leader: one chunk of it, index (u16), length (u16), data
+        NAK = 3,     ///< follower: chunks still missing, bitmap (u32)
+        ACK = 4,     ///< follower: has the whole timeline and its checksum matches
+        START = 5,   ///< leader: start playing from the beginning, sequence (u16), in ms (u16)
+        STOP = 6,    ///< leader: stop playing, sequence (u16)
+        REQUEST = 7  ///< follower: please offer your timeline
+    };
+
+    TimelineSync(Playing &playing, bool leader, uint16_t port); // Constructor declaration
+    void begin();
+    void poll();
+    bool offer();
+    void requestTimeline();
+    void sendStart();
+    void sendStop();
+    void printStatus();
+
+    /**
+     * @brief Default UDP port, if SYNC_PORT isn't set in secrets.h.
+     */
+    static const uint16_t defaultPort = 4210;
+
+private:
+    /**
+     * @brief Start of every packet. Multi-byte fields are little endian.
+     */
+    struct Header {
+        uint8_t magic;
+        uint8_t version;
+        uint8_t type;
+        uint8_t reserved;
+        uint32_t hash; ///< checksum of the timeline file the packet is about
+    } __attribute__((packed));
+
+    void handlePacket(int size);
+    void handleOffer(uint32_t offeredHash, const uint8_t *body, int len);
+    void handleChunk(const uint8_t *body, int len);
+    void sendPacket(IPAddress address, Type type, uint32_t hash, const void *body = nullptr, size_t len = 0);
+    void sendChunk(uint16_t index);
+    void confirm(IPAddress address);
+    void sendNak();
+    void sendRequest();
+    void finishReceive();
+    void abortReceive();
+    uint32_t allChunks(uint16_t count);
+
+    /**
+     * @brief First byte of every packet.
+     */
+    static const uint8_t packetMagic = 0x6d;
+
+    /**
+     * @brief Protocol version, the second byte of every packet.
+     */
+    static const uint8_t packetVersion = 1;
+
+    /**
+     * @brief Largest amount of data in a chunk, small enough for one unfragmented UDP packet.
+     */
+    static const uint16_t chunkSize = 512;
+
+    /**
+     * @brief Largest number of chunks in a timeline, one bit each in a NAK.
+     */
+    static const uint16_t maxChunks = 32;
+
+    /**
+     * @brief Largest number of followers the leader keeps track of.
+     */
+    static const int maxFollowers = 16;
+
+    /**
+     * @brief How often the leader offers its timeline again, in ms, for followers that missed it.
+     */
+    static const unsigned long offerInterval = 5000;
+
+    /**
+     * @brief Most chunks the leader sends in one poll(), so a transfer never stalls playback.
+     */
+    static const int chunksPerPoll = 4;
+
+    /**
+     * @brief How long a follower waits for more chunks before sending a NAK, in ms, plus up to nakJitter.
+     *
+     * The random part spreads the NAKs of the troupe out, and as the leader answers NAKs with
+     * broadcasts, one resent chunk usually covers every follower that missed it.
+     */
+    static const unsigned long nakDelay = 150;
+    static const unsigned long nakJitter = 100;
+
+    /**
+     * @brief NAKs a follower sends without an answer before it gives up on a transfer.
+     */
+    static const int maxNaks = 20;
+
+    /**
+     * @brief Shortest time between REQUESTs from a follower, in ms.
+     */
+    static const unsigned long requestInterval = 1000;
+
+    /**
+     * @brief REQUESTs a follower sends, requestInterval ms apart, until an OFFER comes.
+     */
+    static const int maxRequests = 5;
+
+    /**
+     * @brief How far ahead the leader schedules a start, in ms.
+     *
+     * Long enough for the repeats to get through, including the wait for the next DTIM beacon
+     * of a follower in light sleep.
+     */
+    static const uint16_t startDelay = 500;
+
+    /**
+     * @brief How many times a START or STOP is sent, startRepeatInterval ms apart. Followers ignore repeats.
+     */
+    static const int startRepeats = 5;
+    static const unsigned long startRepeatInterval = 40;
+
+    /**
+     * @brief Playing object that is reloaded with a received timeline, and started and stopped.
+     */
+    Playing &playing;
+
+    /**
+     * @brief Storage the timeline file is read from (leader) or saved to (follower).
+     */
+    TimelineStore storage;
+
+    /**
+     * @brief UDP socket, for broadcasts and replies.
+     */
+    WiFiUDP udp;
+
+    /**
+     * @brief Flag indicating whether this poi is the leader.
+     */
+    bool leader;
+
+    /**
+     * @brief UDP port of the troupe.
+     */
+    uint16_t port;
+
+    /**
+     * @brief Packet being received or built.
+     */
+    uint8_t packet[sizeof(Header) + 4 + chunkSize];
+
+    /**
+     * @brief Checksum of the timeline file this poi has, offered (leader) or received (follower).
+     */
+    uint32_t hash = 0;
+
+    /**
+     * @brief Leader: the timeline file being offered.
+     */
+    String data;
+
+    /**
+     * @brief Leader: number of chunks in data.
+     */
+    uint16_t chunkCount = 0;
+
+    /**
+     * @brief Leader: chunks to broadcast, one bit each. The initial push and the NAKs of every follower are merged here.
+     */
+    uint32_t sendMask = 0;
+
+    /**
+     * @brief Leader: millis() when the timeline was last offered.
+     */
+    unsigned long lastOffer = 0;
+
+    /**
+     * @brief Leader: followers that confirmed the current timeline.
+     */
+    IPAddress followers[maxFollowers];
+    int followerCount = 0;
+
+    /**
+     * @brief Leader: sequence number of the last START or STOP, and the repeats still to send.
+     */
+    uint16_t commandSeq = 0;
+    Type command = START;
+    int repeatsLeft = 0;
+    unsigned long lastRepeat = 0;
+
+    /**
+     * @brief Follower: address of the leader, from its last OFFER.
+     */
+    IPAddress leaderAddress;
+
+    /**
+     * @brief Follower: the timeline being received, or nullptr.
+     */
+    uint8_t *receiveBuffer = nullptr;
+    uint32_t receiveHash = 0;
+    uint32_t receiveSize = 0;
+    uint16_t receiveChunks = 0;
+
+    /**
+     * @brief Follower: chunks received so far, one bit each.
+     */
+    uint32_t receivedMask = 0;
+
+    /**
+     * @brief Follower: millis() when the transfer started, and when a chunk or NAK was last seen or sent.
+     */
+    unsigned long receiveStartTime = 0;
+    unsigned long lastActivity = 0;
+
+    /**
+     * @brief Follower: time to wait before the next NAK, and NAKs sent since the last chunk.
+     */
+    unsigned long nakWait = nakDelay;
+    int naks = 0;
+    int totalNaks = 0;
+
+    /**
+     * @brief Follower: millis() of the last REQUEST, and the REQUESTs still to send if no OFFER comes.
+     */
+    unsigned long lastRequest = 0;
+    int requestsLeft = 0;
+
+    /**
+     * @brief Follower: sequence number of the last START or STOP carried out, and whether one was seen yet.
+     */
+    uint16_t lastSeq = 0;
+    bool seqSeen = false;
+
+    /**
+     * @brief Leader and follower: a start scheduled for startAt (millis()).
+     */
+    bool startPending = false;
+    unsigned long startAt = 0;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ * @file Tracer.cpp
+ * @brief Implementation of the Tracer class.
+ *
+ * Breaks each timeline refresh down into phases, in microseconds: DNS, each server request
+ * (connect and time to first byte, then the body), the LittleFS write and decoding the timeline.
+ * The last keepRefreshes refreshes are kept. render() (the `trace` command) prints them as CSV
+ * headed with the firmware build, so dumps from two builds can be put side by side, e.g. with
+ * tools/trace_compare.py.
+ *
+ * HTTPClient connects inside GET()/POST() and has no hook for it, so connecting is part of the
+ * first byte phase, and so is the DNS lookup. Built with TRACE_DNS, the DNS phase resolves the
+ * server name before each request instead; lwIP caches the answer, so the lookup inside the request
+ * is quick, but it is an extra blocking lookup per request, so it is off by default.
+ */
+
+
+#include "Tracer.h"
+#include <Arduino.h>
+
+#ifndef FIRMWARE_BUILD
+#define FIRMWARE_BUILD __DATE__ " " __TIME__
+#endif
+
+Tracer tracer;
+
+/**
+ * @brief Column names of the phases, indexed by Phase.
+ */
+static const char *const phaseNames[] = {"dns", "login_first_byte", "login_body", "number_first_byte", "number_body",
+                                         "timeline_first_byte", "timeline_body", "save", "decode"};
+
+/**
+ * @brief Starts a span.
+ *
+ * @param phase The phase the span's time is added to.
+ */
+Tracer::Span::Span(Phase phase) : phase(phase), start(micros())
+{
+}
+
+
+/**
+ * @brief Ends a span, adding its time to the phase.
+ */
+Tracer::Span::~Span()
+{
+    tracer.add(phase, micros() - start);
+}
+
+
+/**
+ * @brief Default constructor for Tracer class.
+ */
+Tracer::Tracer()
+{
+}
+
+
+/**
+ * @brief Starts tracing a refresh. Call at the start of a refresh.
+ */
+void Tracer::beginRefresh()
+{
+    Refresh &refresh = refreshes[next];
+    memset(&refresh, 0, sizeof(refresh));
+    refresh.time = millis();
+    refreshStart = micros();
+    tracing = true;
+}
+
+
+/**
+ * @brief Finishes tracing a refresh and keeps it, dropping the oldest one if needed.
+ *
+ * @param ok Whether a timeline was loaded.
+ */
+void Tracer::endRefresh(bool ok)
+{
+    if (!tracing)
+    {
+        return;
+    }
+    tracing = false;
+    refreshes[next].total = micros() - refreshStart;
+    refreshes[next].ok = ok;
+    next = (next + 1) % keepRefreshes;
+    if (count < keepRefreshes)
+    {
+        count++;
+    }
+}
+
+
+/**
+ * @brief Adds time to a phase of the refresh being traced. Phases that happen more than once add up.
+ *
+ * @param phase The phase.
+ * @param micros Time in microseconds.
+ */
+void Tracer::add(Phase phase, uint32_t micros)
+{
+    if (tracing && phase < PHASE_COUNT)
+    {
+        refreshes[next].phases[phase] += micros;
+    }
+}
+
+
+/**
+ * @brief Puts the kept refreshes, oldest first, and the median of each column in CSV.
+ *
+ * The median row only covers the refreshes that loaded a timeline, like tools/trace_compare.py, so
+ * the two agree on the same dump. It is left out if none did.
+ *
+ * @return The trace, headed with the firmware build.
+ */
+String Tracer::render()
+{
+    String out;
+    out.reserve(160 + (count + 1) * 120);
+    out += "# trace build=" FIRMWARE_BUILD "\nrefresh,age_ms,ok,total_us";
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        out += ',';
+        out += phaseNames[p];
+        out += "_us";
+    }
+    out += '\n';
+
+    uint32_t now = millis();
+    for (int i = 0; i < count; i++)
+    {
+        const Refresh &refresh = refreshes[(next - count + i + keepRefreshes) % keepRefreshes];
+        out += i + 1;
+        out += ',';
+        out += now - refresh.time;
+        out += ',';
+        out += refresh.ok ? '1' : '0';
+        out += ',';
+        out += refresh.total;
+        for (int p = 0; p < PHASE_COUNT; p++)
+        {
+            out += ',';
+            out += refresh.phases[p];
+        }
+        out += '\n';
+    }
+
+    int okCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        okCount += refreshes[i].ok;
+    }
+    if (okCount > 0)
+    {
+        uint32_t values[keepRefreshes];
+        out += "median,,,";
+        for (int column = -1; column < PHASE_COUNT; column++)
+        {
+            int n = 0;
+            for (int i = 0; i < count; i++)
+            {
+                const Refresh &refresh = refreshes[i];
+                if (refresh.ok)
+                {
+                    values[n++] = column < 0 ? refresh.total : refresh.phases[column];
+                }
+            }
+            if (column >= 0)
+            {
+                out += ',';
+            }
+            out += median(values, n);
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+
+/**
+ * @brief Works out the median of some values, sorting them.
+ *
+ * @param values The values.
+ * @param count Number of values, at least 1.
+ * @return The median, the mean of the two middle values for an even count (rounded down), like Python's statistics.median.
+ */
+uint32_t Tracer::median(uint32_t *values, int count)
+{
+    for (int i = 1; i < count; i++) // insertion sort, count is at most keepRefreshes
+    {
+        uint32_t value = values[i];
+        int j = i;
+        while (j > 0 && values[j - 1] > value)
+        {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = value;
+    }
+    if (count % 2 == 0)
+    {
+        return ((uint64_t)values[count / 2 - 1] + values[count / 2]) / 2;
+    }
+    return values[count / 2];
+}
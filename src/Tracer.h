@@ -0,0 +1,89 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <Arduino.h>
+
+/**
+ * @file Tracer.h
+ * @brief Declaration of the Tracer class.
+ */
+
+class Tracer {
+public:
+    /**
+     * @brief Phases of a refresh. Keep in step with phaseNames and tools/trace_compare.py.
+     */
+    enum Phase : uint8_t {
+        DNS = 0,              ///< resolving the server name, for every request (TRACE_DNS only, else part of first byte)
+        LOGIN_FIRST_BYTE,     ///< login: connecting, sending and waiting for the response headers
+        LOGIN_BODY,           ///< login: reading and parsing the response
+        NUMBER_FIRST_BYTE,    ///< get-current-timeline-number: connecting, sending and waiting for the headers
+        NUMBER_BODY,          ///< get-current-timeline-number: reading the response
+        TIMELINE_FIRST_BYTE,  ///< load-timeline: connecting, sending and waiting for the headers
+        TIMELINE_BODY,        ///< load-timeline: reading the response
+        SAVE,                 ///< writing the timeline to LittleFS
+        DECODE,               ///< Playing::setup(), parsing the timeline
+        PHASE_COUNT
+    };
+
+    /**
+     * @brief Adds the time until it goes out of scope to a phase of the refresh being traced.
+     */
+    class Span {
+    public:
+        Span(Phase phase);
+        ~Span();
+
+    private:
+        Phase phase;
+        uint32_t start;
+    };
+
+    Tracer(); // Constructor declaration
+    void beginRefresh();
+    void endRefresh(bool ok);
+    void add(Phase phase, uint32_t micros);
+    String render();
+
+private:
+    /**
+     * @brief One refresh, with the time spent in each phase.
+     */
+    struct Refresh {
+        uint32_t time;                    ///< millis() at the start
+        uint32_t total;                   ///< microseconds from beginRefresh() to endRefresh()
+        uint32_t phases[PHASE_COUNT];     ///< microseconds in each phase, 0 if it didn't happen
+        bool ok;
+    };
+
+    static uint32_t median(uint32_t *values, int count);
+
+    /**
+     * @brief Number of refreshes kept.
+     */
+    static const int keepRefreshes = 8;
+
+    /**
+     * @brief The last refreshes, oldest overwritten first. next is where the next one goes.
+     */
+    Refresh refreshes[keepRefreshes];
+    int next = 0;
+    int count = 0;
+
+    /**
+     * @brief Whether a refresh is being traced. Spans outside a refresh are ignored.
+     */
+    bool tracing = false;
+
+    /**
+     * @brief micros() when the refresh being traced started.
+     */
+    uint32_t refreshStart = 0;
+};
+
+/**
+ * @brief The refresh tracer, shared by all classes like the profiler.
+ */
+extern Tracer tracer;
+
+#endif
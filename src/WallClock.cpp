@@ -0,0 +1,177 @@
+/**
+ * @file WallClock.cpp
+ * @brief Implementation of the WallClock class.
+ *
+ * Wall-clock time in UTC, set over SNTP once WiFi is connected (lwIP keeps it up to date
+ * every hour after that). Times are Unix time in milliseconds, so a show can be scheduled to
+ * start at the same moment on every poi (see Playing) with no link between them during the show.
+ * The NTP server is set in secrets.h (NTP_SERVER), so a local one can stand in without internet.
+ */
+
+
+#include "WallClock.h"
+#include <Arduino.h>
+#include <time.h>
+#include <sys/time.h>
+#include <coredecls.h>
+
+WallClock wallClock;
+
+/**
+ * @brief Constructor for WallClock class.
+ */
+WallClock::WallClock()
+{
+}
+
+
+/**
+ * @brief Starts syncing the time over SNTP. It is set once WiFi is connected.
+ *
+ * @param server Host name or IP address of the NTP server.
+ */
+void WallClock::begin(const char *server)
+{
+    this->server = server;
+    settimeofday_cb([this]() { synced(); });
+    configTime(0, 0, server); // UTC, schedules are in UTC
+}
+
+
+/**
+ * @brief Records that SNTP set the time. Called by lwIP.
+ */
+void WallClock::synced()
+{
+    syncedOnce = true;
+    lastSync = millis();
+    syncs++;
+}
+
+
+/**
+ * @brief Checks whether the time has been set since boot.
+ *
+ * @return true once SNTP has answered.
+ */
+bool WallClock::isSynced()
+{
+    return syncedOnce;
+}
+
+
+/**
+ * @brief Returns the wall-clock time.
+ *
+ * @return Unix time in milliseconds (UTC), meaningless until isSynced().
+ */
+uint64_t WallClock::now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/**
+ * @brief Works out how long until a wall-clock time.
+ *
+ * @param time Unix time in milliseconds.
+ * @return Milliseconds until then, negative if it has passed (limited to about +-24 days).
+ */
+long WallClock::msUntil(uint64_t time)
+{
+    int64_t until = (int64_t)(time - now());
+    return (long)constrain(until, (int64_t)-0x7fffffff, (int64_t)0x7fffffff);
+}
+
+
+/**
+ * @brief Prints the time and when it was last synced.
+ */
+void WallClock::printStatus()
+{
+    Serial.print("Clock (NTP server ");
+    Serial.print(server);
+    Serial.print("): ");
+    if (!syncedOnce)
+    {
+        Serial.println("not synced yet");
+        return;
+    }
+    print(now());
+    Serial.print(" UTC, synced ");
+    Serial.print(syncs);
+    Serial.print(" times, last ");
+    Serial.print((millis() - lastSync) / 1000);
+    Serial.println(" s ago");
+}
+
+
+/**
+ * @brief Reads a time as Unix milliseconds, or as UTC "YYYY-MM-DDTHH:MM:SS[.mmm]Z" (the Z is optional).
+ *
+ * @param text The time.
+ * @return Unix time in milliseconds, or 0 if it isn't a time.
+ */
+uint64_t WallClock::parse(const char *text)
+{
+    int year, month, day, hour, minute, second, length = 0;
+    if (sscanf(text, "%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &month, &day, &hour, &minute, &second, &length) != 6)
+    {
+        char *end;
+        uint64_t time = strtoull(text, &end, 10);
+        return *end == '\0' ? time : 0;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+    {
+        return 0;
+    }
+
+    long ms = 0;
+    const char *rest = text + length;
+    if (*rest == '.')
+    {
+        // milliseconds, from however many digits are given
+        long scale = 100;
+        while (isdigit((unsigned char)*++rest))
+        {
+            ms += (*rest - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (*rest == 'Z')
+    {
+        rest++;
+    }
+    if (*rest != '\0')
+    {
+        return 0;
+    }
+
+    // days since 1970-01-01 in the proleptic Gregorian calendar
+    int y = year - (month <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yearOfEra = y - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    int64_t days = (int64_t)era * 146097 + dayOfEra - 719468;
+    return (uint64_t)(((days * 24 + hour) * 60 + minute) * 60 + second) * 1000 + ms;
+}
+
+
+/**
+ * @brief Prints a time as UTC "YYYY-MM-DD HH:MM:SS.mmm".
+ *
+ * @param time Unix time in milliseconds.
+ */
+void WallClock::print(uint64_t time)
+{
+    time_t seconds = time / 1000;
+    struct tm parts;
+    gmtime_r(&seconds, &parts);
+    char text[32];
+    snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d.%03d", parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday,
+             parts.tm_hour, parts.tm_min, parts.tm_sec, (int)(time % 1000));
+    Serial.print(text);
+}
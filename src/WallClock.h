@@ -0,0 +1,51 @@
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include <Arduino.h>
+
+/**
+ * @file WallClock.h
+ * @brief Declaration of the WallClock class.
+ */
+
+class WallClock {
+public:
+    WallClock(); // Constructor declaration
+    void begin(const char *server);
+    bool isSynced();
+    uint64_t now();
+    long msUntil(uint64_t time);
+    void printStatus();
+    static uint64_t parse(const char *text);
+    static void print(uint64_t time);
+
+private:
+    void synced();
+
+    /**
+     * @brief Whether the time has been set by SNTP since boot.
+     */
+    volatile bool syncedOnce = false;
+
+    /**
+     * @brief millis() when SNTP last set the time.
+     */
+    volatile unsigned long lastSync = 0;
+
+    /**
+     * @brief Number of times SNTP has set the time.
+     */
+    volatile uint32_t syncs = 0;
+
+    /**
+     * @brief The NTP server, for printStatus().
+     */
+    const char *server = "";
+};
+
+/**
+ * @brief The wall clock, shared like Serial.
+ */
+extern WallClock wallClock;
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/**
+ * @file Arduino.h
+ * @brief Just enough of the Arduino core to build parts of the firmware on the host, for the tests
+ * (the native environment in platformio.ini). Serial output is dropped.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+using std::max;
+using std::min;
+
+class String
+{
+public:
+    String(const char *text = "") : text(text) {}
+    const char *c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.size(); }
+    bool isEmpty() const { return text.empty(); }
+    bool reserve(unsigned int size) { text.reserve(size); return true; }
+    bool concat(const char *data, unsigned int len) { text.append(data, len); return true; }
+    bool operator==(const String &other) const { return text == other.text; }
+
+private:
+    std::string text;
+};
+
+class HostSerial
+{
+public:
+    template <typename T> void print(const T &, int = 0) {}
+    template <typename T> void println(const T &, int = 0) {}
+    void println() {}
+};
+
+inline HostSerial Serial;
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HOST_FIRMWARESTUBS_H
+#define HOST_FIRMWARESTUBS_H
+
+/**
+ * @file FirmwareStubs.h
+ * @brief The rest of the firmware that the parts of src/ built for the host use, doing nothing.
+ *
+ * The native environment only builds the files that have tests. Include this in one file of each test.
+ */
+
+#include <Storage.h>
+#include <LoopProfiler.h>
+#include <Metrics.h>
+
+Storage::Storage() {}
+String Storage::load(const String &path) { return ""; }
+LoopProfiler::Scope::Scope(Section section) {}
+LoopProfiler::Scope::~Scope() {}
+Metrics::Metrics() {}
+void Metrics::flashWrite(uint32_t bytes) {}
+void Metrics::fileSaved(bool ok) {}
+Metrics metrics;
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+/**
+ * @file LittleFS.h
+ * @brief Stand-in for LittleFS on the host, for the declarations that include it. Nothing is stored.
+ */
+
+class File
+{
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef HOST_COREDECLS_H
+#define HOST_COREDECLS_H
+
+/**
+ * @file coredecls.h
+ * @brief crc32() of the ESP8266 core, on the host: CRC-32 bit by bit, most significant bit first, no final xor.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+inline uint32_t crc32(const void *data, size_t length, uint32_t crc = 0xffffffff)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length--)
+    {
+        uint8_t c = *bytes++;
+        for (uint32_t i = 0x80; i > 0; i >>= 1)
+        {
+            bool bit = crc & 0x80000000;
+            if (c & i)
+            {
+                bit = !bit;
+            }
+            crc <<= 1;
+            if (bit)
+            {
+                crc ^= 0x04c11db7;
+            }
+        }
+    }
+    return crc;
+}
+
+#endif
@@ -0,0 +1,143 @@
+/**
+ * @file test_checkpoint.cpp
+ * @brief Host tests of PlaybackCheckpoint: which checkpoints are resumed from after a reset.
+ *
+ * Run with `pio test -e native`. RTC memory is an array on the host (see PlaybackCheckpoint::hostMemory()),
+ * which keeps its contents over a simulated reset like the real one does, and can be scribbled on.
+ */
+
+#include <unity.h>
+#include <PlaybackCheckpoint.h>
+#include <RtcLayout.h>
+#include <FirmwareStubs.h>
+
+static const uint32_t timelineId = 0x1234abcd;
+static const long loopLength = 60000;
+static const uint32_t rateOne = 65536; // as in Playing.h
+static const uint32_t minRate = rateOne / 4;
+static const uint32_t maxRate = rateOne * 4;
+
+static long position;
+static uint32_t rate;
+
+/**
+ * @brief Loads the checkpoint as Playing does after a reset, for the test timeline.
+ */
+static bool resume(uint32_t id = timelineId)
+{
+    position = -1;
+    rate = 0;
+    return PlaybackCheckpoint::load(id, loopLength, minRate, maxRate, position, rate);
+}
+
+void setUp()
+{
+    memset(PlaybackCheckpoint::hostMemory(), 0, 128 * 4);
+}
+
+void tearDown()
+{
+}
+
+void test_resumes_where_it_was()
+{
+    PlaybackCheckpoint::save(timelineId, 12345, rateOne * 3 / 2);
+    TEST_ASSERT_TRUE(resume());
+    TEST_ASSERT_EQUAL(12345, position);
+    TEST_ASSERT_EQUAL(rateOne * 3 / 2, rate);
+}
+
+void test_latest_save_wins()
+{
+    PlaybackCheckpoint::save(timelineId, 100, rateOne);
+    PlaybackCheckpoint::save(timelineId, 200, rateOne / 2);
+    TEST_ASSERT_TRUE(resume());
+    TEST_ASSERT_EQUAL(200, position);
+    TEST_ASSERT_EQUAL(rateOne / 2, rate);
+}
+
+void test_crc_mismatch()
+{
+    PlaybackCheckpoint::save(timelineId, 12345, rateOne);
+    for (int bit = 0; bit < 128; bit++) // any one bit flipped, in the checksum or the rest
+    {
+        uint32_t *block = &PlaybackCheckpoint::hostMemory()[RTC_PLAYBACK_BLOCK + bit / 32];
+        *block ^= 1UL << (bit % 32);
+        TEST_ASSERT_FALSE(resume());
+        TEST_ASSERT_EQUAL(-1, position); // left alone
+        TEST_ASSERT_EQUAL(0, rate);
+        *block ^= 1UL << (bit % 32);
+    }
+    TEST_ASSERT_TRUE(resume());
+}
+
+void test_power_cycle()
+{
+    // after a power cycle RTC memory holds anything, e.g. all zeros or all ones
+    TEST_ASSERT_FALSE(resume());
+    memset(PlaybackCheckpoint::hostMemory(), 0xff, 128 * 4);
+    TEST_ASSERT_FALSE(resume());
+}
+
+void test_different_timeline()
+{
+    PlaybackCheckpoint::save(timelineId, 12345, rateOne);
+    TEST_ASSERT_FALSE(resume(timelineId + 1));
+    TEST_ASSERT_TRUE(resume(timelineId));
+}
+
+void test_position_outside_the_loop()
+{
+    PlaybackCheckpoint::save(timelineId, loopLength, rateOne);
+    TEST_ASSERT_FALSE(resume());
+    PlaybackCheckpoint::save(timelineId, loopLength + 5000, rateOne);
+    TEST_ASSERT_FALSE(resume());
+    PlaybackCheckpoint::save(timelineId, -1, rateOne);
+    TEST_ASSERT_FALSE(resume());
+    PlaybackCheckpoint::save(timelineId, loopLength - 1, rateOne);
+    TEST_ASSERT_TRUE(resume());
+    PlaybackCheckpoint::save(timelineId, 0, rateOne);
+    TEST_ASSERT_TRUE(resume());
+}
+
+void test_rate_out_of_range()
+{
+    PlaybackCheckpoint::save(timelineId, 12345, minRate - 1);
+    TEST_ASSERT_FALSE(resume());
+    PlaybackCheckpoint::save(timelineId, 12345, maxRate + 1);
+    TEST_ASSERT_FALSE(resume());
+    PlaybackCheckpoint::save(timelineId, 12345, 0);
+    TEST_ASSERT_FALSE(resume());
+    PlaybackCheckpoint::save(timelineId, 12345, minRate);
+    TEST_ASSERT_TRUE(resume());
+    PlaybackCheckpoint::save(timelineId, 12345, maxRate);
+    TEST_ASSERT_TRUE(resume());
+}
+
+void test_other_rtc_blocks_are_left_alone()
+{
+    uint32_t *memory = PlaybackCheckpoint::hostMemory();
+    memset(memory, 0x5a, 128 * 4);
+    PlaybackCheckpoint::save(timelineId, 12345, rateOne);
+    for (int block = 0; block < 128; block++)
+    {
+        if (block < RTC_PLAYBACK_BLOCK || block >= RTC_PLAYBACK_BLOCK + 4)
+        {
+            TEST_ASSERT_EQUAL_UINT32(0x5a5a5a5a, memory[block]);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_resumes_where_it_was);
+    RUN_TEST(test_latest_save_wins);
+    RUN_TEST(test_crc_mismatch);
+    RUN_TEST(test_power_cycle);
+    RUN_TEST(test_different_timeline);
+    RUN_TEST(test_position_outside_the_loop);
+    RUN_TEST(test_rate_out_of_range);
+    RUN_TEST(test_other_rtc_blocks_are_left_alone);
+    return UNITY_END();
+}
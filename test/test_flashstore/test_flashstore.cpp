@@ -0,0 +1,200 @@
+/**
+ * @file test_flashstore.cpp
+ * @brief Host tests of FlashStore: what a reset at any point of a save leaves behind.
+ *
+ * Run with `pio test -e native`. The region is a file (see FlashStore::hostBegin()); a reset is
+ * FlashStore::hostBegin() on the same file, which forgets everything in RAM and scans it again.
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include <functional>
+#include <FlashStore.h>
+#include <FirmwareStubs.h>
+
+static const char *regionFile = "test_flashstore_region.bin";
+static const uint32_t regionSize = 32768; // as reserved by ld/eagle.flash.1m64.timeline.ld
+static const String path = "/timeline0.txt";
+
+/**
+ * @brief A timeline-sized record that is different for each version, about 3 KB, so a bank holds a few.
+ */
+static String timeline(int version)
+{
+    std::string text;
+    while (text.size() < 3000)
+    {
+        text += "{\"" + std::to_string(text.size()) + "\":[" + std::to_string(version) + "]}";
+    }
+    return String(text.c_str());
+}
+
+static void reset()
+{
+    FlashStore::hostBegin(regionFile, regionSize);
+}
+
+/**
+ * @brief Copies the region. Resets first, so everything written is in the file.
+ */
+static std::vector<uint8_t> snapshot()
+{
+    reset();
+    std::vector<uint8_t> region(regionSize);
+    FILE *f = fopen(regionFile, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(regionSize, fread(region.data(), 1, regionSize, f));
+    fclose(f);
+    return region;
+}
+
+/**
+ * @brief Puts a copy of the region back, and resets.
+ */
+static void restore(const std::vector<uint8_t> &region)
+{
+    reset(); // nothing left to write over it
+    FILE *f = fopen(regionFile, "r+b");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(regionSize, fwrite(region.data(), 1, regionSize, f));
+    fclose(f);
+    reset();
+}
+
+/**
+ * @brief Saves a version from a snapshot of the region, with the power cut after every word in turn,
+ * and checks that after a reset the store holds either the old version or the new one, and can still save.
+ *
+ * @param before Run after each reset to the snapshot, before the save, e.g. to fail a save first.
+ * @return The number of words the whole save took.
+ */
+static long cutEveryWord(const std::vector<uint8_t> &region, int oldVersion, int newVersion,
+                         std::function<void()> before = nullptr)
+{
+    FlashStore store;
+    for (long words = 0;; words++)
+    {
+        restore(region);
+        if (before)
+        {
+            before();
+        }
+        FlashStore::hostCutPower(words);
+        bool saved = store.save(path, timeline(newVersion));
+
+        reset();
+        String loaded = store.load(path);
+        TEST_ASSERT_TRUE_MESSAGE(loaded == timeline(saved ? newVersion : oldVersion), "wrong record after a reset");
+        if (saved)
+        {
+            return words;
+        }
+
+        TEST_ASSERT_TRUE(store.save(path, timeline(newVersion + 1)));
+        reset();
+        TEST_ASSERT_TRUE_MESSAGE(store.load(path) == timeline(newVersion + 1), "can't save after a torn record");
+    }
+}
+
+void setUp()
+{
+    remove(regionFile);
+    reset();
+}
+
+void tearDown()
+{
+}
+
+void test_save_and_load()
+{
+    FlashStore store;
+    TEST_ASSERT_TRUE(store.load(path).isEmpty());
+    TEST_ASSERT_TRUE(store.save(path, timeline(1)));
+    TEST_ASSERT_TRUE(store.load(path) == timeline(1));
+    reset();
+    TEST_ASSERT_TRUE(store.load(path) == timeline(1));
+}
+
+void test_latest_record_across_banks()
+{
+    FlashStore store;
+    for (int version = 1; version <= 12; version++) // 12 records of 3 KB go round both 16 KB banks a few times
+    {
+        TEST_ASSERT_TRUE(store.save(path, timeline(version)));
+        reset();
+        TEST_ASSERT_TRUE(store.load(path) == timeline(version));
+    }
+}
+
+void test_unchanged_data_is_not_saved()
+{
+    FlashStore store;
+    TEST_ASSERT_TRUE(store.save(path, timeline(1)));
+    std::vector<uint8_t> region = snapshot();
+    FlashStore::hostCutPower(0); // nothing can be written, and nothing needs to be
+    TEST_ASSERT_TRUE(store.save(path, timeline(1)));
+    reset();
+    TEST_ASSERT_TRUE(region == snapshot());
+}
+
+void test_cut_save_in_the_same_bank()
+{
+    FlashStore store;
+    TEST_ASSERT_TRUE(store.save(path, timeline(1)));
+    long words = cutEveryWord(snapshot(), 1, 2);
+    TEST_ASSERT_GREATER_THAN(750, words); // the header, 3 KB of data and the commit word
+}
+
+void test_cut_save_that_moves_to_the_other_bank()
+{
+    FlashStore store;
+    for (int version = 1; version <= 3; version++) // fills bank 0 up to where a maxRecordSize record doesn't fit
+    {
+        TEST_ASSERT_TRUE(store.save(path, timeline(version)));
+    }
+    cutEveryWord(snapshot(), 3, 4);
+}
+
+void test_torn_record_in_the_new_bank_keeps_the_old_one()
+{
+    // the save moving to bank 1 is cut off after erasing it, at a few points; then the next save, after
+    // a reset or straight away, must not erase bank 0, which holds the only complete record, wherever it
+    // is cut off in turn
+    FlashStore store;
+    for (int version = 1; version <= 3; version++)
+    {
+        TEST_ASSERT_TRUE(store.save(path, timeline(version)));
+    }
+    std::vector<uint8_t> full = snapshot();
+    long sectors = regionSize / 2 / 4096;
+    long beforeCommit = sectors + 3 + (timeline(4).length() + 3) / 4 + 2; // erase, header, data, length and crc
+    for (long words : {sectors, sectors + 3, sectors + 100, beforeCommit})
+    {
+        auto failSave = [&store, words]() {
+            FlashStore::hostCutPower(words);
+            TEST_ASSERT_FALSE(store.save(path, timeline(4)));
+        };
+        cutEveryWord(full, 3, 5, failSave); // no reset in between
+
+        restore(full);
+        failSave();
+        reset();
+        TEST_ASSERT_TRUE(store.load(path) == timeline(3));
+        cutEveryWord(snapshot(), 3, 5);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_save_and_load);
+    RUN_TEST(test_latest_record_across_banks);
+    RUN_TEST(test_unchanged_data_is_not_saved);
+    RUN_TEST(test_cut_save_in_the_same_bank);
+    RUN_TEST(test_cut_save_that_moves_to_the_other_bank);
+    RUN_TEST(test_torn_record_in_the_new_bank_keeps_the_old_one);
+    remove(regionFile);
+    return UNITY_END();
+}
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Embed timelines from timelines/*.json into the firmware as PROGMEM tables.
+
+Runs before every build as a PlatformIO extra script (see platformio.ini), or
+by hand to check the timelines:
+
+    python3 tools/embed_timelines.py
+
+Each file must hold a timeline in the format the server sends: an object of
+"time in ms": [colour, ...] entries, or {"tracks": [{...}, ...]} with one such
+object per track. An optional "palette": ["#rrggbb" or [r, g, b], ...] sets
+the colours the colour numbers index, as for a downloaded timeline. Timelines are validated and normalised the same way
+Playing::processTimelineData() does it (each track sorted by time, duplicate
+times keep the last entry, repeated colours merged), and written to
+include/EmbeddedTimelineData.h in file name order. A malformed timeline stops
+the build.
+"""
+
+import glob
+import json
+import os
+import sys
+
+MAX_EVENT_TIME = 86400000  # same as Playing::maxEventTime
+DEFAULT_CUE_HOLD = 1000  # same as Playing::defaultCueHold
+MAX_TRACKS = 4  # same as Playing::maxTracks
+PALETTE_SIZE = 256  # same as Output::paletteSize
+
+
+class TimelineError(Exception):
+    pass
+
+
+def crc32(data, crc=0xFFFFFFFF):
+    # same as crc32() in the ESP8266 core (coredecls.h): MSB first, no final xor
+    for byte in data:
+        for i in range(7, -1, -1):
+            bit = bool(crc & 0x80000000) != bool(byte & (1 << i))
+            crc = (crc << 1) & 0xFFFFFFFF
+            if bit:
+                crc ^= 0x04C11DB7
+    return crc
+
+
+def load_tracks(path):
+    try:
+        with open(path) as f:
+            pairs = json.load(f, object_pairs_hook=lambda p: p)
+    except ValueError as e:
+        raise TimelineError("not valid JSON: %s" % e)
+    if not isinstance(pairs, list):
+        raise TimelineError("expected an object of \"time\": [colour, ...] entries")
+
+    root = dict(pairs)
+    palette = load_palette(root.get("palette"))
+    track_list = root.get("tracks")
+    if track_list is None:
+        tracks = [track_events(pairs)]
+    else:
+        if not isinstance(track_list, list) or len(track_list) > MAX_TRACKS:
+            raise TimelineError("\"tracks\" should be a list of up to %d tracks" % MAX_TRACKS)
+        tracks = []
+        for i, track in enumerate(track_list):
+            try:
+                tracks.append(track_events(track))
+            except TimelineError as e:
+                raise TimelineError("track %d: %s" % (i, e))
+    if not any(tracks):
+        raise TimelineError("no events")
+    return tracks, palette
+
+
+def load_palette(entries):
+    if entries is None:
+        return None
+    if not isinstance(entries, list) or len(entries) > PALETTE_SIZE:
+        raise TimelineError("\"palette\" should be a list of up to %d colours" % PALETTE_SIZE)
+    palette = []
+    for i, entry in enumerate(entries):
+        if isinstance(entry, str) and len(entry.lstrip("#")) == 6:
+            try:
+                rgb = int(entry.lstrip("#"), 16)
+            except ValueError:
+                rgb = None
+            if rgb is not None:
+                palette.append((rgb >> 16, (rgb >> 8) & 0xFF, rgb & 0xFF))
+                continue
+        elif (isinstance(entry, list) and len(entry) == 3
+              and all(isinstance(c, int) and 0 <= c <= 255 for c in entry)):
+            palette.append(tuple(entry))
+            continue
+        raise TimelineError("palette colour %d should be \"#rrggbb\" or [r, g, b]" % i)
+    return palette
+
+
+def track_events(pairs):
+    if not isinstance(pairs, list) or any(not isinstance(p, tuple) for p in pairs):
+        raise TimelineError("expected an object of \"time\": [colour, ...] entries")
+    events = []
+    for key, value in pairs:
+        if key in ("", "palette", "startAt"):
+            continue  # end marker, or the palette or start time of a flat timeline (embedded shows have no clock)
+        if not key.isdigit():
+            raise TimelineError("time %r is not a whole number of ms" % key)
+        time = int(key)
+        if time > MAX_EVENT_TIME:
+            raise TimelineError("time %d is later than %d ms" % (time, MAX_EVENT_TIME))
+        if not isinstance(value, list) or not value or not isinstance(value[0], int):
+            raise TimelineError("event at %s should be [colour, ...]" % key)
+        colour = value[0]
+        if not 0 <= colour <= 255:
+            raise TimelineError("colour %d at %s is out of range 0-255" % (colour, key))
+        events.append((time, colour))
+    return events
+
+
+def normalise(tracks):
+    normalised = [normalise_track(events) for events in tracks]
+    loop_length = max(length for _, length in normalised)
+    return [cues for cues, _ in normalised], loop_length
+
+
+def normalise_track(events):
+    events = sorted(events, key=lambda e: e[0])  # stable, like the insertion sort on the device
+    cues = []
+    for time, colour in events:
+        if cues and cues[-1][0] == time:
+            cues[-1] = (time, colour)  # duplicate time: last one wins
+            if len(cues) > 1 and cues[-2][1] == colour:
+                cues.pop()
+            continue
+        if cues and cues[-1][1] == colour:
+            continue
+        cues.append((time, colour))
+
+    if len(cues) > 1:
+        loop_length = cues[-1][0] + (cues[-1][0] - cues[-2][0])
+    elif cues:
+        loop_length = cues[0][0] + DEFAULT_CUE_HOLD
+    else:
+        loop_length = 0
+    return cues, loop_length
+
+
+def timeline_id(tracks):
+    # matches Playing's checksum of a downloaded timeline, in the same order: its timings[] (long),
+    # colours[] (uint8_t) and effects[] (uint8_t, all 0 as embedded cues are just colours) arrays, its
+    # effect table (empty), the track sizes and startAt (uint64_t, 0 as embedded timelines don't have one)
+    cues = [cue for track in tracks for cue in track]
+    crc = crc32(b"".join(t.to_bytes(4, "little") for t, _ in cues))
+    crc = crc32(bytes(c for _, c in cues), crc)
+    crc = crc32(bytes(len(cues)), crc)
+    crc = crc32(b"".join(len(track).to_bytes(4, "little") for track in tracks), crc)
+    return crc32(bytes(8), crc)
+
+
+def generate(timelines):
+    lines = [
+        "// Generated by tools/embed_timelines.py from timelines/*.json - do not edit.",
+        "",
+        "#ifndef EMBEDDEDTIMELINEDATA_H",
+        "#define EMBEDDEDTIMELINEDATA_H",
+        "",
+        "#include <EmbeddedTimeline.h>",
+        "",
+        "#define EMBEDDED_TIMELINE_COUNT %d" % len(timelines),
+    ]
+    for i, (name, tracks, palette, _) in enumerate(timelines):
+        cues = [cue for track in tracks for cue in track]
+        lines.append("")
+        lines.append("// %d: %s" % (i, name))
+        lines.append("static constexpr EmbeddedCue embeddedCues%d[%d] PROGMEM = {" % (i, len(cues)))
+        lines.extend("    {%d, %d}," % cue for cue in cues)
+        lines.append("};")
+        lines.append("static constexpr uint32_t embeddedTrackCues%d[%d] PROGMEM = {%s};" % (
+            i, len(tracks), ", ".join(str(len(track)) for track in tracks)))
+        if palette:
+            lines.append("static constexpr uint8_t embeddedPalette%d[%d][3] PROGMEM = {" % (i, len(palette)))
+            lines.extend("    {%d, %d, %d}," % colour for colour in palette)
+            lines.append("};")
+    if timelines:
+        lines.append("")
+        lines.append("static constexpr EmbeddedTimeline embeddedTimelines[EMBEDDED_TIMELINE_COUNT] PROGMEM = {")
+        for i, (_, tracks, palette, loop_length) in enumerate(timelines):
+            palette_fields = "embeddedPalette%d, %d" % (i, len(palette)) if palette else "nullptr, 0"
+            lines.append("    {embeddedCues%d, %d, embeddedTrackCues%d, %d, %s, %d, 0x%08xu}," % (
+                i, sum(len(track) for track in tracks), i, len(tracks), palette_fields, loop_length,
+                timeline_id(tracks)))
+        lines.append("};")
+    lines.append("")
+    lines.append("#endif")
+    return "\n".join(lines) + "\n"
+
+
+def run(project_dir):
+    timelines = []
+    errors = []
+    for path in sorted(glob.glob(os.path.join(project_dir, "timelines", "*.json"))):
+        name = os.path.basename(path)
+        try:
+            tracks, palette = load_tracks(path)
+            tracks, loop_length = normalise(tracks)
+        except TimelineError as e:
+            errors.append("%s: %s" % (name, e))
+            continue
+        timelines.append((name, tracks, palette, loop_length))
+        print("embed_timelines: %d: %s, %d cues in %d tracks, %d ms" % (
+            len(timelines) - 1, name, sum(len(track) for track in tracks), len(tracks), loop_length))
+
+    if errors:
+        for error in errors:
+            print("embed_timelines: error: " + error, file=sys.stderr)
+        return False
+
+    out_path = os.path.join(project_dir, "include", "EmbeddedTimelineData.h")
+    content = generate(timelines)
+    old = None
+    if os.path.exists(out_path):
+        with open(out_path) as f:
+            old = f.read()
+    if content != old:  # only touch the file when it changed, to avoid rebuilds
+        with open(out_path, "w") as f:
+            f.write(content)
+    return True
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO (SCons)
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(0 if run(os.path.dirname(os.path.dirname(os.path.abspath(__file__)))) else 1)
+else:
+    if not run(env["PROJECT_DIR"]):  # noqa: F821
+        env.Exit(1)  # noqa: F821
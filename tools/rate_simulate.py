@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Simulate playback rate changes over a long show, and check the timing.
+
+Runs the playback clock of src/Playing.cpp on the host: the Q16 rate and
+rebase of setRate() and getPosition(), the loop wrap of useTimelineData()
+and the wake up of msUntilNextCue(), with the rate changed at random times
+the way the `rate` command does it (limited to 0.25x..4x, rounded to Q16).
+Each run is checked against exact arithmetic:
+
+    python3 tools/rate_simulate.py timelines/show.json --hours 3 --runs 10
+
+Without a timeline file a 16 cue, 4 second loop is used. For each run it
+shows the largest lateness of a cue (real time from when it is exactly due
+to the millis() tick it is shown at) and how far the position is off at the
+end of the show, both of which have to stay under 1 ms; for comparison, the
+end error of a rebase that keeps whole milliseconds only, as a rate change
+that set the position from getPosition() would; and how far the Q16 rounding
+of the requested rates moves the show, which is not an error of the clock
+but of the rate it was given. Exits with 1 if any run is 1 ms off or more.
+
+Standard library only.
+"""
+
+import argparse
+import os
+import random
+import sys
+from fractions import Fraction
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from embed_timelines import TimelineError, load_tracks, normalise  # noqa: E402
+
+# keep in step with Playing.h
+RATE_ONE = 65536
+MIN_RATE = RATE_ONE // 4
+MAX_RATE = RATE_ONE * 4
+
+
+def q16_rate(multiplier):
+    """The rate the `rate` command sets for a multiplier, see handleCommand() in Main.cpp."""
+    multiplier = min(max(multiplier, Fraction(MIN_RATE, RATE_ONE)), Fraction(MAX_RATE, RATE_ONE))
+    return int(multiplier * RATE_ONE + Fraction(1, 2))
+
+
+def default_timeline():
+    return [(i * 250, i % 8) for i in range(16)], 4000
+
+
+def rate_changes(rng, duration, per_minute):
+    """Random rate changes as (millis, multiplier), with an odd one out of range to be limited."""
+    changes = []
+    t = 0
+    while True:
+        t += max(1, int(rng.expovariate(per_minute / 60000.0)))
+        if t >= duration:
+            return changes
+        if rng.random() < 0.05:
+            multiplier = rng.choice(["0.1", "10", "100000"])
+        else:
+            multiplier = "%.3f" % rng.uniform(0.5, 2.0)
+        changes.append((t, Fraction(multiplier)))
+
+
+def simulate(cues, loop_length, duration, changes):
+    """Plays the show, returns the largest cue lateness and the end errors, in ms."""
+    times = sorted(time for time, _ in cues)
+    rate = RATE_ONE
+    rebase_time = 0
+    rebase = 0          # Q16 ms, as rebasePosition but without the loop wraps, which take off exactly loopLength << 16
+    cue = 0             # cues shown so far, over all passes
+    whole_ms = 0        # the same clock, rebased in whole milliseconds only
+    requested = Fraction(0)  # the show position at the requested, unrounded rates
+    requested_rate = Fraction(1)
+    worst_lateness = Fraction(0)
+
+    for until, multiplier in changes + [(duration, None)]:
+        # show the cues due before the next rate change, each at the millis() tick msUntilNextCue() wakes for
+        while True:
+            passes, index = divmod(cue, len(times))
+            target = (passes * loop_length + times[index]) << 16
+            due = rebase_time + Fraction(target - rebase, rate)
+            if due >= until:
+                break
+            wait = -(-(target - rebase) // rate)  # rounded up, shown at the rate change if it falls in the last ms
+            worst_lateness = max(worst_lateness, rebase_time + wait - due)
+            cue += 1
+
+        # setRate(): bank the time at the old rate, fraction and all, and carry on at the new one
+        elapsed = until - rebase_time
+        requested += elapsed * requested_rate
+        whole_ms += (elapsed * rate) >> 16
+        rebase += elapsed * rate
+        rebase_time = until
+        if multiplier is not None:
+            rate = q16_rate(multiplier)
+            requested_rate = min(max(multiplier, Fraction(MIN_RATE, RATE_ONE)), Fraction(MAX_RATE, RATE_ONE))
+
+    exact = Fraction(rebase, 1 << 16)
+    return {
+        "cues": cue,
+        "loops": (rebase >> 16) // loop_length,
+        "lateness": worst_lateness,
+        "end_error": exact - (rebase >> 16),  # getPosition() truncates, the wraps take off whole loops
+        "whole_ms_error": exact - whole_ms,
+        "rounding": abs(exact - requested),
+    }
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("timeline", nargs="?", help="timeline file, as the server sends it (default: a test loop)")
+    parser.add_argument("--hours", type=float, default=2.0, help="length of the show")
+    parser.add_argument("--changes", type=float, default=6.0, help="rate changes per minute, on average")
+    parser.add_argument("--runs", type=int, default=5, help="number of runs, each with its own rate changes")
+    parser.add_argument("--seed", type=int, default=1, help="random seed")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    if args.timeline:
+        try:
+            tracks, _ = load_tracks(args.timeline)
+            tracks, loop_length = normalise(tracks)
+        except (OSError, TimelineError) as e:
+            print("%s: %s" % (args.timeline, e), file=sys.stderr)
+            return 1
+        cues = [cue for track in tracks for cue in track]
+    else:
+        cues, loop_length = default_timeline()
+    duration = int(args.hours * 3600000)
+    rng = random.Random(args.seed)
+
+    print("%d cues, %d ms loop, %.1f hours, %.1f rate changes a minute" % (
+        len(cues), loop_length, args.hours, args.changes))
+    print("%4s %8s %8s %8s %12s %10s %14s %12s" % (
+        "run", "changes", "loops", "cues", "max late", "end error", "whole ms only", "Q16 rounding"))
+    failed = False
+    for run in range(args.runs):
+        changes = rate_changes(rng, duration, args.changes)
+        result = simulate(cues, loop_length, duration, changes)
+        ok = result["lateness"] < 1 and result["end_error"] < 1
+        failed = failed or not ok
+        print("%4d %8d %8d %8d %9.3f ms %7.3f ms %11.1f ms %9.1f ms%s" % (
+            run + 1, len(changes), result["loops"], result["cues"], result["lateness"], result["end_error"],
+            result["whole_ms_error"], result["rounding"], "" if ok else "  FAILED"))
+    print("all cues within 1 ms, and the end of the show" if not failed else "off by 1 ms or more")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""Soak a poi with thousands of refresh cycles and watch for leaks.
+
+Run tools/standin_server.py (with any faults to inject) and point the poi at
+it in secrets.h, then connect the poi over USB:
+
+    python3 tools/soak.py /dev/ttyUSB0 --cycles 2000 --reset-every 50 --csv soak.csv
+
+Each cycle sends `refresh` on the Serial port and waits for the refresh to
+end, seen as magicpoi_refreshes_total going up in the `metrics` output; a
+refresh that doesn't end within --timeout fails the soak (that is the refresh
+that hangs in the afternoon). With --reset-every the poi is also reset through
+the USB adapter's RTS line every N cycles, so boots are soaked too.
+
+After every refresh the free heap, largest free block, fragmentation and the
+HTTP requests, LittleFS mounts and files in use are sampled. At the end each
+one gets a least-squares trend over the cycles after --warmup, and the soak
+fails if the heap shrinks or anything else grows by more than its allowance
+over the run, or if a resource is still in use between refreshes.
+
+Needs pyserial (pip install pyserial).
+"""
+
+import argparse
+import csv
+import re
+import sys
+import time
+
+METRIC = re.compile(r'^(magicpoi_[a-z_]+)(?:\{resource="([a-z_]+)"\})? (-?\d+)$')
+
+# sample name: (metric, label, direction that is a leak, default allowance over the run)
+WATCHED = {
+    "heap_free": ("magicpoi_heap_free_bytes", None, -1, 1024),
+    "heap_max_block": ("magicpoi_heap_max_block_bytes", None, -1, 2048),
+    "heap_fragmentation": ("magicpoi_heap_fragmentation_percent", None, 1, 10),
+    "http_requests": ("magicpoi_resources_in_use", "http_request", 1, 0),
+    "fs_mounts": ("magicpoi_resources_in_use", "fs_mount", 1, 0),
+    "open_files": ("magicpoi_resources_in_use", "file", 1, 0),
+}
+RESOURCES = ["http_requests", "fs_mounts", "open_files"]
+LAST_LINE = 'magicpoi_resources_in_use_max{resource="file"}'
+
+
+class Poi:
+    """The poi on the end of a serial port."""
+
+    def __init__(self, path, baud, verbose):
+        try:
+            import serial
+        except ImportError:
+            sys.exit("soaking needs pyserial: pip install pyserial")
+        self.port = serial.Serial(path, baud, timeout=0.1)
+        self.verbose = verbose
+
+    def command(self, text):
+        self.port.write((text + "\n").encode())
+
+    def metrics(self, timeout=5.0):
+        """Asks for the metrics and returns them as {(name, label): value}, or None if they didn't come."""
+        self.command("metrics")
+        values = {}
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            line = self.port.readline().decode(errors="replace").strip()
+            match = METRIC.match(line)
+            if match:
+                values[(match.group(1), match.group(2))] = int(match.group(3))
+                if line.startswith(LAST_LINE):
+                    return values
+            elif line and self.verbose:
+                print("  poi: " + line, file=sys.stderr)
+        return None
+
+    def reset(self):
+        self.port.rts = True
+        time.sleep(0.1)
+        self.port.rts = False
+
+
+def trend(values):
+    """Returns the least-squares slope of values against their index."""
+    n = len(values)
+    if n < 2:
+        return 0.0
+    mean_x = (n - 1) / 2
+    mean_y = sum(values) / n
+    num = sum((x - mean_x) * (y - mean_y) for x, y in enumerate(values))
+    den = sum((x - mean_x) ** 2 for x in range(n))
+    return num / den
+
+
+def run(args, poi):
+    samples = []
+    failures = []
+    refreshes = None
+    for cycle in range(1, args.cycles + 1):
+        if args.reset_every and cycle % args.reset_every == 0:
+            poi.reset()
+            time.sleep(args.boot_time)
+            refreshes = None  # the counters start again
+
+        if refreshes is None:
+            first = poi.metrics()
+            if first is None:
+                failures.append("cycle %d: no metrics from the poi" % cycle)
+                break
+            refreshes = first.get(("magicpoi_refreshes_total", None), 0)
+
+        start = time.monotonic()
+        poi.command("refresh")
+        values = None
+        while time.monotonic() - start < args.timeout:
+            time.sleep(args.poll)
+            values = poi.metrics()
+            if values and values.get(("magicpoi_refreshes_total", None), 0) > refreshes:
+                break
+            values = None
+        if values is None:
+            failures.append("cycle %d: refresh didn't end within %d s" % (cycle, args.timeout))
+            break
+        refreshes = values[("magicpoi_refreshes_total", None)]
+
+        sample = {"cycle": cycle, "seconds": round(time.monotonic() - start, 2),
+                  "failed_refreshes": values.get(("magicpoi_refresh_failures_total", None), 0)}
+        for name, (metric, label, _, _) in WATCHED.items():
+            sample[name] = values.get((metric, label), 0)
+        samples.append(sample)
+        print("cycle %d: %.1f s, heap %d (block %d), in use: http %d, mounts %d, files %d" % (
+            cycle, sample["seconds"], sample["heap_free"], sample["heap_max_block"],
+            sample["http_requests"], sample["fs_mounts"], sample["open_files"]))
+        for name in RESOURCES:
+            if sample[name] != 0:
+                failures.append("cycle %d: %s still in use after the refresh: %d" % (cycle, name, sample[name]))
+    return samples, failures
+
+
+def check_trends(args, samples):
+    failures = []
+    settled = samples[args.warmup:]
+    if len(settled) < 2:
+        return ["too few cycles after the warmup to see a trend"]
+    allowances = dict(a.split("=") for a in args.allow)
+    print("%-20s %10s %10s %12s" % ("sample", "first", "last", "trend/run"))
+    for name, (_, _, leak, allowance) in WATCHED.items():
+        values = [s[name] for s in settled]
+        change = trend(values) * (len(values) - 1)
+        print("%-20s %10d %10d %+12.1f" % (name, values[0], values[-1], change))
+        if change * leak > float(allowances.get(name, allowance)):
+            failures.append("%s trends %s: %+.1f over %d cycles" % (
+                name, "down" if leak < 0 else "up", change, len(values)))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial port of the poi")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--cycles", type=int, default=1000, help="refreshes to run")
+    parser.add_argument("--reset-every", type=int, default=0, metavar="N",
+                        help="reset the poi every N cycles (0 = never)")
+    parser.add_argument("--boot-time", type=float, default=8.0,
+                        help="seconds to wait after a reset for WiFi and the first load")
+    parser.add_argument("--timeout", type=int, default=60, help="seconds a refresh may take")
+    parser.add_argument("--poll", type=float, default=1.0, help="seconds between metrics polls")
+    parser.add_argument("--warmup", type=int, default=10,
+                        help="cycles left out of the trends, while the heap settles")
+    parser.add_argument("--allow", action="append", default=[], metavar="SAMPLE=AMOUNT",
+                        help="allowed change over the run, e.g. heap_free=2048")
+    parser.add_argument("--csv", metavar="FILE", help="write every sample to FILE")
+    parser.add_argument("--verbose", action="store_true", help="copy the poi's log to stderr")
+    args = parser.parse_args()
+
+    poi = Poi(args.port, args.baud, args.verbose)
+    try:
+        samples, failures = run(args, poi)
+    except KeyboardInterrupt:
+        print("interrupted", file=sys.stderr)
+        return 1
+
+    if args.csv and samples:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(samples[0]))
+            writer.writeheader()
+            writer.writerows(samples)
+
+    failures += check_trends(args, samples)
+    for failure in failures:
+        print("FAIL: " + failure, file=sys.stderr)
+    print("%d cycles, %s" % (len(samples), "FAILED" if failures else "passed"))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Magic Poi Lite server api.
+
+Serves the three endpoints the firmware uses, so Authentication and Loading
+can be exercised on a LAN without touching magicpoi.circusscientist.com:
+
+    POST /api/login
+    GET  /lite/api/get-current-timeline-number
+    GET  /lite/api/load-timeline?number=N
+
+Point the poi at it by setting serverIP / serverPort in src/secrets.h to the
+address of the machine running this script, e.g.
+
+    python3 tools/standin_server.py --port 8080 --latency 200 --bandwidth 4000
+
+Faults can be injected per endpoint (--error login=500, --truncate 0.5,
+--fail-every 3) and large timelines generated with --events. Every request
+is logged with its duration, and each refresh (timeline number followed by
+load-timeline from the same device) is reported with its total latency.
+Press Ctrl-C (or send SIGTERM) for a summary.
+
+Standard library only.
+"""
+
+import argparse
+import json
+import random
+import signal
+import statistics
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlparse
+
+ENDPOINTS = {
+    "/api/login": "login",
+    "/lite/api/get-current-timeline-number": "number",
+    "/lite/api/load-timeline": "timeline",
+}
+
+TOKEN = "standin.jwt.token"
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--latency", type=int, default=0,
+                        help="delay before each response, in ms")
+    parser.add_argument("--jitter", type=int, default=0,
+                        help="random extra delay up to this many ms")
+    parser.add_argument("--bandwidth", type=int, default=0,
+                        help="limit response bodies to this many bytes/s (0 = unlimited)")
+    parser.add_argument("--error", action="append", default=[], metavar="ENDPOINT=CODE",
+                        help="always answer ENDPOINT (login, number, timeline) with CODE")
+    parser.add_argument("--fail-every", type=int, default=0, metavar="N",
+                        help="answer every Nth request with a 500")
+    parser.add_argument("--truncate", type=float, default=0.0, metavar="FRACTION",
+                        help="only send this fraction of the load-timeline body, then close")
+    parser.add_argument("--timeline", metavar="FILE",
+                        help="timeline JSON to serve (default: generated)")
+    parser.add_argument("--events", type=int, default=20,
+                        help="number of events in the generated timeline")
+    parser.add_argument("--interval", type=int, default=1000,
+                        help="ms between generated events")
+    parser.add_argument("--number", default="0",
+                        help="timeline number to report")
+    return parser.parse_args()
+
+
+def generated_timeline(events, interval):
+    return {str(i * interval): [i % 7, 0, 0] for i in range(events)}
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = {name: [] for name in ENDPOINTS.values()}
+        self.failures = {name: 0 for name in ENDPOINTS.values()}
+        self.refresh_start = {}
+        self.refreshes = []
+        self.count = 0
+
+    def next_count(self):
+        with self.lock:
+            self.count += 1
+            return self.count
+
+    def record(self, client, name, code, ms):
+        with self.lock:
+            self.requests[name].append(ms)
+            if code >= 400 or code == 0:
+                self.failures[name] += 1
+            if name in ("login", "number"):
+                self.refresh_start.setdefault(client, time.monotonic() - ms / 1000.0)
+            elif name == "timeline":
+                start = self.refresh_start.pop(client, None)
+                if start is not None:
+                    total = (time.monotonic() - start) * 1000.0
+                    self.refreshes.append((total, code))
+                    return total
+        return None
+
+    def summary(self):
+        lines = ["", "endpoint    requests  failed   min ms   avg ms   max ms"]
+        for name, times in self.requests.items():
+            if times:
+                lines.append("%-10s %9d %7d %8.1f %8.1f %8.1f" % (
+                    name, len(times), self.failures[name],
+                    min(times), statistics.mean(times), max(times)))
+            else:
+                lines.append("%-10s %9d %7d" % (name, 0, 0))
+        ok = [t for t, code in self.refreshes if code == 200]
+        lines.append("refreshes: %d, ok: %d" % (len(self.refreshes), len(ok)))
+        if ok:
+            lines.append("refresh latency ms: min %.1f  median %.1f  max %.1f" % (
+                min(ok), statistics.median(ok), max(ok)))
+        return "\n".join(lines)
+
+
+def make_handler(args, body, stats):
+    errors = {}
+    for item in args.error:
+        name, _, code = item.partition("=")
+        errors[name] = int(code)
+
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *fmt_args):
+            pass
+
+        def do_GET(self):
+            self.handle_api()
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", 0))
+            self.request_body = self.rfile.read(length)
+            self.handle_api()
+
+        def handle_api(self):
+            start = time.monotonic()
+            url = urlparse(self.path)
+            name = ENDPOINTS.get(url.path)
+            if name is None:
+                self.reply(404, b"not found\n", "text/plain")
+                return
+
+            delay = args.latency + (random.randint(0, args.jitter) if args.jitter else 0)
+            time.sleep(delay / 1000.0)
+
+            code = errors.get(name, 200)
+            if args.fail_every and stats.next_count() % args.fail_every == 0:
+                code = 500
+
+            if code != 200:
+                payload, kind = b'{"error":"injected"}', "application/json"
+            elif name == "login":
+                payload, kind = json.dumps({"token": TOKEN}).encode(), "application/json"
+            elif name == "number":
+                if self.headers.get("Authorization") != "Bearer " + TOKEN:
+                    code, payload, kind = 401, b'{"error":"bad token"}', "application/json"
+                else:
+                    payload, kind = args.number.encode(), "text/plain"
+            else:
+                if self.headers.get("Authorization") != "Bearer " + TOKEN:
+                    code, payload, kind = 401, b'{"error":"bad token"}', "application/json"
+                else:
+                    payload, kind = body, "application/json"
+
+            truncate = name == "timeline" and code == 200 and args.truncate > 0
+            sent = self.reply(code, payload, kind, truncate)
+            ms = (time.monotonic() - start) * 1000.0
+            refresh = stats.record(self.client_address[0], name, code if sent else 0, ms)
+
+            line = "%s %-8s %s %d %6.1f ms %d bytes" % (
+                self.client_address[0], name, self.command, code, ms, len(payload))
+            if truncate:
+                line += " (truncated)"
+            if refresh is not None:
+                line += "  refresh %.1f ms" % refresh
+            print(line, flush=True)
+
+        def reply(self, code, payload, kind, truncate=False):
+            try:
+                self.send_response(code)
+                self.send_header("Content-Type", kind)
+                self.send_header("Content-Length", str(len(payload)))
+                self.end_headers()
+                if truncate:
+                    payload = payload[:int(len(payload) * args.truncate)]
+                    self.close_connection = True
+                self.send_body(payload)
+                return True
+            except (BrokenPipeError, ConnectionResetError):
+                return False
+
+        def send_body(self, payload):
+            if not args.bandwidth:
+                self.wfile.write(payload)
+                return
+            chunk = max(1, args.bandwidth // 20)
+            for i in range(0, len(payload), chunk):
+                self.wfile.write(payload[i:i + chunk])
+                self.wfile.flush()
+                time.sleep(len(payload[i:i + chunk]) / float(args.bandwidth))
+
+    return Handler
+
+
+def stop(signum, frame):
+    raise KeyboardInterrupt
+
+
+def main():
+    signal.signal(signal.SIGTERM, stop)
+    args = parse_args()
+    if args.timeline:
+        with open(args.timeline, "rb") as f:
+            body = f.read()
+        json.loads(body)
+    else:
+        body = json.dumps(generated_timeline(args.events, args.interval)).encode()
+
+    stats = Stats()
+    server = ThreadingHTTPServer((args.host, args.port), make_handler(args, body, stats))
+    print("stand-in api on %s:%d, timeline %d bytes" % (args.host, args.port, len(body)), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+    print(stats.summary())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,452 @@
+#!/usr/bin/env python3
+"""Troupe sync leader on a laptop, and a simulator for the sync protocol.
+
+Plays the part of a poi with SYNC_LEADER set (see src/TimelineSync.cpp):
+offers a timeline file to the followers on the LAN over UDP broadcast,
+resends the chunks they are missing and lists who confirmed it, so a show
+can be distributed with no internet at all:
+
+    python3 tools/sync_leader.py timeline.json
+
+Type start, stop or status (and Enter) while it runs; --start-after N sends
+a start once N followers have confirmed the timeline. Followers save the
+file exactly as sent, so use the same JSON the server would send.
+
+With --simulate the same leader and follower logic runs against a simulated
+lossy broadcast network instead, with no hardware, and reports how long a
+troupe of each size takes to get the timeline, how many packets the leader
+sends and how far apart the simulated poi start:
+
+    python3 tools/sync_leader.py timeline.json --simulate 1,2,4,8,16,32 --loss 0.1
+
+Standard library only.
+"""
+
+import argparse
+import collections
+import random
+import selectors
+import socket
+import struct
+import sys
+import time
+
+# keep in step with TimelineSync.h
+MAGIC = 0x6D
+VERSION = 1
+OFFER, CHUNK, NAK, ACK, START, STOP, REQUEST = range(1, 8)
+TYPE_NAMES = {OFFER: "offer", CHUNK: "chunk", NAK: "nak", ACK: "ack", START: "start", STOP: "stop",
+              REQUEST: "request"}
+DEFAULT_PORT = 4210
+CHUNK_SIZE = 512
+MAX_CHUNKS = 32
+OFFER_INTERVAL = 5.0
+CHUNKS_PER_POLL = 4
+NAK_DELAY = 0.150
+NAK_JITTER = 0.100
+MAX_NAKS = 20
+REQUEST_INTERVAL = 1.0
+MAX_REQUESTS = 5
+START_DELAY = 0.500
+START_REPEATS = 5
+START_REPEAT_INTERVAL = 0.040
+
+HEADER = struct.Struct("<BBBBI")
+OFFER_BODY = struct.Struct("<IHH")
+CHUNK_BODY = struct.Struct("<HH")
+NAK_BODY = struct.Struct("<I")
+START_BODY = struct.Struct("<HH")
+STOP_BODY = struct.Struct("<H")
+
+
+def make_crc_table():
+    table = []
+    for byte in range(256):
+        crc = byte << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7 if crc & 0x80000000 else crc << 1) & 0xFFFFFFFF
+        table.append(crc)
+    return table
+
+
+CRC_TABLE = make_crc_table()
+
+
+def crc32(data, crc=0xFFFFFFFF):
+    # same as crc32() in the ESP8266 core (coredecls.h): MSB first, no final xor
+    for byte in data:
+        crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ byte]
+    return crc
+
+
+def all_chunks(count):
+    return (1 << count) - 1
+
+
+def packet(kind, hash_, body=b""):
+    return HEADER.pack(MAGIC, VERSION, kind, 0, hash_) + body
+
+
+def parse(data):
+    if len(data) < HEADER.size:
+        return None
+    magic, version, kind, _, hash_ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        return None
+    return kind, hash_, data[HEADER.size:]
+
+
+class Leader:
+    """The leader side of the protocol. send(data, address) sends a packet, address None broadcasts."""
+
+    def __init__(self, data, send, now):
+        if not data or len(data) > MAX_CHUNKS * CHUNK_SIZE:
+            raise ValueError("timeline must be 1 to %d bytes" % (MAX_CHUNKS * CHUNK_SIZE))
+        self.data = data
+        self.send = send
+        self.hash = crc32(data)
+        self.chunk_count = (len(data) + CHUNK_SIZE - 1) // CHUNK_SIZE
+        self.send_mask = all_chunks(self.chunk_count)
+        self.last_offer = now - OFFER_INTERVAL
+        self.confirmed = []
+        self.seq = random.getrandbits(16)
+        self.command = START
+        self.repeats_left = 0
+        self.last_repeat = now
+        self.start_at = None
+        self.sent = collections.Counter()
+
+    def emit(self, kind, body=b"", address=None):
+        self.sent[TYPE_NAMES[kind]] += 1
+        self.send(packet(kind, self.hash, body), address)
+
+    def handle(self, data, address, now):
+        parsed = parse(data)
+        if parsed is None:
+            return
+        kind, hash_, body = parsed
+        if kind == NAK and hash_ == self.hash and len(body) >= NAK_BODY.size:
+            self.send_mask |= NAK_BODY.unpack_from(body)[0] & all_chunks(self.chunk_count)
+        elif kind in (ACK, REQUEST) and hash_ == self.hash:
+            if address not in self.confirmed:
+                self.confirmed.append(address)
+                return address  # newly confirmed
+        elif kind == REQUEST:
+            self.last_offer = now - OFFER_INTERVAL
+        return None
+
+    def poll(self, now):
+        if now - self.last_offer >= OFFER_INTERVAL:
+            self.emit(OFFER, OFFER_BODY.pack(len(self.data), self.chunk_count, CHUNK_SIZE))
+            self.last_offer = now
+        for _ in range(CHUNKS_PER_POLL):
+            if not self.send_mask:
+                break
+            index = (self.send_mask & -self.send_mask).bit_length() - 1
+            self.send_mask &= ~(1 << index)
+            chunk = self.data[index * CHUNK_SIZE:(index + 1) * CHUNK_SIZE]
+            self.emit(CHUNK, CHUNK_BODY.pack(index, len(chunk)) + chunk)
+        if self.repeats_left > 0 and now - self.last_repeat >= START_REPEAT_INTERVAL:
+            if self.command == START:
+                delay = max(0, int(round((self.start_at - now) * 1000)))
+                self.emit(START, START_BODY.pack(self.seq, delay))
+            else:
+                self.emit(STOP, STOP_BODY.pack(self.seq))
+            self.repeats_left -= 1
+            self.last_repeat = now
+
+    def start(self, now):
+        self.seq = (self.seq + 1) & 0xFFFF
+        self.command = START
+        self.repeats_left = START_REPEATS
+        self.last_repeat = now - START_REPEAT_INTERVAL
+        self.start_at = now + START_DELAY
+
+    def stop(self, now):
+        self.seq = (self.seq + 1) & 0xFFFF
+        self.command = STOP
+        self.repeats_left = START_REPEATS
+        self.last_repeat = now - START_REPEAT_INTERVAL
+        self.start_at = None
+
+
+class Follower:
+    """The follower side of the protocol, as in TimelineSync.cpp, for the simulator."""
+
+    def __init__(self, send, rng):
+        self.send = send
+        self.rng = rng
+        self.hash = 0
+        self.data = None
+        self.leader = None
+        self.receiving = None  # [hash, size, chunk count, buffer, received mask]
+        self.last_activity = 0.0
+        self.nak_wait = NAK_DELAY
+        self.naks = 0
+        self.total_naks = 0
+        self.last_request = None
+        self.requests_left = 0
+        self.last_seq = None
+        self.start_at = None
+        self.started_at = None
+        self.received_at = None
+
+    def handle(self, data, address, now):
+        parsed = parse(data)
+        if parsed is None:
+            return
+        kind, hash_, body = parsed
+        if kind == OFFER and len(body) >= OFFER_BODY.size:
+            self.leader = address
+            self.requests_left = 0
+            size, count, chunk_size = OFFER_BODY.unpack_from(body)
+            if hash_ == self.hash:
+                self.send(packet(ACK, self.hash), address)
+            elif self.receiving and self.receiving[0] == hash_:
+                pass
+            elif size and chunk_size == CHUNK_SIZE and count <= MAX_CHUNKS and count == (size + CHUNK_SIZE - 1) // CHUNK_SIZE:
+                self.receiving = [hash_, size, count, bytearray(size), 0]
+                self.last_activity = now
+                self.nak_wait = NAK_DELAY + self.rng.random() * NAK_JITTER
+                self.naks = 0
+        elif kind == CHUNK and len(body) >= CHUNK_BODY.size:
+            if self.receiving and self.receiving[0] == hash_:
+                self.chunk(body, now)
+            elif hash_ != self.hash:
+                self.request(now)
+        elif kind in (START, STOP) and len(body) >= STOP_BODY.size:
+            seq = STOP_BODY.unpack_from(body)[0]
+            if seq == self.last_seq:
+                return
+            self.last_seq = seq
+            if kind == STOP:
+                self.start_at = None
+            else:
+                delay = START_BODY.unpack_from(body)[1] if len(body) >= START_BODY.size else 0
+                self.start_at = now + delay / 1000.0
+
+    def chunk(self, body, now):
+        hash_, size, count, buffer, mask = self.receiving
+        index, length = CHUNK_BODY.unpack_from(body)
+        offset = index * CHUNK_SIZE
+        if index >= count or length != min(CHUNK_SIZE, size - offset) or len(body) < CHUNK_BODY.size + length:
+            return
+        buffer[offset:offset + length] = body[CHUNK_BODY.size:CHUNK_BODY.size + length]
+        self.receiving[4] = mask | (1 << index)
+        self.last_activity = now
+        self.naks = 0
+        if self.receiving[4] == all_chunks(count):
+            if crc32(buffer) == hash_:
+                self.hash = hash_
+                self.data = bytes(buffer)
+                self.received_at = now
+                self.send(packet(ACK, self.hash), self.leader)
+                self.send(packet(ACK, self.hash), self.leader)
+            self.receiving = None
+
+    def request(self, now):
+        idle = self.requests_left == 0
+        self.requests_left = MAX_REQUESTS
+        if idle or now - self.last_request >= REQUEST_INTERVAL:
+            self.send_request(now)
+
+    def send_request(self, now):
+        self.last_request = now
+        self.requests_left -= 1
+        self.send(packet(REQUEST, self.hash), None)
+
+    def poll(self, now):
+        if self.receiving and now - self.last_activity >= self.nak_wait:
+            if self.naks >= MAX_NAKS:
+                self.receiving = None
+            else:
+                missing = all_chunks(self.receiving[2]) & ~self.receiving[4]
+                self.send(packet(NAK, self.receiving[0], NAK_BODY.pack(missing)), self.leader)
+                self.naks += 1
+                self.total_naks += 1
+                self.last_activity = now
+                self.nak_wait = NAK_DELAY + self.rng.random() * NAK_JITTER
+        elif not self.receiving and self.requests_left > 0 and now - self.last_request >= REQUEST_INTERVAL:
+            self.send_request(now)
+        if self.start_at is not None and now >= self.start_at:
+            self.started_at = now
+            self.start_at = None
+
+
+def simulate(data, size, loss, latency, seed, tick=0.005, limit=60.0):
+    """Runs a leader and size followers on a simulated broadcast network, returns the results."""
+    rng = random.Random(seed)
+    in_flight = []  # (delivery time, order, receiver, data, sender)
+    order = [0]
+
+    def sender(name):
+        def send(data, address):
+            receivers = ["leader"] + ["f%d" % i for i in range(size)] if address is None else [address]
+            for receiver in receivers:
+                if receiver != name and rng.random() >= loss:
+                    order[0] += 1
+                    in_flight.append((now[0] + latency, order[0], receiver, data, name))
+        return send
+
+    now = [0.0]
+    leader = Leader(data, sender("leader"), now[0])
+    followers = {"f%d" % i: Follower(sender("f%d" % i), random.Random(rng.random())) for i in range(size)}
+    nodes = dict(followers, leader=leader)
+    received_at = None
+    done_at = None
+    while now[0] < limit:
+        in_flight.sort()
+        while in_flight and in_flight[0][0] <= now[0]:
+            _, _, receiver, packet_data, source = in_flight.pop(0)
+            nodes[receiver].handle(packet_data, source, now[0])
+        leader.poll(now[0])
+        for follower in followers.values():
+            follower.poll(now[0])
+        if received_at is None and all(f.hash == leader.hash for f in followers.values()):
+            received_at = now[0]
+        if done_at is None and len(leader.confirmed) == size:
+            done_at = now[0]
+            leader.start(now[0])
+        if done_at is not None and all(f.started_at is not None for f in followers.values()) and leader.repeats_left == 0:
+            break
+        now[0] += tick
+
+    starts = [f.started_at for f in followers.values() if f.started_at is not None]
+    return {
+        "received_at": received_at,
+        "done": done_at,
+        "received": sum(1 for f in followers.values() if f.hash == leader.hash),
+        "sent": leader.sent,
+        "naks": sum(f.total_naks for f in followers.values()),
+        "start_spread": (max(starts) - min(starts)) if len(starts) == size else None,
+        "start_error": (max(abs(s - leader.start_at) for s in starts)) if len(starts) == size else None,
+    }
+
+
+def run_simulation(args, data):
+    sizes = [int(s) for s in args.simulate.split(",")]
+    print("timeline %d bytes in %d chunks, loss %.0f%%, latency %d ms" % (
+        len(data), (len(data) + CHUNK_SIZE - 1) // CHUNK_SIZE, args.loss * 100, args.latency))
+    print("%6s %10s %10s %12s %8s %8s %14s" % (
+        "poi", "all have", "confirmed", "leader sent", "resent", "NAKs", "start spread"))
+    chunk_count = (len(data) + CHUNK_SIZE - 1) // CHUNK_SIZE
+
+    def ms(seconds, width):
+        return "%*.0f ms" % (width - 3, seconds * 1000) if seconds is not None else "%*s" % (width, "never")
+
+    for size in sizes:
+        result = simulate(data, size, args.loss, args.latency / 1000.0, args.seed)
+        spread = "%11.1f ms" % (result["start_spread"] * 1000) if result["start_spread"] is not None else "   some missed"
+        sent = sum(result["sent"].values())
+        print("%6d %10s %10s %12d %8d %8d %14s" % (
+            size, ms(result["received_at"], 10), ms(result["done"], 10), sent,
+            max(0, result["sent"]["chunk"] - chunk_count), result["naks"], spread))
+    return 0
+
+
+def run_leader(args, data):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+    sock.bind(("", args.port))
+    sock.setblocking(False)
+
+    def send(packet_data, address):
+        sock.sendto(packet_data, (args.broadcast, args.port) if address is None else address)
+
+    leader = Leader(data, send, time.monotonic())
+    print("leader on UDP port %d, timeline %08x, %d bytes in %d chunks" % (
+        args.port, leader.hash, len(data), leader.chunk_count), flush=True)
+    selector = selectors.DefaultSelector()
+    selector.register(sock, selectors.EVENT_READ)
+    selector.register(sys.stdin, selectors.EVENT_READ)
+    started = False
+    try:
+        while True:
+            for key, _ in selector.select(0.01):
+                now = time.monotonic()
+                if key.fileobj is sock:
+                    try:
+                        packet_data, address = sock.recvfrom(2048)
+                    except BlockingIOError:
+                        continue
+                    if address[0] in local_addresses():
+                        continue  # our own broadcast
+                    if leader.handle(packet_data, address, now):
+                        print("%s has the timeline, %d followers confirmed" % (address[0], len(leader.confirmed)),
+                              flush=True)
+                else:
+                    line = sys.stdin.readline()
+                    if not line:
+                        selector.unregister(sys.stdin)
+                        continue
+                    command = line.strip()
+                    if command == "start":
+                        leader.start(now)
+                        print("starting in %d ms" % (START_DELAY * 1000), flush=True)
+                    elif command == "stop":
+                        leader.stop(now)
+                        print("stopping", flush=True)
+                    elif command == "status":
+                        print("timeline %08x, confirmed by: %s" % (
+                            leader.hash, ", ".join(a[0] for a in leader.confirmed) or "nobody"), flush=True)
+                    elif command:
+                        print("commands: start, stop, status", flush=True)
+            now = time.monotonic()
+            if args.start_after and not started and len(leader.confirmed) >= args.start_after:
+                started = True
+                leader.start(now)
+                print("%d followers confirmed, starting in %d ms" % (len(leader.confirmed), START_DELAY * 1000),
+                      flush=True)
+            leader.poll(now)
+    except KeyboardInterrupt:
+        pass
+    print("sent: %s" % ", ".join("%s %d" % item for item in sorted(leader.sent.items())))
+    return 0
+
+
+_local = None
+
+
+def local_addresses():
+    global _local
+    if _local is None:
+        _local = {"127.0.0.1"}
+        try:
+            _local.update(info[4][0] for info in socket.getaddrinfo(socket.gethostname(), None, socket.AF_INET))
+        except OSError:
+            pass
+    return _local
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("timeline", help="timeline file to distribute, as the server sends it")
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT, help="UDP port (SYNC_PORT on the poi)")
+    parser.add_argument("--broadcast", default="255.255.255.255",
+                        help="broadcast address of the LAN, e.g. 192.168.1.255")
+    parser.add_argument("--start-after", type=int, default=0, metavar="N",
+                        help="start the show once N followers have confirmed the timeline")
+    parser.add_argument("--simulate", metavar="SIZES",
+                        help="simulate troupes of these sizes (comma separated) instead of using the network")
+    parser.add_argument("--loss", type=float, default=0.05,
+                        help="simulated chance of losing each packet at each receiver")
+    parser.add_argument("--latency", type=int, default=5, help="simulated mean latency, in ms")
+    parser.add_argument("--seed", type=int, default=1, help="random seed for the simulation")
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    with open(args.timeline, "rb") as f:
+        data = f.read()
+    if not data or len(data) > MAX_CHUNKS * CHUNK_SIZE:
+        print("timeline must be 1 to %d bytes" % (MAX_CHUNKS * CHUNK_SIZE), file=sys.stderr)
+        return 1
+    if args.simulate:
+        return run_simulation(args, data)
+    return run_leader(args, data)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
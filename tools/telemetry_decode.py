@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Decode the binary telemetry stream from the poi into CSV.
+
+Build the firmware with TELEMETRY defined in secrets.h, then:
+
+    python3 tools/telemetry_decode.py /dev/ttyUSB0 > show.csv   # live (needs pyserial)
+    python3 tools/telemetry_decode.py capture.bin > show.csv    # from a saved capture
+    cat /dev/ttyUSB0 | python3 tools/telemetry_decode.py -      # from stdin
+
+Frames are picked out of the normal text log (see src/Telemetry.cpp for the
+format) and checked with their CRC-8. Each frame becomes one CSV row; the
+device timestamp is unwrapped into a continuous time in microseconds. Use
+--text to copy the text log to stderr.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+SYNC = 0xA5
+OVERHEAD = 8  # sync, event, length, timestamp (4), crc
+
+PHASES = {1: "auth", 2: "number", 3: "download", 4: "save", 5: "decode"}
+ENDPOINTS = {1: "login", 2: "number", 3: "timeline"}
+
+# event id: (name, payload struct format, field names) - keep in step with src/Telemetry.h
+EVENTS = {
+    1: ("cue", "<HBh", ("index", "colour", "lateness_ms")),
+    2: ("load_phase", "<BBI", ("phase", "ok", "duration_ms")),
+    3: ("heap", "<IIB", ("free", "max_block", "fragmentation")),
+    4: ("net", "<BhII", ("endpoint", "code", "bytes", "duration_ms")),
+    5: ("dropped", "<H", ("dropped",)),
+}
+
+COLUMNS = ["time_us", "event"]
+for _, _, names in EVENTS.values():
+    COLUMNS.extend(n for n in names if n not in COLUMNS)
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+class Decoder:
+    def __init__(self, text_out=None):
+        self.buffer = bytearray()
+        self.text_out = text_out
+        self.last_timestamp = None
+        self.wraps = 0
+        self.bad_frames = 0
+
+    def feed(self, data):
+        """Adds bytes and yields decoded rows."""
+        self.buffer.extend(data)
+        while True:
+            start = self.buffer.find(bytes([SYNC]))
+            if start < 0:
+                self.text(self.buffer)
+                self.buffer.clear()
+                return
+            self.text(self.buffer[:start])
+            del self.buffer[:start]
+            if len(self.buffer) < 3:
+                return  # wait for the header
+            if not self.plausible(self.buffer[1], self.buffer[2]):
+                self.text(self.buffer[:1])  # a 0xA5 in the text log, not a frame
+                del self.buffer[:1]
+                continue
+            if len(self.buffer) < OVERHEAD + self.buffer[2]:
+                return  # wait for the rest of the frame
+            frame = bytes(self.buffer[:OVERHEAD + self.buffer[2]])
+            if crc8(frame[1:-1]) != frame[-1]:
+                self.bad_frames += 1
+                del self.buffer[:1]  # resync on the next sync byte
+                continue
+            del self.buffer[:len(frame)]
+            yield self.decode(frame)
+
+    @staticmethod
+    def plausible(event, length):
+        return event in EVENTS and length == struct.calcsize(EVENTS[event][1])
+
+    def decode(self, frame):
+        event, length, timestamp = struct.unpack_from("<BBI", frame, 1)
+        if self.last_timestamp is not None and timestamp < self.last_timestamp:
+            self.wraps += 1  # micros() wraps every ~71 minutes
+        self.last_timestamp = timestamp
+        name, fmt, names = EVENTS[event]
+        row = {"time_us": timestamp + (self.wraps << 32), "event": name}
+        values = struct.unpack(fmt, frame[7:7 + length])
+        row.update(zip(names, values))
+        if "phase" in row:
+            row["phase"] = PHASES.get(row["phase"], row["phase"])
+        if "endpoint" in row:
+            row["endpoint"] = ENDPOINTS.get(row["endpoint"], row["endpoint"])
+        return row
+
+    def text(self, data):
+        if self.text_out and data:
+            self.text_out.write(data.decode("ascii", "replace"))
+            self.text_out.flush()
+
+
+def open_input(path, baud):
+    if path == "-":
+        return sys.stdin.buffer, None
+    if path.startswith("/dev/") or path.upper().startswith("COM"):
+        try:
+            import serial
+        except ImportError:
+            sys.exit("reading a serial port needs pyserial: pip install pyserial")
+        port = serial.Serial(path, baud, timeout=0.1)
+        return port, port
+    return open(path, "rb"), None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("input", help="serial port, capture file, or - for stdin")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--text", action="store_true", help="copy the text log to stderr")
+    args = parser.parse_args()
+
+    source, port = open_input(args.input, args.baud)
+    decoder = Decoder(sys.stderr if args.text else None)
+    writer = csv.DictWriter(sys.stdout, COLUMNS)
+    writer.writeheader()
+    try:
+        while True:
+            data = source.read(256) if port else source.read1(4096)
+            if not data:
+                if port:
+                    continue
+                break
+            for row in decoder.feed(data):
+                writer.writerow(row)
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    if decoder.bad_frames:
+        print("%d bad frames skipped" % decoder.bad_frames, file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
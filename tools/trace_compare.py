@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Compare refresh traces from two firmware builds, phase by phase.
+
+Save the output of the `trace` command on the Serial monitor (or of
+GET /trace on the local server) for each build, then:
+
+    python3 tools/trace_compare.py before.csv after.csv
+
+Each trace is the CSV from src/Tracer.cpp, headed with the build it came
+from. Refreshes that didn't load a timeline are left out, and the median of
+each phase is shown for both builds with the change, so a regression in DNS,
+a server request, the LittleFS write or decoding stands out. Text around the
+trace (the rest of the Serial log) is skipped. With one file, its medians are
+shown on their own.
+"""
+
+import argparse
+import statistics
+import sys
+
+# keep in step with src/Tracer.h
+PHASES = ["total", "dns", "login_first_byte", "login_body", "number_first_byte", "number_body",
+          "timeline_first_byte", "timeline_body", "save", "decode"]
+
+
+def read_trace(path):
+    """Returns the build and the refreshes (dicts of phase name to microseconds) in a trace dump."""
+    build = "?"
+    columns = None
+    refreshes = []
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("# trace build="):
+                build = line[len("# trace build="):]
+                refreshes = []  # keep the last dump in the file
+                columns = None
+            elif line.startswith("refresh,"):
+                columns = [c[:-3] if c.endswith("_us") else c for c in line.split(",")]
+            elif columns and line and line[0].isdigit():
+                fields = line.split(",")
+                if len(fields) != len(columns):
+                    continue
+                row = dict(zip(columns, fields))
+                if row.get("ok") == "1":
+                    refreshes.append({p: int(row[p]) for p in PHASES if p in row})
+    return build, refreshes
+
+
+def medians(refreshes):
+    return {p: statistics.median(r[p] for r in refreshes) for p in PHASES if refreshes and p in refreshes[0]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("before", help="trace from the first build")
+    parser.add_argument("after", nargs="?", help="trace from the second build")
+    args = parser.parse_args()
+
+    traces = [read_trace(args.before)] + ([read_trace(args.after)] if args.after else [])
+    for path, (build, refreshes) in zip([args.before, args.after], traces):
+        print("%s: build %s, %d successful refreshes" % (path, build, len(refreshes)))
+        if not refreshes:
+            print("no successful refreshes in %s" % path, file=sys.stderr)
+            return 1
+
+    before = medians(traces[0][1])
+    if len(traces) == 1:
+        print("%-20s %12s" % ("phase (median)", "ms"))
+        for phase in PHASES:
+            print("%-20s %12.1f" % (phase, before.get(phase, 0) / 1000))
+        return 0
+
+    after = medians(traces[1][1])
+    print("%-20s %12s %12s %12s %8s" % ("phase (median)", "before ms", "after ms", "change ms", "change"))
+    for phase in PHASES:
+        b = before.get(phase, 0)
+        a = after.get(phase, 0)
+        percent = "%+7.0f%%" % ((a - b) * 100 / b) if b else "       -"
+        print("%-20s %12.1f %12.1f %+12.1f %s" % (phase, b / 1000, a / 1000, (a - b) / 1000, percent))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())